@@ -3,6 +3,8 @@
 #include "lib391/ece391support.h"
 #include "lib391/ece391sysnum.h"
 
+#define TRUNCATE_FILE 4 /* file ioctl, arg is the new length */
+
 uint32_t power_ten( int pow);
 
 int32_t string_to_int(uint8_t * args );
@@ -41,18 +43,21 @@ int main() {
     int len = 1;
 
 
-     if ( (fd = ece391_open(name) ) != -1 )
+     if ( (fd = ece391_open(name) ) == -1 )
     {
-    ece391_ioctl(-1, 2, fd); /* File exists. Update file position*/
-    ece391_ioctl(-1,3,fd); /* Set to Delete Mode */
-    } else {
-        ece391_ioctl(-1,0, name); /* File doesn't exist. Update file position*/
+        ece391_ioctl(-1,0, name); /* File doesn't exist. Create it*/
         fd = ece391_open(name);
     }
-    if (string_to_int(args) == -1) {
+    int32_t count = string_to_int(args);
+    if (count == -1) {
         return 3;
     }
-    if (0 == ece391_write(fd, (uint8_t * )"\0",string_to_int(args ) )) return 3;
+    ece391_stat_t stat;
+    if (-1 == ece391_fstat(fd, &stat)) return 3;
+    if (0 == stat.size || 0 == count) return 3; /* Nothing to delete */
+
+    /* Drop the last count bytes */
+    if (-1 == ece391_ioctl(fd, TRUNCATE_FILE, (stat.size > (uint32_t)count) ? stat.size - count : 0)) return 3;
 
     ece391_close(fd);
     return 0;
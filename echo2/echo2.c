@@ -35,7 +35,7 @@ int main() {
     args[arg_counter++] = 0;
     if ( (fd = ece391_open(name) ) != -1 )
     {
-    ece391_ioctl(-1, 2, fd); /* File exists. Update file position*/
+    ece391_lseek(fd, 0, SEEK_END); /* File exists. Append at its end*/
     } else {
         ece391_ioctl(-1,0, name); /* File doesn't exist. Update file position*/
         fd = ece391_open(name);
@@ -0,0 +1,386 @@
+#include "ece391syscall.h"
+
+/*
+ * User space heap allocator. The heap is grown from the kernel a region
+ * at a time through ece391_sbrk(), so most calls to ece391_malloc() and
+ * ece391_free() never trap into the kernel.
+ *
+ * Small requests (<= SMALL_MAX_SIZE) are served from per size class bins.
+ * Each bin owns whole pages; freed objects go on a LIFO free list that is
+ * checked first, so the common case is a single pointer pop or push.
+ *
+ * Large requests are served from spans of whole pages using boundary tags
+ * (a size word before and after every block) so neighbouring free blocks
+ * coalesce on free. Free large blocks are kept on lists segregated by
+ * log2(size), with a bitmap of non-empty lists searched with bsf.
+ */
+
+#define HEAP_PAGE_SIZE      4096
+#define HEAP_PAGE_SHIFT     12
+#define HEAP_MAX_PAGES      1024            /* Matches the 4MB kernel heap window */
+#define HEAP_GROW_PAGES     16              /* Pages requested per sbrk call */
+
+#define HEAP_ALIGN          8
+#define SMALL_MAX_SIZE      256
+#define NUM_SMALL_BINS      10
+#define SMALL_LOOKUP_SIZE   (SMALL_MAX_SIZE / HEAP_ALIGN + 1)
+
+#define LARGE_SPAN_PAGES    4               /* Minimum pages carved per large span */
+#define LARGE_MIN_BLOCK     16              /* Header, two list pointers, footer */
+#define LARGE_TAG_SIZE      4
+#define LARGE_MIN_LOG2      8
+#define NUM_LARGE_LISTS     16
+#define TAG_ALLOC           0x1
+#define TAG_SIZE_MASK       (~(uint32_t)(HEAP_ALIGN - 1))
+
+/* Owner of each heap page, used by ece391_free() to find the allocator */
+#define PAGE_UNUSED         0
+#define PAGE_LARGE          0xFF            /* Small bins store their index + 1 */
+
+/* Free object in a small bin */
+typedef struct small_obj_t {
+    struct small_obj_t* next;
+} small_obj_t;
+
+/* Small size class bin */
+typedef struct small_bin_t {
+    small_obj_t* free_list;     /* Freed objects, reused first */
+    uint8_t* bump;              /* Next never-used object in the current page */
+    uint8_t* bump_end;          /* End of the current page */
+} small_bin_t;
+
+/* Free large block, header word is followed by the list links */
+typedef struct large_block_t {
+    uint32_t tag;
+    struct large_block_t* next;
+    struct large_block_t* prev;
+} large_block_t;
+
+static const uint16_t small_bin_sizes[NUM_SMALL_BINS] = { 8, 16, 24, 32, 48, 64, 96, 128, 192, 256 };
+
+static small_bin_t small_bins[NUM_SMALL_BINS];
+static uint8_t small_lookup[SMALL_LOOKUP_SIZE];
+
+static large_block_t* large_lists[NUM_LARGE_LISTS];
+static uint32_t large_list_mask;
+
+static uint8_t page_owner[HEAP_MAX_PAGES];
+static uint8_t* heap_base;      /* First heap address, NULL until initialized */
+static uint8_t* heap_top;       /* End of pages handed to the bins and spans */
+static uint8_t* heap_brk;       /* End of pages mapped by the kernel */
+
+static int32_t heap_init(void);
+static uint8_t* heap_take_pages(uint32_t num_pages, uint8_t owner);
+static void* small_alloc(uint32_t bin);
+static void* large_alloc(uint32_t size);
+static void large_free(large_block_t* block);
+static void large_list_push(large_block_t* block);
+static void large_list_remove(large_block_t* block);
+
+/**
+ * @brief Index of the lowest set bit, num must be non-zero
+*/
+static inline uint32_t bsf(uint32_t num)
+{
+    uint32_t idx;
+    asm volatile ("bsfl %1, %0" : "=r"(idx) : "rm"(num) : "cc");
+    return idx;
+}
+
+/**
+ * @brief Index of the highest set bit, num must be non-zero
+*/
+static inline uint32_t bsr(uint32_t num)
+{
+    uint32_t idx;
+    asm volatile ("bsrl %1, %0" : "=r"(idx) : "rm"(num) : "cc");
+    return idx;
+}
+
+void* ece391_malloc (uint32_t nbytes)
+{
+    if (nbytes == 0 || nbytes > HEAP_MAX_PAGES * HEAP_PAGE_SIZE) {
+        return NULL;
+    }
+
+    if (heap_base == NULL && heap_init() == -1) {
+        return NULL;
+    }
+
+    if (nbytes <= SMALL_MAX_SIZE) {
+        return small_alloc(small_lookup[(nbytes + HEAP_ALIGN - 1) / HEAP_ALIGN]);
+    }
+
+    return large_alloc(nbytes);
+}
+
+int32_t ece391_free (void* ptr)
+{
+    uint8_t* addr = (uint8_t*)ptr;
+
+    /* Freeing NULL is a no-op */
+    if (addr == NULL) {
+        return 0;
+    }
+
+    if (addr < heap_base || addr >= heap_top || ((uint32_t)addr & (HEAP_ALIGN - 1))) {
+        return -1;
+    }
+
+    uint8_t owner = page_owner[(addr - heap_base) >> HEAP_PAGE_SHIFT];
+    if (owner == PAGE_UNUSED) {
+        return -1;
+    }
+
+    /* Fast path: push onto the bin's free list */
+    if (owner != PAGE_LARGE) {
+        small_bin_t* bin = &small_bins[owner - 1];
+        small_obj_t* obj = (small_obj_t*)addr;
+        obj->next = bin->free_list;
+        bin->free_list = obj;
+        return 0;
+    }
+
+    large_block_t* block = (large_block_t*)(addr - LARGE_TAG_SIZE);
+    if (!(block->tag & TAG_ALLOC)) {
+        /* Double free */
+        return -1;
+    }
+
+    large_free(block);
+    return 0;
+}
+
+/**
+ * @brief Build the size lookup table and find the start of the heap
+*/
+static int32_t heap_init(void)
+{
+    int32_t brk = ece391_sbrk(0);
+    if (brk == -1) {
+        return -1;
+    }
+
+    uint32_t i, bin = 0;
+    for (i = 0; i < SMALL_LOOKUP_SIZE; i++) {
+        while (small_bin_sizes[bin] < i * HEAP_ALIGN) {
+            bin++;
+        }
+        small_lookup[i] = bin;
+    }
+
+    heap_base = (uint8_t*)brk;
+    heap_top = heap_base;
+    heap_brk = heap_base;
+    return 0;
+}
+
+/**
+ * @brief Hand out whole pages from the top of the heap, growing the heap
+ *        by at least HEAP_GROW_PAGES when it runs out
+ *
+ * @return First page, NULL if the kernel refused to grow the heap
+*/
+static uint8_t* heap_take_pages(uint32_t num_pages, uint8_t owner)
+{
+    uint32_t needed = num_pages * HEAP_PAGE_SIZE;
+
+    if ((uint32_t)(heap_brk - heap_top) < needed) {
+        uint32_t grow = needed - (heap_brk - heap_top);
+        if (grow < HEAP_GROW_PAGES * HEAP_PAGE_SIZE) {
+            grow = HEAP_GROW_PAGES * HEAP_PAGE_SIZE;
+        }
+
+        /* Fall back to the exact amount near the heap limit */
+        if (ece391_sbrk(grow) == -1) {
+            grow = needed - (heap_brk - heap_top);
+            if (ece391_sbrk(grow) == -1) {
+                return NULL;
+            }
+        }
+        heap_brk += grow;
+    }
+
+    uint8_t* pages = heap_top;
+    uint32_t first = (pages - heap_base) >> HEAP_PAGE_SHIFT;
+    uint32_t i;
+    for (i = 0; i < num_pages; i++) {
+        page_owner[first + i] = owner;
+    }
+
+    heap_top += needed;
+    return pages;
+}
+
+/**
+ * @brief Allocate an object from a small size class bin
+*/
+static void* small_alloc(uint32_t idx)
+{
+    small_bin_t* bin = &small_bins[idx];
+
+    /* Fast path: reuse the most recently freed object */
+    small_obj_t* obj = bin->free_list;
+    if (obj != NULL) {
+        bin->free_list = obj->next;
+        return obj;
+    }
+
+    /* Carve a new object out of the bin's current page */
+    uint32_t size = small_bin_sizes[idx];
+    if (bin->bump + size > bin->bump_end) {
+        uint8_t* page = heap_take_pages(1, idx + 1);
+        if (page == NULL) {
+            return NULL;
+        }
+        bin->bump = page;
+        bin->bump_end = page + HEAP_PAGE_SIZE;
+    }
+
+    void* ptr = bin->bump;
+    bin->bump += size;
+    return ptr;
+}
+
+/* Boundary tag helpers, a block's size includes both tags */
+#define BLOCK_SIZE(block)   ((block)->tag & TAG_SIZE_MASK)
+#define BLOCK_FOOTER(block) ((uint32_t*)((uint8_t*)(block) + BLOCK_SIZE(block) - LARGE_TAG_SIZE))
+#define BLOCK_NEXT(block)   ((large_block_t*)((uint8_t*)(block) + BLOCK_SIZE(block)))
+
+static inline void block_set_tags(large_block_t* block, uint32_t size, uint32_t alloc)
+{
+    block->tag = size | alloc;
+    *BLOCK_FOOTER(block) = size | alloc;
+}
+
+/**
+ * @brief Free list index for a block size
+*/
+static inline uint32_t large_list_index(uint32_t size)
+{
+    uint32_t idx = bsr(size);
+    idx = (idx < LARGE_MIN_LOG2) ? 0 : idx - LARGE_MIN_LOG2;
+    return (idx >= NUM_LARGE_LISTS) ? NUM_LARGE_LISTS - 1 : idx;
+}
+
+/**
+ * @brief Allocate a block with boundary tags, splitting a free block or
+ *        carving a new span when no free block is large enough
+*/
+static void* large_alloc(uint32_t nbytes)
+{
+    uint32_t size = (nbytes + 2 * LARGE_TAG_SIZE + HEAP_ALIGN - 1) & TAG_SIZE_MASK;
+    uint32_t idx = large_list_index(size);
+    large_block_t* block = NULL;
+
+    /* First fit within the block's own list */
+    large_block_t* cur;
+    for (cur = large_lists[idx]; cur != NULL; cur = cur->next) {
+        if (BLOCK_SIZE(cur) >= size) {
+            block = cur;
+            break;
+        }
+    }
+
+    /* Any block on a higher list is large enough */
+    if (block == NULL && idx + 1 < NUM_LARGE_LISTS) {
+        uint32_t higher = large_list_mask & ~((2U << idx) - 1);
+        if (higher) {
+            block = large_lists[bsf(higher)];
+        }
+    }
+
+    if (block != NULL) {
+        large_list_remove(block);
+    } else {
+        /* New span, fenced by allocated tags so coalescing stays inside it */
+        uint32_t min_pages = (size + 2 * LARGE_TAG_SIZE + HEAP_PAGE_SIZE - 1) >> HEAP_PAGE_SHIFT;
+        uint32_t num_pages = (min_pages < LARGE_SPAN_PAGES) ? LARGE_SPAN_PAGES : min_pages;
+
+        uint8_t* span = heap_take_pages(num_pages, PAGE_LARGE);
+        if (span == NULL && num_pages != min_pages) {
+            num_pages = min_pages;
+            span = heap_take_pages(num_pages, PAGE_LARGE);
+        }
+        if (span == NULL) {
+            return NULL;
+        }
+
+        uint32_t span_bytes = num_pages * HEAP_PAGE_SIZE;
+        *(uint32_t*)span = TAG_ALLOC;
+        *(uint32_t*)(span + span_bytes - LARGE_TAG_SIZE) = TAG_ALLOC;
+
+        block = (large_block_t*)(span + LARGE_TAG_SIZE);
+        block_set_tags(block, span_bytes - 2 * LARGE_TAG_SIZE, 0);
+    }
+
+    /* Split off the remainder when it can hold a free block */
+    uint32_t block_size = BLOCK_SIZE(block);
+    if (block_size - size >= LARGE_MIN_BLOCK) {
+        large_block_t* rest = (large_block_t*)((uint8_t*)block + size);
+        block_set_tags(rest, block_size - size, 0);
+        large_list_push(rest);
+        block_size = size;
+    }
+
+    block_set_tags(block, block_size, TAG_ALLOC);
+    return (uint8_t*)block + LARGE_TAG_SIZE;
+}
+
+/**
+ * @brief Free a block, coalescing with free neighbours in the same span
+*/
+static void large_free(large_block_t* block)
+{
+    uint32_t size = BLOCK_SIZE(block);
+
+    /* Merge with the following block */
+    large_block_t* next = BLOCK_NEXT(block);
+    if (!(next->tag & TAG_ALLOC)) {
+        large_list_remove(next);
+        size += BLOCK_SIZE(next);
+    }
+
+    /* Merge with the preceding block, found through its footer */
+    uint32_t prev_tag = *(uint32_t*)((uint8_t*)block - LARGE_TAG_SIZE);
+    if (!(prev_tag & TAG_ALLOC)) {
+        large_block_t* prev = (large_block_t*)((uint8_t*)block - (prev_tag & TAG_SIZE_MASK));
+        large_list_remove(prev);
+        size += prev_tag & TAG_SIZE_MASK;
+        block = prev;
+    }
+
+    block_set_tags(block, size, 0);
+    large_list_push(block);
+}
+
+static void large_list_push(large_block_t* block)
+{
+    uint32_t idx = large_list_index(BLOCK_SIZE(block));
+
+    block->prev = NULL;
+    block->next = large_lists[idx];
+    if (block->next != NULL) {
+        block->next->prev = block;
+    }
+    large_lists[idx] = block;
+    large_list_mask |= (1U << idx);
+}
+
+static void large_list_remove(large_block_t* block)
+{
+    uint32_t idx = large_list_index(BLOCK_SIZE(block));
+
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        large_lists[idx] = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+
+    if (large_lists[idx] == NULL) {
+        large_list_mask &= ~(1U << idx);
+    }
+}
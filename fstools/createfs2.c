@@ -0,0 +1,362 @@
+/* createfs2.c - builds a file system image from a directory
+ *
+ * Writes either the original block map format (-v 1) or the extent
+ * format (-v 2) read by student-distrib/drivers/file.c. Each file is
+ * laid out in one run of adjacent data blocks, so a version 2 inode
+ * holds a single extent. Spare blocks (-b) and inodes (-n) are left
+ * free for files written at run time.
+ *
+ * Subdirectories need version 2. Each becomes a directory inode whose
+ * buckets are filled the way the kernel looks names up, with room for
+ * about as many names again. Root names the boot block has no room for
+ * go in a root directory inode the same way.
+ *
+ * usage: createfs2 -i <dir> -o <image> [-v 1|2] [-b <free blocks>] [-n <free inodes>]
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 4096
+#define FILENAME_LEN 32
+#define MAX_DENTRIES 63 /* boot block, the root directory */
+#define ROOT_DIR_NODE -2 /* parent of names in the root directory inode */
+#define MIN_INODE_COUNT 64
+#define MAX_INODES 4096
+#define MAX_DATA_BLOCKS 1023 /* blocks in a version 1 inode */
+#define DEFAULT_FREE_BLOCKS 64
+#define DEFAULT_FREE_INODES 32
+#define FS_MAGIC 0x31393346 /* "F391" */
+#define FS_VERSION_BLOCK_MAP 1
+#define FS_VERSION_EXTENT 2
+#define FILE_TYPE_RTC 0
+#define FILE_TYPE_DIR 1
+#define FILE_TYPE_REG 2
+#define DIR_ENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(dentry_t))
+#define DIR_FILL (DIR_ENTRIES_PER_BLOCK / 2) /* names per bucket a directory is sized for */
+
+typedef struct {
+    char filename[FILENAME_LEN];
+    uint32_t filetype;
+    uint32_t inode_num;
+    uint8_t reserved[24];
+} dentry_t;
+
+typedef struct {
+    uint32_t dir_count;
+    uint32_t inode_count;
+    uint32_t data_count;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t root_inode; /* directory inode holding root names past the boot block, 0 if none */
+    uint8_t reserved[40];
+    dentry_t direntries[MAX_DENTRIES];
+} boot_block_t;
+
+typedef struct {
+    uint32_t length;
+    union {
+        uint32_t data_block_num[MAX_DATA_BLOCKS];
+        struct {
+            uint32_t num_extents;
+            uint32_t indirect_block;
+            uint32_t extents[2 * 510]; /* (start, count) pairs */
+        };
+    };
+} inode_t;
+
+/* A file or directory below the input directory */
+typedef struct {
+    char path[1024];
+    char name[FILENAME_LEN + 1];
+    uint32_t type;
+    int parent; /* node index, -1 for the root, ROOT_DIR_NODE past the boot block */
+    uint32_t num_children;
+    uint32_t length;
+    uint32_t start; /* first data block */
+    uint32_t num_blocks;
+} node_t;
+
+static node_t* nodes;
+static uint32_t num_nodes;
+static uint32_t version = FS_VERSION_EXTENT;
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s -i <dir> -o <image> [-v 1|2] [-b <free blocks>] [-n <free inodes>]\n", prog);
+    exit(1);
+}
+
+/* Same FNV-1a name hash as dentry_name_hash() in the kernel */
+static uint32_t name_hash(const char* name) {
+    uint32_t hash = 2166136261U;
+    int i;
+    for (i = 0; i < FILENAME_LEN && name[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619U;
+    }
+    return hash;
+}
+
+static void fill_dentry(dentry_t* dentry, const char* name, uint32_t type, uint32_t inode_num) {
+    size_t len = strlen(name);
+    if (len > FILENAME_LEN) {
+        len = FILENAME_LEN; /* names of 32 bytes or more have no terminator */
+    }
+    memcpy(dentry->filename, name, len);
+    dentry->filetype = type;
+    dentry->inode_num = inode_num;
+}
+
+/* Append a node, returning its index */
+static uint32_t add_node(const node_t* node) {
+    nodes = realloc(nodes, (num_nodes + 1) * sizeof(node_t));
+    if (nodes == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    nodes[num_nodes] = *node;
+    return num_nodes++;
+}
+
+/* Add every regular file and directory below path, depth first */
+static void scan_dir(const char* path, int parent) {
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+    if (dir == NULL) {
+        perror(path);
+        exit(1);
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        node_t node;
+        struct stat st;
+
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+        if (parent == -1 && !strcmp(entry->d_name, "rtc")) {
+            continue;
+        }
+        memset(&node, 0, sizeof(node));
+        snprintf(node.path, sizeof(node.path), "%s/%s", path, entry->d_name);
+        if (stat(node.path, &st) != 0) {
+            continue;
+        }
+        snprintf(node.name, sizeof(node.name), "%.*s", FILENAME_LEN, entry->d_name);
+        node.parent = parent;
+        if (S_ISREG(st.st_mode)) {
+            node.type = FILE_TYPE_REG;
+            node.length = st.st_size;
+            node.num_blocks = (node.length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        } else if (S_ISDIR(st.st_mode)) {
+            if (version != FS_VERSION_EXTENT) {
+                fprintf(stderr, "%s: directories need -v 2\n", node.path);
+                exit(1);
+            }
+            node.type = FILE_TYPE_DIR;
+        } else {
+            continue;
+        }
+
+        uint32_t n = add_node(&node);
+        if (parent != -1) {
+            nodes[parent].num_children++;
+        }
+        if (node.type == FILE_TYPE_DIR) {
+            scan_dir(node.path, n);
+        }
+    }
+    closedir(dir);
+}
+
+/* Fill the buckets of directory d with its children, probing like the kernel */
+static void build_dir(uint32_t d, dentry_t* slots) {
+    uint32_t num_buckets = nodes[d].num_blocks;
+    uint32_t n, i;
+    for (n = 0; n < num_nodes; n++) {
+        if (nodes[n].parent != (int)d) {
+            continue;
+        }
+        uint32_t bucket = name_hash(nodes[n].name) % num_buckets;
+        for (;;) {
+            dentry_t* bucket_slots = slots + bucket * DIR_ENTRIES_PER_BLOCK;
+            i = 0;
+            while (i < DIR_ENTRIES_PER_BLOCK && bucket_slots[i].filename[0] != '\0') {
+                i++;
+            }
+            if (i < DIR_ENTRIES_PER_BLOCK) {
+                fill_dentry(&bucket_slots[i], nodes[n].name, nodes[n].type, n + 1);
+                break;
+            }
+            bucket = (bucket + 1) % num_buckets;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* in_dir = NULL;
+    const char* out_path = NULL;
+    uint32_t free_blocks = DEFAULT_FREE_BLOCKS;
+    uint32_t free_inodes = DEFAULT_FREE_INODES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:o:v:b:n:")) != -1) {
+        switch (opt) {
+            case 'i': in_dir = optarg; break;
+            case 'o': out_path = optarg; break;
+            case 'v': version = atoi(optarg); break;
+            case 'b': free_blocks = atoi(optarg); break;
+            case 'n': free_inodes = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (in_dir == NULL || out_path == NULL) {
+        usage(argv[0]);
+    }
+    if (version != FS_VERSION_BLOCK_MAP && version != FS_VERSION_EXTENT) {
+        usage(argv[0]);
+    }
+
+    scan_dir(in_dir, -1);
+
+    /* Root names past the boot block move to the root directory inode */
+    static boot_block_t boot;
+    uint32_t num_root = 0;
+    uint32_t n, b;
+    for (n = 0; n < num_nodes; n++) {
+        if (nodes[n].parent != -1 || ++num_root <= MAX_DENTRIES - 2) {
+            continue;
+        }
+        if (version != FS_VERSION_EXTENT) {
+            fprintf(stderr, "%s: too many files, at most %d\n", in_dir, MAX_DENTRIES - 2);
+            return 1;
+        }
+        if (boot.root_inode == 0) {
+            node_t root_dir;
+            memset(&root_dir, 0, sizeof(root_dir));
+            snprintf(root_dir.path, sizeof(root_dir.path), "%s", in_dir);
+            root_dir.type = FILE_TYPE_DIR;
+            root_dir.parent = ROOT_DIR_NODE;
+            boot.root_inode = add_node(&root_dir) + 1;
+        }
+        nodes[n].parent = boot.root_inode - 1;
+        nodes[boot.root_inode - 1].num_children++;
+    }
+
+    uint32_t inode_count = num_nodes + 1 + free_inodes; /* node n is inode n + 1, inode 0 is "." and "rtc" */
+    if (inode_count < MIN_INODE_COUNT) {
+        inode_count = MIN_INODE_COUNT;
+    }
+    if (inode_count > (version == FS_VERSION_EXTENT ? MAX_INODES : MIN_INODE_COUNT)) {
+        fprintf(stderr, "%s: too many files\n", in_dir);
+        return 1;
+    }
+    inode_t* inodes = calloc(inode_count, sizeof(inode_t));
+    if (inodes == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    fill_dentry(&boot.direntries[boot.dir_count++], ".", FILE_TYPE_DIR, 0);
+    fill_dentry(&boot.direntries[boot.dir_count++], "rtc", FILE_TYPE_RTC, 0);
+
+    /* Lay every file and directory out in order, data block 0 is never handed out */
+    uint32_t next_block = 1;
+    for (n = 0; n < num_nodes; n++) {
+        node_t* node = &nodes[n];
+        if (node->parent == -1) {
+            fill_dentry(&boot.direntries[boot.dir_count++], node->name, node->type, n + 1);
+        }
+        if (node->type == FILE_TYPE_DIR) {
+            node->num_blocks = (node->num_children + DIR_FILL - 1) / DIR_FILL;
+            if (node->num_blocks == 0) {
+                node->num_blocks = 1;
+            }
+            node->length = node->num_blocks * BLOCK_SIZE;
+        }
+        if (version == FS_VERSION_BLOCK_MAP && node->num_blocks > MAX_DATA_BLOCKS) {
+            fprintf(stderr, "%s: too large for a version 1 inode\n", node->path);
+            return 1;
+        }
+        node->start = next_block;
+        next_block += node->num_blocks;
+
+        inode_t* inode = &inodes[n + 1];
+        inode->length = node->length;
+        if (version == FS_VERSION_EXTENT) {
+            if (node->num_blocks > 0) {
+                inode->num_extents = 1;
+                inode->extents[0] = node->start;
+                inode->extents[1] = node->num_blocks;
+            }
+        } else {
+            for (b = 0; b < node->num_blocks; b++) {
+                inode->data_block_num[b] = node->start + b;
+            }
+        }
+    }
+
+    boot.inode_count = inode_count;
+    boot.data_count = next_block + free_blocks;
+    if (version == FS_VERSION_EXTENT) {
+        boot.magic = FS_MAGIC;
+        boot.version = FS_VERSION_EXTENT;
+    }
+
+    FILE* out = fopen(out_path, "wb");
+    if (out == NULL) {
+        perror(out_path);
+        return 1;
+    }
+    fwrite(&boot, sizeof(boot), 1, out);
+    fwrite(inodes, sizeof(inode_t), inode_count, out);
+
+    /* Data blocks: block 0, the files and directories in order, then the free blocks */
+    static uint8_t block[BLOCK_SIZE];
+    fwrite(block, BLOCK_SIZE, 1, out);
+    for (n = 0; n < num_nodes; n++) {
+        node_t* node = &nodes[n];
+        if (node->type == FILE_TYPE_DIR) {
+            dentry_t* slots = calloc(node->num_blocks, BLOCK_SIZE);
+            if (slots == NULL) {
+                perror("calloc");
+                return 1;
+            }
+            build_dir(n, slots);
+            fwrite(slots, BLOCK_SIZE, node->num_blocks, out);
+            free(slots);
+            continue;
+        }
+
+        FILE* in = fopen(node->path, "rb");
+        if (in == NULL) {
+            perror(node->path);
+            return 1;
+        }
+        uint32_t left = node->length;
+        while (left > 0) {
+            memset(block, 0, BLOCK_SIZE);
+            uint32_t len = left < BLOCK_SIZE ? left : BLOCK_SIZE;
+            if (fread(block, 1, len, in) != len) {
+                fprintf(stderr, "%s: short read\n", node->path);
+                return 1;
+            }
+            fwrite(block, BLOCK_SIZE, 1, out);
+            left -= len;
+        }
+        fclose(in);
+    }
+    memset(block, 0, BLOCK_SIZE);
+    for (b = 0; b < free_blocks; b++) {
+        fwrite(block, BLOCK_SIZE, 1, out);
+    }
+
+    if (fclose(out) != 0) {
+        perror(out_path);
+        return 1;
+    }
+    return 0;
+}
@@ -1,19 +1,75 @@
 #include "alloc.h"
+#include "loader.h"
 
 /* Slab Cache Data Structures */
 static slab_cache_t slab_cache_table[MAX_SLAB_CACHES];
-static slab_bitmap_t slab_bitmap_table0[NUM_OBJECT_ENTRIES][PAGE_SIZE_BYTES / (BITMAP_ENTRY_SIZE * SLAB_OBJECT_SIZE_0)];
-static slab_bitmap_t slab_bitmap_table1[NUM_OBJECT_ENTRIES][PAGE_SIZE_BYTES / (BITMAP_ENTRY_SIZE * SLAB_OBJECT_SIZE_1)];
-static slab_bitmap_t slab_bitmap_table2[NUM_OBJECT_ENTRIES][PAGE_SIZE_BYTES / (BITMAP_ENTRY_SIZE * SLAB_OBJECT_SIZE_2)];
-static slab_bitmap_t slab_bitmap_table3[NUM_OBJECT_ENTRIES][PAGE_SIZE_BYTES / (BITMAP_ENTRY_SIZE * SLAB_OBJECT_SIZE_3)];
-static slab_bitmap_t slab_bitmap_table4[NUM_OBJECT_ENTRIES][PAGE_SIZE_BYTES / (BITMAP_ENTRY_SIZE * SLAB_OBJECT_SIZE_4)];
-static slab_bitmap_t slab_bitmap_table5[NUM_OBJECT_ENTRIES][PAGE_SIZE_BYTES / (BITMAP_ENTRY_SIZE * SLAB_OBJECT_SIZE_5)];
-static slab_bitmap_t slab_bitmap_table6[NUM_OBJECT_ENTRIES][PAGE_SIZE_BYTES / (BITMAP_ENTRY_SIZE * SLAB_OBJECT_SIZE_6)];
-static slab_bitmap_t slab_bitmap_table7[NUM_OBJECT_ENTRIES][PAGE_SIZE_BYTES / (BITMAP_ENTRY_SIZE * SLAB_OBJECT_SIZE_7)];
+static slab_class_t slab_class_table[NUM_SLAB_OBJECTS];
+
+/* Size class parameters, generated from SLAB_CLASS_TABLE */
+#define SLAB_CLASS_SIZE(size, slabs)            (size),
+#define SLAB_CLASS_NUM_SLABS(size, slabs)       (slabs),
+#define SLAB_CLASS_BITMAP_WORDS(size, slabs)    + (slabs) * SLAB_BITMAP_WORDS(size)
+#define SLAB_CLASS_OBJECTS(size, slabs)         + (slabs) * (PAGE_SIZE_BYTES / (size))
+static const uint16_t slab_object_sizes[NUM_SLAB_OBJECTS] = { SLAB_CLASS_TABLE(SLAB_CLASS_SIZE) };
+static const uint16_t slab_class_slabs[NUM_SLAB_OBJECTS] = { SLAB_CLASS_TABLE(SLAB_CLASS_NUM_SLABS) };
+
+/* The class table has to tile the slab cache region exactly */
+typedef char slab_class_table_check[((0 SLAB_CLASS_TABLE(SLAB_CLASS_SLABS)) == MAX_SLAB_CACHES) ? 1 : -1];
+
+/* Maps (size + 7) / 8 to a size class, filled by init_kcache() */
+static uint8_t slab_size_lookup[SLAB_LOOKUP_ENTRIES];
+
+/* Bitmap words for every slab, carved up by init_kcache() */
+#define SLAB_BITMAP_POOL_WORDS  (0 SLAB_CLASS_TABLE(SLAB_CLASS_BITMAP_WORDS))
+static slab_bitmap_t slab_bitmap_pool[SLAB_BITMAP_POOL_WORDS];
+
+/* Per object rounding waste for every slab, also carved up by init_kcache().
+ * Waste is below the gap to the previous class, which is at most 128 bytes. */
+#define SLAB_WASTE_POOL_BYTES   (0 SLAB_CLASS_TABLE(SLAB_CLASS_OBJECTS))
+static uint8_t slab_waste_pool[SLAB_WASTE_POOL_BYTES];
+
+/* Buddy System Data Structures */
+static zone_t page_zone;
+
+/* Named object caches */
+static kmem_cache_t kmem_cache_table[KMEM_CACHE_MAX_CACHES];
+static spinlock_t kmem_cache_table_lock = SPIN_LOCK_UNLOCKED;
+
+/* Telemetry: live kmalloc() objects recorded while tracking is on */
+static kmem_track_t kmem_track_table[KMEM_TRACK_ENTRIES];
+static uint32_t kmem_tracking = 0;
+static spinlock_t kmem_track_lock = SPIN_LOCK_UNLOCKED;
+
+/* Object heap headers and page descriptor groups */
+static kmem_cache_t* uheap_cache;
+static kmem_cache_t* uheap_group_cache;
 
 /* Function Prototypes */
 uint32_t log2i(uint32_t num);
-uint32_t slab_cache_index(uint32_t size);
+uint32_t slab_class_index(uint32_t size);
+static void slab_list_push(slab_class_t* class, uint16_t idx);
+static void slab_list_remove(slab_class_t* class, uint16_t idx);
+static void free_list_push(uint16_t idx, uint8_t order);
+static void free_list_remove(uint16_t idx, uint8_t order);
+static void uheap_ctor(void* obj);
+static void uheap_group_ctor(void* obj);
+static uheap_t* uheap_get(pcb_t* pcb);
+static uheap_page_t* uheap_page(uheap_t* heap, uint32_t slot);
+static int32_t uheap_map_run(pcb_t* pcb, uint32_t num_pages);
+static void uheap_unmap_run(pcb_t* pcb, uint32_t first, uint32_t num_pages);
+static void uheap_unmap_page(uint32_t pid, uint8_t* va);
+static void uheap_list_push(uheap_t* heap, uint8_t class_idx, uint16_t slot);
+static void uheap_list_remove(uheap_t* heap, uint8_t class_idx, uint16_t slot);
+static void kpage_set_waste(void* kptr, uint32_t waste);
+static void kpage_set_cache(void* kptr, uint32_t is_cache);
+static int32_t kpage_is_cache(void* kptr);
+static kmem_slab_t* kmem_cache_grow(kmem_cache_t* cache);
+static void kmem_cache_release_slab(kmem_cache_t* cache, kmem_slab_t* slab);
+static void kmem_slab_list_push(kmem_cache_t* cache, kmem_slab_t* slab);
+static void kmem_slab_list_remove(kmem_cache_t* cache, kmem_slab_t* slab);
+static void kmem_track_insert(void* kptr, uint32_t size, uint32_t caller);
+static void kmem_track_remove(void* kptr);
+static void kmem_stats_alloc(kmem_stats_t* stats, uint32_t waste);
 
 /**
  * @brief Main dynamic memory allocation interface, directs
@@ -35,6 +91,7 @@ void* kmalloc(uint32_t size, kmem_flags_e flags)
     /* Slab cache allocations */
     void* kptr = NULL;
     uint16_t alloc_type = 0;
+    uint8_t order = 0;
     if (size <= MAX_SLAB_OBJECT_SIZE) {
         alloc_type = ALLOC_SLAB;
         kptr = kcache_alloc(size);
@@ -43,7 +100,6 @@ void* kmalloc(uint32_t size, kmem_flags_e flags)
     else {
         /* Determine page order */
         uint32_t log2_order = log2i(size - 1);
-        uint8_t order = 0;
         
         /* Single page allocations */
         if (0 <= log2_order && log2_order < 12) {
@@ -53,35 +109,53 @@ void* kmalloc(uint32_t size, kmem_flags_e flags)
         else if (log2_order < 24) {
             order = log2_order - 11;
         } 
-        /* Invalid size allocations*/
-        else {
-            /* Return Null, but could send signal */
-            return NULL;
+
+        /* Invalid size allocations leave kptr as NULL */
+        if (log2_order < 24) {
+            alloc_type = ALLOC_PAGE;
+            kptr = kpage_alloc(order);
+            if (kptr != NULL) {
+                kpage_set_waste(kptr, (PAGE_SIZE_BYTES << order) - size);
+            }
         }
+    }
 
-        alloc_type = ALLOC_PAGE;
-        kptr = kpage_alloc(order);
+    /* Out of memory or invalid size */
+    if (kptr == NULL) {
+        if (flags & KMEM_ATOMIC) {
+            restore_flags(sysflags);
+        }
+        return NULL;
     }
 
+    /* Page allocations span 2**order pages, each needs a mapping */
+    uint32_t num_pages = (alloc_type == ALLOC_PAGE) ? (0x01 << order) : 1;
+    uint32_t i;
+
     /* Page directory management */
     if (flags & KMEM_KERNEL) {
-        uint8_t pid;
-        for (pid = 0; pid < NUM_PROCESS; pid++) {
-            map_page((uint8_t*)kptr, (uint8_t*)kptr, pid, ALLOC_4KB | ALLOC_KERNEL | alloc_type);
+        /* Kernel page tables are shared, one mapping covers every process */
+        for (i = 0; i < num_pages; i++) {
+            uint8_t* page = (uint8_t*)kptr + i * PAGE_SIZE_BYTES;
+            map_kernel_page(page, page, ALLOC_4KB | ALLOC_KERNEL | alloc_type);
         }
     }
-    else if (flags & KMEM_USER) {
-        map_page((uint8_t*)kptr + USER_SPACE_HEAP_OFFSET, (uint8_t*)kptr, (get_curr_pcb())->id, ALLOC_4KB | ALLOC_USER | alloc_type);
-        kptr += USER_SPACE_HEAP_OFFSET;
-    }
     else {
         /* Return Null, but could send signal */
+        if (flags & KMEM_ATOMIC) {
+            restore_flags(sysflags);
+        }
         return NULL;
     }
 
     /* Flush TLB */
     // load_page_directory((uint32_t*)get_proc_page(get_curr_pcb()->id)->proc_pdirectory);
 
+    /* Leak tracking records the object under its physical address */
+    if (kmem_tracking) {
+        kmem_track_insert(kptr, size, (uint32_t)__builtin_return_address(0));
+    }
+
     /* Atomic allocation check */
     if (flags & KMEM_ATOMIC) {
         restore_flags(sysflags);
@@ -106,46 +180,63 @@ void kfree(void* kptr, kmem_flags_e flags)
         cli_and_save(sysflags);
     }
 
-    /* User space address translations */
-    if (flags & KMEM_USER) {
-        kptr -= USER_SPACE_HEAP_OFFSET;
-    }
-
     /* Kernel memory address translations */
     /* Kernel memory pointer are 1-to-1 with physical addresses */
-    if ((flags & KMEM_KERNEL) || (flags & KMEM_USER)) {
+    uint32_t num_pages = 1;
+    if (flags & KMEM_KERNEL) {
+        kmem_track_remove(kptr);
+
         if (KMEM_CACHE_START <= (uint32_t)kptr && (uint32_t)kptr < KMEM_CACHE_END) {
-            kcache_free(kptr);
+            int32_t num_alloc = kcache_free(kptr);
+            if (num_alloc < 0) {
+                if (flags & KMEM_ATOMIC) {
+                    restore_flags(sysflags);
+                }
+                return;
+            }
+
+            /* Other objects may still live on this page, keep it mapped */
+            if (num_alloc > 0) {
+                num_pages = 0;
+            }
         }
         else if (KMEM_PAGE_START <= (uint32_t)kptr && (uint32_t)kptr < KMEM_PAGE_END) {
+            /* Grab block size before it is returned to the buddy system */
+            int32_t order = kpage_order(kptr);
+            if (order < 0) {
+                if (flags & KMEM_ATOMIC) {
+                    restore_flags(sysflags);
+                }
+                return;
+            }
+            num_pages = 0x01 << order;
             kpage_free(kptr);
         }
         /* Invalid Pointer*/
         else {
             /* Return, but could send signal */
+            if (flags & KMEM_ATOMIC) {
+                restore_flags(sysflags);
+            }
             return;
         }
     }
     /* Invalid flags */
     else {
         /* Return, but could send signal */
+        if (flags & KMEM_ATOMIC) {
+            restore_flags(sysflags);
+        }
         return;
     }
 
     /* Page directory management */
+    uint32_t i;
     if (flags & KMEM_KERNEL) {
-        uint8_t pid;
-        for (pid = 0; pid < NUM_PROCESS; pid++) {
-            mark_page_not_present((uint8_t*)kptr, pid);
+        for (i = 0; i < num_pages; i++) {
+            unmap_kernel_page((uint8_t*)kptr + i * PAGE_SIZE_BYTES);
         }
     }
-    else if (flags & KMEM_USER) {
-        mark_page_not_present((uint8_t*)kptr + USER_SPACE_HEAP_OFFSET, (get_curr_pcb())->id);
-    }
-    else {
-        /* Return, but could send signal */
-        return;
-    }
 
     /* Flush TLB */
     // load_page_directory((uint32_t*)get_proc_page(get_curr_pcb()->id)->proc_pdirectory);
@@ -163,58 +254,102 @@ void kfree(void* kptr, kmem_flags_e flags)
 */
 void init_kcache(void)
 {
-    uint32_t i, j, index;
-
-    /* Initialize slab cache table */
-    i = 0;
-    for (j = 0; j < NUM_OBJECT_ENTRIES; j++) {
-        index = i * NUM_OBJECT_ENTRIES + j;
-        slab_cache_table[index].object_size = SLAB_OBJECT_SIZE_0;
-        slab_cache_table[index].cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
-        slab_cache_table[index].bitmap = slab_bitmap_table0[j];
-    } i++; /* Increment i as index to object number */
-    for (j = 0; j < NUM_OBJECT_ENTRIES; j++) {
-        index = i * NUM_OBJECT_ENTRIES + j;
-        slab_cache_table[index].object_size = SLAB_OBJECT_SIZE_1;
-        slab_cache_table[index].cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
-        slab_cache_table[index].bitmap = slab_bitmap_table1[j];
-    } i++; /* Increment i as index to object number */
-    for (j = 0; j < NUM_OBJECT_ENTRIES; j++) {
-        index = i * NUM_OBJECT_ENTRIES + j;
-        slab_cache_table[index].object_size = SLAB_OBJECT_SIZE_2;
-        slab_cache_table[index].cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
-        slab_cache_table[index].bitmap = slab_bitmap_table2[j];
-    } i++; /* Increment i as index to object number */
-    for (j = 0; j < NUM_OBJECT_ENTRIES; j++) {
-        index = i * NUM_OBJECT_ENTRIES + j;
-        slab_cache_table[index].object_size = SLAB_OBJECT_SIZE_3;
-        slab_cache_table[index].cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
-        slab_cache_table[index].bitmap = slab_bitmap_table3[j];
-    } i++; /* Increment i as index to object number */
-    for (j = 0; j < NUM_OBJECT_ENTRIES; j++) {
-        index = i * NUM_OBJECT_ENTRIES + j;
-        slab_cache_table[index].object_size = SLAB_OBJECT_SIZE_4;
-        slab_cache_table[index].cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
-        slab_cache_table[index].bitmap = slab_bitmap_table4[j];
-    } i++; /* Increment i as index to object number */
-    for (j = 0; j < NUM_OBJECT_ENTRIES; j++) {
-        index = i * NUM_OBJECT_ENTRIES + j;
-        slab_cache_table[index].object_size = SLAB_OBJECT_SIZE_5;
-        slab_cache_table[index].cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
-        slab_cache_table[index].bitmap = slab_bitmap_table5[j];
-    } i++; /* Increment i as index to object number */
-    for (j = 0; j < NUM_OBJECT_ENTRIES; j++) {
-        index = i * NUM_OBJECT_ENTRIES + j;
-        slab_cache_table[index].object_size = SLAB_OBJECT_SIZE_6;
-        slab_cache_table[index].cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
-        slab_cache_table[index].bitmap = slab_bitmap_table6[j];
-    } i++; /* Increment i as index to object number */
-    for (j = 0; j < NUM_OBJECT_ENTRIES; j++) {
-        index = i * NUM_OBJECT_ENTRIES + j;
-        slab_cache_table[index].object_size = SLAB_OBJECT_SIZE_7;
-        slab_cache_table[index].cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
-        slab_cache_table[index].bitmap = slab_bitmap_table7[j];
-    } i++; /* Increment i as index to object number */
+    uint32_t i, j, index, w;
+    uint32_t first_slab = 0;
+    slab_bitmap_t* bitmap = slab_bitmap_pool;
+    uint8_t* waste = slab_waste_pool;
+
+    /* Build size lookup: each entry takes the smallest class that fits */
+    for (i = 0, j = 0; i < SLAB_LOOKUP_ENTRIES; i++) {
+        while (slab_object_sizes[j] < i * MIN_SLAB_OBJECT_SIZE) {
+            j++;
+        }
+        slab_size_lookup[i] = j;
+    }
+
+    for (i = 0; i < NUM_SLAB_OBJECTS; i++) {
+        uint16_t object_size = slab_object_sizes[i];
+        uint32_t num_objects = PAGE_SIZE_BYTES / object_size;
+        uint32_t num_words = SLAB_BITMAP_WORDS(object_size);
+        uint32_t num_slabs = slab_class_slabs[i];
+
+        slab_class_table[i].object_size = object_size;
+        slab_class_table[i].partial = SLAB_NULL;
+        slab_class_table[i].num_allocs = 0;
+        slab_class_table[i].waste_bytes = 0;
+        slab_class_table[i].stats = (kmem_stats_t){ 0, 0, 0, 0 };
+        slab_class_table[i].lock = SPIN_LOCK_UNLOCKED;
+
+        /* Push in reverse so the lowest slab is allocated from first */
+        for (j = num_slabs; j-- > 0;) {
+            index = first_slab + j;
+            slab_cache_t* slab = &slab_cache_table[index];
+            slab->object_size = object_size;
+            slab->num_free = num_objects;
+            slab->class_idx = i;
+            slab->cache = (uint8_t*)(index * PAGE_SIZE_BYTES + KMEM_CACHE_START);
+            slab->bitmap = bitmap + j * num_words;
+            slab->waste = waste + j * num_objects;
+
+            /* Bits past the last object are marked allocated so bsf never finds them */
+            for (w = 0; w < num_words; w++) {
+                slab->bitmap[w] = OBJECT_FLAG_FREE;
+            }
+            if (num_objects % BITMAP_ENTRY_SIZE) {
+                slab->bitmap[num_words - 1] = BITMAP_WORD_FULL << (num_objects % BITMAP_ENTRY_SIZE);
+            }
+
+            /* Summary bits past the last bitmap word are marked full */
+            for (w = 0; w < SLAB_SUMMARY_WORDS * BITMAP_ENTRY_SIZE; w++) {
+                if (w % BITMAP_ENTRY_SIZE == 0) {
+                    slab->summary[w / BITMAP_ENTRY_SIZE] = 0;
+                }
+                if (w >= num_words) {
+                    slab->summary[w / BITMAP_ENTRY_SIZE] |= (0x01 << (w % BITMAP_ENTRY_SIZE));
+                }
+            }
+
+            slab_list_push(&slab_class_table[i], index);
+        }
+
+        bitmap += num_slabs * num_words;
+        waste += num_slabs * num_objects;
+        first_slab += num_slabs;
+    }
+}
+
+/**
+ * @brief Print each size class with its slab tail waste and the internal
+ *        fragmentation of the allocations it has served.
+ * 
+ * @details Worst case is the waste of a request one byte larger than the
+ *          previous class, as a percent of the object size. Average is
+ *          the bytes wasted per allocation served since boot.
+*/
+void kcache_print_classes(void)
+{
+    uint32_t i;
+    uint32_t prev_size = 0;
+
+    printf("size slabs objs/slab tail worst%% avg-waste\n");
+    for (i = 0; i < NUM_SLAB_OBJECTS; i++) {
+        slab_class_t* class = &slab_class_table[i];
+        uint32_t object_size = class->object_size;
+        uint32_t worst = (object_size - (prev_size + 1)) * 1000 / object_size;
+
+        spin_lock(&class->lock);
+        uint32_t avg_waste = 0;
+        if (class->num_allocs) {
+            avg_waste = class->waste_bytes / class->num_allocs;
+        }
+        spin_unlock(&class->lock);
+
+        printf("%u %u %u %u %u.%u %u\n", object_size, slab_class_slabs[i],
+            PAGE_SIZE_BYTES / object_size, PAGE_SIZE_BYTES % object_size,
+            worst / 10, worst % 10, avg_waste);
+
+        prev_size = object_size;
+    }
 }
 
 /**
@@ -226,53 +361,54 @@ void init_kcache(void)
 */
 void* kcache_alloc(uint32_t size)
 {
-    /* Grab table starting index*/
-    uint32_t slab_table_start_index = slab_cache_index(size);
-
-    /* Default to NULL for unavailable allocations */
-    uint8_t* kptr = NULL;
-    
-    /* Traverse object cache table section and return physical address */
-    uint32_t i, bit;
-    uint32_t num_bits_in_table = PAGE_SIZE_BYTES / (slab_cache_table[slab_table_start_index].object_size);
-    for (i = 0; i < NUM_OBJECT_ENTRIES; i++) {
-        int32_t obj_idx = -1;
-        uint8_t bitmap_table_idx, bit_position;
-        slab_bitmap_t* bitmap_byte;
-
-        /* Start Critical Section: Writes and reads from bitmap */
-        spin_lock(&slab_cache_table[i + slab_table_start_index].lock);
-
-        /* Traverse bitmap, searching for valid position */
-        for (bit = 0; bit < num_bits_in_table; bit++) {
-            /* Calculate indices */
-            bitmap_table_idx = bit / BITMAP_ENTRY_SIZE;
-            bit_position = bit % BITMAP_ENTRY_SIZE;
-            bitmap_byte = &slab_cache_table[i + slab_table_start_index].bitmap[i] + bitmap_table_idx;
-
-            /* Check availability */
-            if ((*bitmap_byte & (0x01 << bit_position)) == OBJECT_FLAG_FREE) {
-                /* Set allocated */
-                *bitmap_byte |= (0x01 << bit_position);
-
-                /* Set index */
-                obj_idx = bit;
+    /* Grab size class */
+    uint32_t class_idx = slab_class_index(size);
+    if (class_idx >= NUM_SLAB_OBJECTS) {
+        return NULL;
+    }
+    slab_class_t* class = &slab_class_table[class_idx];
 
-                break;
-            }
-        }
+    /* Start Critical Section: Writes and reads from partial list and bitmap */
+    spin_lock(&class->lock);
+
+    /* Every slab of this size is full */
+    if (class->partial == SLAB_NULL) {
+        class->stats.failed++;
+        spin_unlock(&class->lock);
+        return NULL;
+    }
+    slab_cache_t* slab = &slab_cache_table[class->partial];
 
-        /* End Critical Section: Writes and reads from bitmap */
-        spin_unlock(&slab_cache_table[i + slab_table_start_index].lock);
+    /* Find a bitmap word with a free object, at most SLAB_SUMMARY_WORDS checks */
+    uint32_t s = 0;
+    while (slab->summary[s] == BITMAP_WORD_FULL) {
+        s++;
+    }
+    uint32_t word_idx = s * BITMAP_ENTRY_SIZE + bit_scan_forward(~slab->summary[s]);
 
-        /* Set pointer to physical address upon valid position */
-        if (obj_idx != -1) {
-            kptr = slab_cache_table[i + slab_table_start_index].cache + (slab_cache_table[i + slab_table_start_index].object_size * obj_idx);
-            break;
-        }
+    /* Find the free object within the word */
+    uint32_t bit_position = bit_scan_forward(~slab->bitmap[word_idx]);
+    slab->bitmap[word_idx] |= (0x01 << bit_position);
+    if (slab->bitmap[word_idx] == BITMAP_WORD_FULL) {
+        slab->summary[s] |= (0x01 << (word_idx % BITMAP_ENTRY_SIZE));
     }
 
-    return kptr;
+    /* Full slabs leave the partial list */
+    if (--slab->num_free == 0) {
+        slab_list_remove(class, class->partial);
+    }
+
+    /* Fragmentation accounting */
+    uint32_t obj_idx = word_idx * BITMAP_ENTRY_SIZE + bit_position;
+    class->num_allocs++;
+    class->waste_bytes += slab->object_size - size;
+    slab->waste[obj_idx] = slab->object_size - size;
+    kmem_stats_alloc(&class->stats, slab->object_size - size);
+
+    /* End Critical Section: Writes and reads from partial list and bitmap */
+    spin_unlock(&class->lock);
+
+    return slab->cache + slab->object_size * obj_idx;
 }
 
 /**
@@ -285,26 +421,171 @@ void* kcache_alloc(uint32_t size)
  *                         considering the object size.
  *          Bits [11:0] : Index into the object/bitmap table
  * 
- * @return None
+ * @return Number of objects still allocated in the slab, 
+ *         -1 if kptr is not an allocated object
 */
-void kcache_free(void* kptr)
+int32_t kcache_free(void* kptr)
 {
     /* Decode physical address pointer to cache indices */
     uint32_t slab_cache_index = (((uint32_t)kptr & KMEM_SLAB_MASK) >> PAGE_SIZE_LOG2);
-    uint32_t object_index = ((uint32_t)kptr & KMEM_OBJECT_MASK) / slab_cache_table[slab_cache_index].object_size;
+    slab_cache_t* slab = &slab_cache_table[slab_cache_index];
+    slab_class_t* class = &slab_class_table[slab->class_idx];
+    uint32_t object_offset = ((uint32_t)kptr & KMEM_OBJECT_MASK);
+    uint32_t object_index = object_offset / slab->object_size;
+    uint32_t num_objects = PAGE_SIZE_BYTES / slab->object_size;
 
-    /* Start Critical Section: Writes and reads from bitmap */
-    spin_lock(&slab_cache_table[slab_cache_index].lock);
+    /* Pointer must be the start of an object */
+    if (object_offset % slab->object_size || object_index >= num_objects) {
+        return -1;
+    }
 
     /* Calculate indices */
     uint32_t bitmap_table_index = object_index / BITMAP_ENTRY_SIZE;
     uint32_t bit_position = object_index % BITMAP_ENTRY_SIZE;
 
-    /* Set deallocated */
-    slab_cache_table[slab_cache_index].bitmap[bitmap_table_index] &= ~(0x01 << bit_position);
+    /* Start Critical Section: Writes and reads from partial list and bitmap */
+    spin_lock(&class->lock);
+
+    /* Ignore double frees */
+    if ((slab->bitmap[bitmap_table_index] & (0x01 << bit_position)) == OBJECT_FLAG_FREE) {
+        spin_unlock(&class->lock);
+        return -1;
+    }
+
+    /* Set deallocated, the word can no longer be full */
+    slab->bitmap[bitmap_table_index] &= ~(0x01 << bit_position);
+    slab->summary[bitmap_table_index / BITMAP_ENTRY_SIZE] &= ~(0x01 << (bitmap_table_index % BITMAP_ENTRY_SIZE));
+
+    /* Fragmentation accounting */
+    class->stats.live--;
+    class->stats.frag_bytes -= slab->waste[object_index];
+    slab->waste[object_index] = 0;
+
+    /* Previously full slabs rejoin the partial list */
+    if (slab->num_free++ == 0) {
+        slab_list_push(class, slab_cache_index);
+    }
+    int32_t num_alloc = num_objects - slab->num_free;
+
+    /* End Critical Section: Writes and reads from partial list and bitmap */
+    spin_unlock(&class->lock);
+
+    return num_alloc;
+}
+
+/**
+ * @brief Push a slab to the head of its class partial list
+ * 
+ * @warning Caller must hold the class lock
+*/
+static void slab_list_push(slab_class_t* class, uint16_t idx)
+{
+    slab_cache_t* slab = &slab_cache_table[idx];
+
+    slab->prev = SLAB_NULL;
+    slab->next = class->partial;
+    if (class->partial != SLAB_NULL) {
+        slab_cache_table[class->partial].prev = idx;
+    }
+
+    class->partial = idx;
+}
+
+/**
+ * @brief Unlink a slab from its class partial list
+ * 
+ * @warning Caller must hold the class lock
+*/
+static void slab_list_remove(slab_class_t* class, uint16_t idx)
+{
+    slab_cache_t* slab = &slab_cache_table[idx];
+
+    if (slab->prev != SLAB_NULL) {
+        slab_cache_table[slab->prev].next = slab->next;
+    } else {
+        class->partial = slab->next;
+    }
+
+    if (slab->next != SLAB_NULL) {
+        slab_cache_table[slab->next].prev = slab->prev;
+    }
+
+    slab->next = SLAB_NULL;
+    slab->prev = SLAB_NULL;
+}
+
+/**
+ * @brief Initialize the buddy system free lists over 
+ *        KMEM_PAGE_START - KMEM_PAGE_END
+ * 
+ * @details The zone is carved into the largest blocks that are 
+ *          naturally aligned in physical memory, so that the buddy
+ *          of any block is found by flipping a single address bit.
+ *          Pages past installed memory, the slab cache and the reserved
+ *          range never reach a free list, so no block spans them and
+ *          no free block ever coalesces with them.
+ * 
+ * @param mem_end : End of installed memory, the zone is cut short there
+ * @param reserve_start : Start of a range kept out of the zone
+ * @param reserve_end : End of that range
+*/
+void init_kpage(uint32_t mem_end, uint32_t reserve_start, uint32_t reserve_end)
+{
+    uint32_t i;
+
+    /* Empty free lists */
+    for (i = 0; i < BUDDY_NUM_ORDERS; i++) {
+        page_zone.free_area[i].free_list = PAGE_NODE_NULL;
+        page_zone.free_area[i].num_free = 0;
+        page_zone.stats[i] = (kmem_stats_t){ 0, 0, 0, 0 };
+    }
+
+    /* Clear page bookkeeping */
+    for (i = 0; i < KMEM_NUM_PAGES; i++) {
+        page_zone.page_map[i].next = PAGE_NODE_NULL;
+        page_zone.page_map[i].prev = PAGE_NODE_NULL;
+        page_zone.page_map[i].order = 0;
+        page_zone.page_map[i].flags = 0;
+        page_zone.page_map[i].waste = 0;
+    }
+
+    page_zone.end = (mem_end < KMEM_PAGE_END) ? (mem_end & ~KMEM_OBJECT_MASK) : KMEM_PAGE_END;
+
+    /* Ranges inside the zone that are never handed out */
+    uint32_t hole_start[KMEM_ZONE_HOLES] = { KMEM_CACHE_START >> PAGE_SIZE_LOG2, reserve_start >> PAGE_SIZE_LOG2 };
+    uint32_t hole_end[KMEM_ZONE_HOLES] = { KMEM_CACHE_END >> PAGE_SIZE_LOG2, (reserve_end + PAGE_SIZE_BYTES - 1) >> PAGE_SIZE_LOG2 };
 
-    /* End Critical Section: Writes and reads from bitmap */
-    spin_unlock(&slab_cache_table[slab_cache_index].lock);
+    /* Seed free lists with maximal aligned blocks */
+    uint32_t pfn = KMEM_PAGE_START >> PAGE_SIZE_LOG2;
+    uint32_t end_pfn = page_zone.end >> PAGE_SIZE_LOG2;
+    while (pfn < end_pfn) {
+        /* Step over a hole, or end the block where the next one starts */
+        uint32_t limit = end_pfn;
+        uint32_t in_hole = 0;
+        for (i = 0; i < KMEM_ZONE_HOLES; i++) {
+            if (hole_start[i] <= pfn && pfn < hole_end[i]) {
+                pfn = hole_end[i];
+                in_hole = 1;
+                break;
+            }
+            if (pfn < hole_start[i] && hole_start[i] < limit) {
+                limit = hole_start[i];
+            }
+        }
+        if (in_hole) {
+            continue;
+        }
+
+        uint8_t order = BUDDY_MAX_ORDER;
+        while ((pfn & ((0x01 << order) - 1)) || (pfn + (0x01 << order) > limit)) {
+            order--;
+        }
+
+        free_list_push(pfn - (KMEM_PAGE_START >> PAGE_SIZE_LOG2), order);
+        pfn += (0x01 << order);
+    }
+
+    page_zone.lock = SPIN_LOCK_UNLOCKED;
 }
 
 /**
@@ -316,7 +597,44 @@ void kcache_free(void* kptr)
 */
 void* kpage_alloc(uint8_t order)
 {
-    return NULL;
+    if (order > BUDDY_MAX_ORDER) {
+        return NULL;
+    }
+
+    /* Start Critical Section: Writes and reads from free lists */
+    spin_lock(&page_zone.lock);
+
+    /* Find smallest order with a free block */
+    uint8_t curr_order = order;
+    while (curr_order <= BUDDY_MAX_ORDER && page_zone.free_area[curr_order].free_list == PAGE_NODE_NULL) {
+        curr_order++;
+    }
+
+    /* Out of memory */
+    if (curr_order > BUDDY_MAX_ORDER) {
+        page_zone.stats[order].failed++;
+        spin_unlock(&page_zone.lock);
+        return NULL;
+    }
+
+    uint16_t idx = page_zone.free_area[curr_order].free_list;
+    free_list_remove(idx, curr_order);
+
+    /* Split block, returning upper halves to the free lists */
+    while (curr_order > order) {
+        curr_order--;
+        free_list_push(idx + (0x01 << curr_order), curr_order);
+    }
+
+    page_zone.page_map[idx].order = order;
+    page_zone.page_map[idx].flags = PAGE_FLAG_ALLOC;
+    page_zone.page_map[idx].waste = 0;
+    kmem_stats_alloc(&page_zone.stats[order], 0);
+
+    /* End Critical Section: Writes and reads from free lists */
+    spin_unlock(&page_zone.lock);
+
+    return (void*)(KMEM_PAGE_START + ((uint32_t)idx << PAGE_SIZE_LOG2));
 }
 
 /**
@@ -328,54 +646,1234 @@ void* kpage_alloc(uint8_t order)
 */
 void kpage_free(void* kptr)
 {
-    return;
+    /* Check pointer is a page in the zone */
+    if ((uint32_t)kptr < KMEM_PAGE_START || (uint32_t)kptr >= KMEM_PAGE_END || 
+        ((uint32_t)kptr & KMEM_OBJECT_MASK)) {
+        return;
+    }
+
+    uint32_t base_pfn = KMEM_PAGE_START >> PAGE_SIZE_LOG2;
+    uint32_t idx = ((uint32_t)kptr - KMEM_PAGE_START) >> PAGE_SIZE_LOG2;
+
+    /* Start Critical Section: Writes and reads from free lists */
+    spin_lock(&page_zone.lock);
+
+    /* Ignore double frees and pointers into the middle of a block */
+    if (page_zone.page_map[idx].flags != PAGE_FLAG_ALLOC) {
+        spin_unlock(&page_zone.lock);
+        return;
+    }
+
+    uint8_t order = page_zone.page_map[idx].order;
+    page_zone.page_map[idx].flags = 0;
+    page_zone.stats[order].live--;
+    page_zone.stats[order].frag_bytes -= page_zone.page_map[idx].waste;
+    page_zone.page_map[idx].waste = 0;
+
+    /* Coalesce with free buddies of the same order */
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t buddy_pfn = (idx + base_pfn) ^ (0x01 << order);
+        if (buddy_pfn < base_pfn || buddy_pfn - base_pfn >= KMEM_NUM_PAGES) {
+            break;
+        }
+
+        uint32_t buddy_idx = buddy_pfn - base_pfn;
+        if (page_zone.page_map[buddy_idx].flags != PAGE_FLAG_FREE || 
+            page_zone.page_map[buddy_idx].order != order) {
+            break;
+        }
+
+        free_list_remove(buddy_idx, order);
+        page_zone.page_map[buddy_idx].flags = 0;
+        if (buddy_idx < idx) {
+            idx = buddy_idx;
+        }
+        order++;
+    }
+
+    free_list_push(idx, order);
+
+    /* End Critical Section: Writes and reads from free lists */
+    spin_unlock(&page_zone.lock);
 }
 
 /**
- * @brief Determine the integer log2()
+ * @brief Look up the order of an allocated block
+ * 
+ * @param kptr : Pointer to physical page returned by kpage_alloc()
+ * 
+ * @return Order of the block, -1 if kptr is not an allocated block
 */
-uint32_t log2i(uint32_t num) {
-    uint32_t ret = 0;
+int32_t kpage_order(void* kptr)
+{
+    if ((uint32_t)kptr < KMEM_PAGE_START || (uint32_t)kptr >= KMEM_PAGE_END) {
+        return -1;
+    }
+
+    uint32_t idx = ((uint32_t)kptr - KMEM_PAGE_START) >> PAGE_SIZE_LOG2;
+    if (page_zone.page_map[idx].flags != PAGE_FLAG_ALLOC) {
+        return -1;
+    }
+
+    return page_zone.page_map[idx].order;
+}
+
+/**
+ * @brief Create a named object cache
+ * 
+ * @param name : Name reported by the telemetry interface
+ * @param size : Exact object size in bytes
+ * @param align : Object alignment, a power of two (0 for the default)
+ * @param ctor : Called on each object when its slab is created, or NULL
+ * @param dtor : Called on each object when its slab is released, or NULL
+ * 
+ * @return Cache handle, NULL if the size or alignment cannot fit a 
+ *         slab or every cache is in use
+*/
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size, uint32_t align, kmem_ctor_t ctor, kmem_ctor_t dtor)
+{
+    if (name == NULL || size == 0 || size > PAGE_SIZE_BYTES || (align & (align - 1))) {
+        return NULL;
+    }
+    if (align < KMEM_CACHE_MIN_ALIGN) {
+        align = KMEM_CACHE_MIN_ALIGN;
+    }
+
+    /* Objects start past the slab header, at least one must fit */
+    uint32_t stride = (size + align - 1) & ~(align - 1);
+    uint32_t offset = (sizeof(kmem_slab_t) + align - 1) & ~(align - 1);
+    if (align >= PAGE_SIZE_BYTES || offset + stride > PAGE_SIZE_BYTES) {
+        return NULL;
+    }
+
+    /* Start Critical Section: Claim a free cache descriptor */
+    spin_lock(&kmem_cache_table_lock);
 
-    /* Count the highest position of 1 bit */
     uint32_t i;
-    for (i = 0; i < 32; i++) {
-        if (num & 0x01)
-            ret = i;
-        
-        num = num >> 1;
+    for (i = 0; i < KMEM_CACHE_MAX_CACHES && kmem_cache_table[i].in_use; i++);
+    if (i == KMEM_CACHE_MAX_CACHES) {
+        spin_unlock(&kmem_cache_table_lock);
+        return NULL;
+    }
+
+    kmem_cache_t* cache = &kmem_cache_table[i];
+    strncpy(cache->name, name, KMEM_CACHE_NAME_LEN - 1);
+    cache->name[KMEM_CACHE_NAME_LEN - 1] = '\0';
+    cache->size = size;
+    cache->stride = stride;
+    cache->offset = offset;
+    cache->num_objects = (PAGE_SIZE_BYTES - offset) / stride;
+    cache->ctor = ctor;
+    cache->dtor = dtor;
+    cache->partial = NULL;
+    cache->empty = NULL;
+    cache->num_slabs = 0;
+    cache->stats = (kmem_stats_t){ 0, 0, 0, 0 };
+    cache->lock = SPIN_LOCK_UNLOCKED;
+    cache->in_use = 1;
+
+    /* End Critical Section: Claim a free cache descriptor */
+    spin_unlock(&kmem_cache_table_lock);
+
+    return cache;
+}
+
+/**
+ * @brief Allocate a constructed object from a cache
+ * 
+ * @return Pointer to the object, NULL if out of memory
+*/
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+    if (cache == NULL || !cache->in_use) {
+        return NULL;
+    }
+
+    /* Start Critical Section: Writes and reads from partial list and bitmaps */
+    spin_lock(&cache->lock);
+
+    if (cache->partial == NULL) {
+        /* Reuse the cached empty slab before asking the buddy system */
+        if (cache->empty != NULL) {
+            kmem_slab_list_push(cache, cache->empty);
+            cache->empty = NULL;
+        }
+        else {
+            /* Constructors run without the lock held */
+            spin_unlock(&cache->lock);
+            kmem_slab_t* slab = kmem_cache_grow(cache);
+            spin_lock(&cache->lock);
+
+            if (slab == NULL) {
+                cache->stats.failed++;
+                spin_unlock(&cache->lock);
+                return NULL;
+            }
+            kmem_slab_list_push(cache, slab);
+            cache->num_slabs++;
+        }
+    }
+    kmem_slab_t* slab = cache->partial;
+
+    /* Bits past the last object are set, so a word with a clear bit has a free object */
+    uint32_t word_idx = 0;
+    while (slab->bitmap[word_idx] == BITMAP_WORD_FULL) {
+        word_idx++;
     }
-    
-    return ret;
+    uint32_t bit_position = bit_scan_forward(~slab->bitmap[word_idx]);
+    slab->bitmap[word_idx] |= (0x01 << bit_position);
+
+    /* Full slabs leave the partial list */
+    if (--slab->num_free == 0) {
+        kmem_slab_list_remove(cache, slab);
+    }
+    kmem_stats_alloc(&cache->stats, cache->stride - cache->size);
+
+    /* End Critical Section: Writes and reads from partial list and bitmaps */
+    spin_unlock(&cache->lock);
+
+    uint32_t obj_idx = word_idx * BITMAP_ENTRY_SIZE + bit_position;
+    return (uint8_t*)slab + cache->offset + obj_idx * cache->stride;
 }
 
-uint32_t slab_cache_index(uint32_t size)
+/**
+ * @brief Return a constructed object to its cache
+ * 
+ * @details A slab that becomes empty is kept if the cache has no empty
+ *          slab yet, otherwise it is destructed and freed.
+ * 
+ * @return 0 on success, -1 if obj is not a live object of this cache
+*/
+int32_t kmem_cache_free(kmem_cache_t* cache, void* obj)
 {
-    if (size <= SLAB_OBJECT_SIZE_0) {
-        return 0 * NUM_OBJECT_ENTRIES;
+    if (cache == NULL || !cache->in_use) {
+        return -1;
     }
-    else if (size <= SLAB_OBJECT_SIZE_1) {
-        return 1 * NUM_OBJECT_ENTRIES;
+
+    /* The header is only read once the page is known to be a mapped slab */
+    kmem_slab_t* slab = (kmem_slab_t*)((uint32_t)obj & ~KMEM_OBJECT_MASK);
+    if (!kpage_is_cache(slab) || slab->cache != cache) {
+        return -1;
     }
-    else if (size <= SLAB_OBJECT_SIZE_2) {
-        return 2 * NUM_OBJECT_ENTRIES;
+
+    /* Pointer must be the start of an object */
+    uint32_t object_offset = ((uint32_t)obj & KMEM_OBJECT_MASK);
+    if (object_offset < cache->offset || (object_offset - cache->offset) % cache->stride) {
+        return -1;
     }
-    else if (size <= SLAB_OBJECT_SIZE_3) {
-        return 3 * NUM_OBJECT_ENTRIES;
+    uint32_t object_index = (object_offset - cache->offset) / cache->stride;
+    if (object_index >= cache->num_objects) {
+        return -1;
     }
-    else if (size <= SLAB_OBJECT_SIZE_4) {
-        return 4 * NUM_OBJECT_ENTRIES;
+    uint32_t bitmap_table_index = object_index / BITMAP_ENTRY_SIZE;
+    uint32_t bit_position = object_index % BITMAP_ENTRY_SIZE;
+
+    /* Start Critical Section: Writes and reads from partial list and bitmaps */
+    spin_lock(&cache->lock);
+
+    /* Ignore double frees */
+    if ((slab->bitmap[bitmap_table_index] & (0x01 << bit_position)) == OBJECT_FLAG_FREE) {
+        spin_unlock(&cache->lock);
+        return -1;
     }
-    else if (size <= SLAB_OBJECT_SIZE_5) {
-        return 5 * NUM_OBJECT_ENTRIES;
+    slab->bitmap[bitmap_table_index] &= ~(0x01 << bit_position);
+    cache->stats.live--;
+    cache->stats.frag_bytes -= cache->stride - cache->size;
+
+    /* Previously full slabs rejoin the partial list */
+    if (slab->num_free++ == 0) {
+        kmem_slab_list_push(cache, slab);
     }
-    else if (size <= SLAB_OBJECT_SIZE_6) {
-        return 6 * NUM_OBJECT_ENTRIES;
+
+    /* Empty slabs are kept once, any more go back to the buddy system */
+    kmem_slab_t* release = NULL;
+    if (slab->num_free == cache->num_objects) {
+        kmem_slab_list_remove(cache, slab);
+        if (cache->empty == NULL) {
+            cache->empty = slab;
+        }
+        else {
+            release = slab;
+            cache->num_slabs--;
+        }
     }
-    else if (size <= SLAB_OBJECT_SIZE_7) {
-        return 7 * NUM_OBJECT_ENTRIES;
+
+    /* End Critical Section: Writes and reads from partial list and bitmaps */
+    spin_unlock(&cache->lock);
+
+    if (release != NULL) {
+        kmem_cache_release_slab(cache, release);
     }
-    else {
+
+    return 0;
+}
+
+/**
+ * @brief Destroy an empty cache, releasing its slabs
+ * 
+ * @return 0 on success, -1 if the cache still has live objects
+*/
+int32_t kmem_cache_destroy(kmem_cache_t* cache)
+{
+    if (cache == NULL || !cache->in_use) {
         return -1;
     }
+
+    /* Start Critical Section: Writes and reads from partial list */
+    spin_lock(&cache->lock);
+
+    if (cache->stats.live) {
+        spin_unlock(&cache->lock);
+        return -1;
+    }
+
+    /* With no live objects, the empty slab is the only one left */
+    kmem_slab_t* release = cache->empty;
+    cache->empty = NULL;
+    cache->partial = NULL;
+    cache->num_slabs = 0;
+
+    /* End Critical Section: Writes and reads from partial list */
+    spin_unlock(&cache->lock);
+
+    if (release != NULL) {
+        kmem_cache_release_slab(cache, release);
+    }
+
+    spin_lock(&kmem_cache_table_lock);
+    cache->in_use = 0;
+    spin_unlock(&kmem_cache_table_lock);
+
+    return 0;
+}
+
+/**
+ * @brief Map a fresh page as a slab of the cache and construct its objects
+ * 
+ * @return The new slab, NULL if the buddy system is out of pages
+*/
+static kmem_slab_t* kmem_cache_grow(kmem_cache_t* cache)
+{
+    kmem_slab_t* slab = (kmem_slab_t*)kpage_alloc(0);
+    if (slab == NULL) {
+        return NULL;
+    }
+    map_kernel_page((uint8_t*)slab, (uint8_t*)slab, ALLOC_4KB | ALLOC_KERNEL | ALLOC_PAGE);
+    kpage_set_cache(slab, 1);
+
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->num_free = cache->num_objects;
+
+    /* Bits past the last object are marked allocated so bsf never finds them */
+    uint32_t w;
+    for (w = 0; w < KMEM_CACHE_BITMAP_WORDS; w++) {
+        if (w * BITMAP_ENTRY_SIZE + BITMAP_ENTRY_SIZE <= cache->num_objects) {
+            slab->bitmap[w] = OBJECT_FLAG_FREE;
+        }
+        else if (w * BITMAP_ENTRY_SIZE < cache->num_objects) {
+            slab->bitmap[w] = BITMAP_WORD_FULL << (cache->num_objects % BITMAP_ENTRY_SIZE);
+        }
+        else {
+            slab->bitmap[w] = BITMAP_WORD_FULL;
+        }
+    }
+
+    if (cache->ctor != NULL) {
+        uint32_t i;
+        for (i = 0; i < cache->num_objects; i++) {
+            cache->ctor((uint8_t*)slab + cache->offset + i * cache->stride);
+        }
+    }
+
+    return slab;
+}
+
+/**
+ * @brief Destruct every object of an unused slab and free its page
+ * 
+ * @warning The slab must not be on any cache list
+*/
+static void kmem_cache_release_slab(kmem_cache_t* cache, kmem_slab_t* slab)
+{
+    if (cache->dtor != NULL) {
+        uint32_t i;
+        for (i = 0; i < cache->num_objects; i++) {
+            cache->dtor((uint8_t*)slab + cache->offset + i * cache->stride);
+        }
+    }
+
+    kpage_set_cache(slab, 0);
+    unmap_kernel_page((uint8_t*)slab);
+    kpage_free(slab);
+}
+
+/**
+ * @brief Push a slab to the head of its cache partial list
+ * 
+ * @warning Caller must hold the cache lock
+*/
+static void kmem_slab_list_push(kmem_cache_t* cache, kmem_slab_t* slab)
+{
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (cache->partial != NULL) {
+        cache->partial->prev = slab;
+    }
+
+    cache->partial = slab;
+}
+
+/**
+ * @brief Unlink a slab from its cache partial list
+ * 
+ * @warning Caller must hold the cache lock
+*/
+static void kmem_slab_list_remove(kmem_cache_t* cache, kmem_slab_t* slab)
+{
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->partial = slab->next;
+    }
+
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/**
+ * @brief Move the heap break of the current process by whole pages.
+ * 
+ * @param increment : Number of bytes to grow (> 0) or shrink (< 0) the heap by
+ * 
+ * @return Previous heap break, -1 if the heap cannot be resized
+*/
+int32_t uheap_sbrk(int32_t increment)
+{
+    pcb_t* pcb = get_curr_pcb();
+    uint32_t old_pages = pcb->heap_pages;
+    uint32_t old_brk = USER_SPACE_HEAP_START + old_pages * PAGE_SIZE_BYTES;
+    uint32_t new_pages;
+
+    /* Grow by whole pages, shrink only pages that are entirely released */
+    if (increment >= 0) {
+        new_pages = old_pages + ((uint32_t)increment + PAGE_SIZE_BYTES - 1) / PAGE_SIZE_BYTES;
+    } else {
+        uint32_t release = (uint32_t)(-increment) / PAGE_SIZE_BYTES;
+        new_pages = (release > old_pages) ? 0 : old_pages - release;
+    }
+
+    if (new_pages > USER_SPACE_HEAP_PAGES) {
+        return -1;
+    }
+
+    uint32_t sysflags;
+    cli_and_save(sysflags);
+
+    uint32_t i;
+    for (i = old_pages; i < new_pages; i++) {
+        uint8_t* va = (uint8_t*)USER_SPACE_HEAP_START + i * PAGE_SIZE_BYTES;
+        uint8_t* page = (uint8_t*)kpage_alloc(0);
+
+        /* Out of memory, undo the pages mapped by this call */
+        if (page == NULL) {
+            pcb->heap_pages = i;
+            uheap_sbrk(-(int32_t)((i - old_pages) * PAGE_SIZE_BYTES));
+            restore_flags(sysflags);
+            return -1;
+        }
+
+        map_page(va, page, pcb->id, ALLOC_4KB | ALLOC_USER | ALLOC_HEAP);
+        flush_tlb_page(va);
+
+        /* Never hand out another process's data */
+        memset_dword(va, 0, PAGE_SIZE_BYTES / sizeof(uint32_t));
+    }
+
+    for (i = new_pages; i < old_pages; i++) {
+        uheap_unmap_page(pcb->id, (uint8_t*)USER_SPACE_HEAP_START + i * PAGE_SIZE_BYTES);
+    }
+
+    pcb->heap_pages = new_pages;
+    restore_flags(sysflags);
+
+    return old_brk;
+}
+
+/**
+ * @brief Create the object caches for object heap headers and page 
+ *        descriptor groups
+*/
+void init_uheap(void)
+{
+    uheap_cache = kmem_cache_create("uheap", sizeof(uheap_t), 0, uheap_ctor, NULL);
+    uheap_group_cache = kmem_cache_create("uheap_group", UHEAP_GROUP_PAGES * sizeof(uheap_page_t), 0, uheap_group_ctor, NULL);
+}
+
+/**
+ * @brief Constructor for an object heap header, an empty heap
+*/
+static void uheap_ctor(void* obj)
+{
+    uheap_t* heap = (uheap_t*)obj;
+
+    uint32_t i;
+    for (i = 0; i < UHEAP_NUM_CLASSES; i++) {
+        heap->partial[i] = UHEAP_NULL;
+    }
+    for (i = 0; i < UHEAP_SLOT_WORDS; i++) {
+        heap->groups[i] = NULL;
+        heap->slot_map[i] = 0;
+    }
+    heap->num_pages = 0;
+}
+
+/**
+ * @brief Constructor for a page descriptor group, every page unused
+*/
+static void uheap_group_ctor(void* obj)
+{
+    uheap_page_t* group = (uheap_page_t*)obj;
+
+    uint32_t i;
+    for (i = 0; i < UHEAP_GROUP_PAGES; i++) {
+        group[i].role = UHEAP_PAGE_UNUSED;
+        group[i].next = UHEAP_NULL;
+        group[i].prev = UHEAP_NULL;
+    }
+}
+
+/**
+ * @brief Object heap of a process, allocated empty on first use
+ * 
+ * @return The heap, NULL if out of memory
+ * 
+ * @warning Caller must have interrupts disabled
+*/
+static uheap_t* uheap_get(pcb_t* pcb)
+{
+    if (pcb->uheap == NULL) {
+        pcb->uheap = (uheap_t*)kmem_cache_alloc(uheap_cache);
+    }
+
+    return pcb->uheap;
+}
+
+/**
+ * @brief Descriptor of a mapped object heap page
+*/
+static uheap_page_t* uheap_page(uheap_t* heap, uint32_t slot)
+{
+    return &heap->groups[slot / UHEAP_GROUP_PAGES][slot % UHEAP_GROUP_PAGES];
+}
+
+/**
+ * @brief Allocate an object from the current process object heap
+ * 
+ * @param size : Number of bytes requested
+ * 
+ * @return User virtual address of the object, NULL if out of memory
+*/
+void* uheap_alloc(uint32_t size)
+{
+    if (size == 0 || size > USER_SPACE_KMEM_PAGES * PAGE_SIZE_BYTES) {
+        return NULL;
+    }
+
+    pcb_t* pcb = get_curr_pcb();
+    void* ptr = NULL;
+
+    uint32_t sysflags;
+    cli_and_save(sysflags);
+
+    uheap_t* heap = uheap_get(pcb);
+    if (heap == NULL) {
+        restore_flags(sysflags);
+        return NULL;
+    }
+
+    /* Objects larger than a class get their own run of pages */
+    if (size > (0x01 << UHEAP_MAX_OBJECT_LOG2)) {
+        uint32_t num_pages = (size + PAGE_SIZE_BYTES - 1) / PAGE_SIZE_BYTES;
+        int32_t slot = uheap_map_run(pcb, num_pages);
+        if (slot != -1) {
+            uheap_page(heap, slot)->role = UHEAP_PAGE_RUN;
+            uheap_page(heap, slot)->count = num_pages;
+            ptr = (void*)(USER_SPACE_KMEM_START + slot * PAGE_SIZE_BYTES);
+        }
+        restore_flags(sysflags);
+        return ptr;
+    }
+
+    uint32_t log2_size = (size <= (0x01 << UHEAP_MIN_OBJECT_LOG2)) ? UHEAP_MIN_OBJECT_LOG2 : log2i(size - 1) + 1;
+    uint8_t class_idx = log2_size - UHEAP_MIN_OBJECT_LOG2;
+
+    /* Map a fresh page when no page of this class has room */
+    uint16_t slot = heap->partial[class_idx];
+    if (slot == UHEAP_NULL) {
+        int32_t new_slot = uheap_map_run(pcb, 1);
+        if (new_slot == -1) {
+            restore_flags(sysflags);
+            return NULL;
+        }
+
+        slot = (uint16_t)new_slot;
+        uheap_page_t* page = uheap_page(heap, slot);
+        uint32_t num_objects = PAGE_SIZE_BYTES >> log2_size;
+        uint32_t i;
+        for (i = 0; i < UHEAP_BITMAP_WORDS; i++) {
+            /* Bits past the last object are permanently allocated */
+            if (i * BITMAP_ENTRY_SIZE >= num_objects) {
+                page->bitmap[i] = BITMAP_WORD_FULL;
+            } else if ((i + 1) * BITMAP_ENTRY_SIZE > num_objects) {
+                page->bitmap[i] = BITMAP_WORD_FULL << (num_objects - i * BITMAP_ENTRY_SIZE);
+            } else {
+                page->bitmap[i] = 0;
+            }
+        }
+        page->role = class_idx;
+        page->count = num_objects;
+        uheap_list_push(heap, class_idx, slot);
+    }
+
+    /* Take the first free object on the page */
+    uheap_page_t* page = uheap_page(heap, slot);
+    uint32_t word = 0;
+    while (page->bitmap[word] == BITMAP_WORD_FULL) {
+        word++;
+    }
+    uint32_t bit = bit_scan_forward(~page->bitmap[word]);
+    page->bitmap[word] |= (0x01 << bit);
+
+    if (--page->count == 0) {
+        uheap_list_remove(heap, class_idx, slot);
+    }
+
+    ptr = (void*)(USER_SPACE_KMEM_START + slot * PAGE_SIZE_BYTES + ((word * BITMAP_ENTRY_SIZE + bit) << log2_size));
+    restore_flags(sysflags);
+    return ptr;
+}
+
+/**
+ * @brief Free an object from the current process object heap
+ * 
+ * @param ptr : User virtual address returned by uheap_alloc()
+ * 
+ * @return 0 on success, -1 if ptr is not a live object
+*/
+int32_t uheap_free(void* ptr)
+{
+    uint32_t addr = (uint32_t)ptr;
+    if (addr < USER_SPACE_KMEM_START || addr >= USER_SPACE_KMEM_START + USER_SPACE_KMEM_PAGES * PAGE_SIZE_BYTES) {
+        return -1;
+    }
+
+    pcb_t* pcb = get_curr_pcb();
+    uheap_t* heap = pcb->uheap;
+    if (heap == NULL) {
+        return -1;
+    }
+    uint32_t slot = (addr - USER_SPACE_KMEM_START) / PAGE_SIZE_BYTES;
+    uint32_t offset = addr & (PAGE_SIZE_BYTES - 1);
+
+    uint32_t sysflags;
+    cli_and_save(sysflags);
+
+    /* Unmapped pages have no descriptor */
+    if (!(heap->slot_map[slot / BITMAP_ENTRY_SIZE] & (0x01 << (slot % BITMAP_ENTRY_SIZE)))) {
+        restore_flags(sysflags);
+        return -1;
+    }
+    uheap_page_t* page = uheap_page(heap, slot);
+
+    /* Multi-page objects are freed whole */
+    if (page->role == UHEAP_PAGE_RUN) {
+        if (offset != 0) {
+            restore_flags(sysflags);
+            return -1;
+        }
+        uheap_unmap_run(pcb, slot, page->count);
+        restore_flags(sysflags);
+        return 0;
+    }
+
+    if (page->role >= UHEAP_NUM_CLASSES) {
+        restore_flags(sysflags);
+        return -1;
+    }
+
+    /* Must point at the start of a live object */
+    uint8_t class_idx = page->role;
+    uint32_t log2_size = class_idx + UHEAP_MIN_OBJECT_LOG2;
+    uint32_t obj = offset >> log2_size;
+    uint32_t word = obj / BITMAP_ENTRY_SIZE;
+    uint32_t mask = 0x01 << (obj % BITMAP_ENTRY_SIZE);
+    if ((offset & ((0x01 << log2_size) - 1)) || !(page->bitmap[word] & mask)) {
+        restore_flags(sysflags);
+        return -1;
+    }
+
+    page->bitmap[word] &= ~mask;
+    if (page->count++ == 0) {
+        uheap_list_push(heap, class_idx, slot);
+    }
+
+    /* Give empty pages back so the footprint follows live objects */
+    if (page->count == (PAGE_SIZE_BYTES >> log2_size)) {
+        uheap_list_remove(heap, class_idx, slot);
+        uheap_unmap_run(pcb, slot, 1);
+    }
+
+    restore_flags(sysflags);
+    return 0;
+}
+
+/**
+ * @brief Release every page of a process heap and object heap back to
+ *        the buddy system. Used when the process halts.
+ * 
+ * @param pcb : Process whose heaps are released
+ * 
+ * @return Number of pages released
+*/
+uint32_t uheap_release(pcb_t* pcb)
+{
+    uint32_t pid = pcb->id;
+    uheap_t* heap = pcb->uheap;
+    uint32_t released = pcb->heap_pages;
+
+    uint32_t sysflags;
+    cli_and_save(sysflags);
+
+    /* sbrk heap pages */
+    uint32_t i;
+    for (i = 0; i < pcb->heap_pages; i++) {
+        uheap_unmap_page(pid, (uint8_t*)USER_SPACE_HEAP_START + i * PAGE_SIZE_BYTES);
+    }
+    pcb->heap_pages = 0;
+
+    if (heap == NULL) {
+        restore_flags(sysflags);
+        return released;
+    }
+    released += heap->num_pages;
+
+    /* Object heap pages, found through the slot bitmap */
+    for (i = 0; i < UHEAP_SLOT_WORDS; i++) {
+        while (heap->slot_map[i]) {
+            uint32_t bit = bit_scan_forward(heap->slot_map[i]);
+            heap->slot_map[i] &= ~(0x01 << bit);
+            uheap_unmap_page(pid, (uint8_t*)USER_SPACE_KMEM_START + (i * BITMAP_ENTRY_SIZE + bit) * PAGE_SIZE_BYTES);
+        }
+
+        /* Descriptors go back to the cache in their constructed state */
+        if (heap->groups[i] != NULL) {
+            uheap_group_ctor(heap->groups[i]);
+            kmem_cache_free(uheap_group_cache, heap->groups[i]);
+        }
+    }
+
+    /* The next allocation starts a fresh heap */
+    uheap_ctor(heap);
+    kmem_cache_free(uheap_cache, heap);
+    pcb->uheap = NULL;
+
+    restore_flags(sysflags);
+    return released;
+}
+
+/**
+ * @brief Number of pages currently held by a process object heap
+*/
+uint32_t uheap_num_pages(pcb_t* pcb)
+{
+    if (pcb->uheap == NULL) {
+        return 0;
+    }
+
+    return pcb->uheap->num_pages;
+}
+
+/**
+ * @brief Map num_pages consecutive object heap pages, each backed by
+ *        its own buddy page
+ * 
+ * @return First slot of the run, -1 if out of slots or memory
+ * 
+ * @warning Caller must have interrupts disabled
+*/
+static int32_t uheap_map_run(pcb_t* pcb, uint32_t num_pages)
+{
+    uheap_t* heap = pcb->uheap;
+    int32_t first = -1;
+    uint32_t i;
+
+    /* Single pages take the first free slot */
+    if (num_pages == 1) {
+        for (i = 0; i < UHEAP_SLOT_WORDS; i++) {
+            if (heap->slot_map[i] != BITMAP_WORD_FULL) {
+                first = i * BITMAP_ENTRY_SIZE + bit_scan_forward(~heap->slot_map[i]);
+                break;
+            }
+        }
+    }
+    /* Runs take the first gap that fits */
+    else {
+        uint32_t run = 0;
+        for (i = 0; i < USER_SPACE_KMEM_PAGES; i++) {
+            if (heap->slot_map[i / BITMAP_ENTRY_SIZE] & (0x01 << (i % BITMAP_ENTRY_SIZE))) {
+                run = 0;
+            } else if (++run == num_pages) {
+                first = i + 1 - num_pages;
+                break;
+            }
+        }
+    }
+
+    if (first == -1) {
+        return -1;
+    }
+
+    for (i = 0; i < num_pages; i++) {
+        uint32_t slot = first + i;
+        uint8_t* va = (uint8_t*)USER_SPACE_KMEM_START + slot * PAGE_SIZE_BYTES;
+        uint8_t* page = (uint8_t*)kpage_alloc(0);
+
+        /* The first mapped page of a group brings in its descriptors */
+        uheap_page_t** group = &heap->groups[slot / UHEAP_GROUP_PAGES];
+        if (page != NULL && *group == NULL) {
+            *group = (uheap_page_t*)kmem_cache_alloc(uheap_group_cache);
+            if (*group == NULL) {
+                kpage_free(page);
+                page = NULL;
+            }
+        }
+
+        /* Out of memory, undo the pages mapped so far */
+        if (page == NULL) {
+            uheap_unmap_run(pcb, first, i);
+            return -1;
+        }
+
+        map_page(va, page, pcb->id, ALLOC_4KB | ALLOC_USER | ALLOC_SLAB);
+        flush_tlb_page(va);
+
+        /* Never hand out another process's data */
+        memset_dword(va, 0, PAGE_SIZE_BYTES / sizeof(uint32_t));
+
+        heap->slot_map[slot / BITMAP_ENTRY_SIZE] |= (0x01 << (slot % BITMAP_ENTRY_SIZE));
+        uheap_page(heap, slot)->role = UHEAP_PAGE_RUN_TAIL;
+        heap->num_pages++;
+    }
+
+    return first;
+}
+
+/**
+ * @brief Unmap num_pages consecutive object heap pages and free them
+ * 
+ * @warning Caller must have interrupts disabled
+*/
+static void uheap_unmap_run(pcb_t* pcb, uint32_t first, uint32_t num_pages)
+{
+    uheap_t* heap = pcb->uheap;
+
+    uint32_t slot;
+    for (slot = first; slot < first + num_pages; slot++) {
+        uheap_unmap_page(pcb->id, (uint8_t*)USER_SPACE_KMEM_START + slot * PAGE_SIZE_BYTES);
+        uheap_page(heap, slot)->role = UHEAP_PAGE_UNUSED;
+        heap->slot_map[slot / BITMAP_ENTRY_SIZE] &= ~(0x01 << (slot % BITMAP_ENTRY_SIZE));
+        heap->num_pages--;
+
+        /* Groups with no mapped page go back to the cache */
+        if (heap->slot_map[slot / BITMAP_ENTRY_SIZE] == 0) {
+            kmem_cache_free(uheap_group_cache, heap->groups[slot / UHEAP_GROUP_PAGES]);
+            heap->groups[slot / UHEAP_GROUP_PAGES] = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Unmap one user heap page and give it back to the buddy system
+*/
+static void uheap_unmap_page(uint32_t pid, uint8_t* va)
+{
+    uint8_t* page = get_mapped_page(va, pid);
+
+    mark_page_not_present(va, pid);
+    flush_tlb_page(va);
+    if (page != NULL) {
+        kpage_free(page);
+    }
+}
+
+/**
+ * @brief Push a page to the head of its class's partial list
+*/
+static void uheap_list_push(uheap_t* heap, uint8_t class_idx, uint16_t slot)
+{
+    uheap_page_t* page = uheap_page(heap, slot);
+
+    page->prev = UHEAP_NULL;
+    page->next = heap->partial[class_idx];
+    if (page->next != UHEAP_NULL) {
+        uheap_page(heap, page->next)->prev = slot;
+    }
+    heap->partial[class_idx] = slot;
+}
+
+/**
+ * @brief Unlink a page from its class's partial list
+*/
+static void uheap_list_remove(uheap_t* heap, uint8_t class_idx, uint16_t slot)
+{
+    uheap_page_t* page = uheap_page(heap, slot);
+
+    if (page->prev != UHEAP_NULL) {
+        uheap_page(heap, page->prev)->next = page->next;
+    } else {
+        heap->partial[class_idx] = page->next;
+    }
+    if (page->next != UHEAP_NULL) {
+        uheap_page(heap, page->next)->prev = page->prev;
+    }
+
+    page->next = UHEAP_NULL;
+    page->prev = UHEAP_NULL;
+}
+
+/**
+ * @brief Copy allocator telemetry to a user buffer, see KMEM_IOCTL_*
+ * 
+ * @param command : KMEM_IOCTL_* command
+ * @param args : Command argument
+ * 
+ * @return Entries written for GET commands, 0 for SET, -1 on bad arguments
+*/
+int32_t kmem_ioctl(uint32_t command, uint32_t args)
+{
+    if (command == KMEM_IOCTL_SET_TRACKING) {
+        spin_lock(&kmem_track_lock);
+        if (args && !kmem_tracking) {
+            uint32_t i;
+            for (i = 0; i < KMEM_TRACK_ENTRIES; i++) {
+                kmem_track_table[i].addr = 0;
+            }
+        }
+        kmem_tracking = (args != 0);
+        spin_unlock(&kmem_track_lock);
+        return 0;
+    }
+
+    /* Both GET commands take a buffer descriptor in the program page */
+    kmem_ioctl_buf_t* req = (kmem_ioctl_buf_t*)args;
+    if (!(PROGRAM_START_MEM <= args && args + sizeof(kmem_ioctl_buf_t) <= PROGRAM_END_MEM)) {
+        return -1;
+    }
+
+    uint32_t entry_size = sizeof(kmem_track_t);
+    if (command == KMEM_IOCTL_GET_STATS) {
+        entry_size = sizeof(kmem_class_info_t);
+    } else if (command == KMEM_IOCTL_GET_CACHES) {
+        entry_size = sizeof(kmem_cache_info_t);
+    }
+    uint32_t buf = (uint32_t)req->buf;
+    uint32_t count = req->count;
+    if (count > (PROGRAM_END_MEM - PROGRAM_START_MEM) / entry_size ||
+        !(PROGRAM_START_MEM <= buf && buf + count * entry_size <= PROGRAM_END_MEM)) {
+        return -1;
+    }
+
+    /*
+     * Counters are copied to a kernel snapshot under the locks and written out after
+     * unlocking. Touching a user page can fault it in, and the fault allocates from
+     * the page zone, which would spin on page_zone.lock if it were still held.
+     */
+    uint32_t i, j, n = 0;
+    switch (command) {
+        case KMEM_IOCTL_GET_STATS: {
+            kmem_class_info_t* info = (kmem_class_info_t*)buf;
+            kmem_class_info_t entry;
+            for (i = 0; i < NUM_SLAB_OBJECTS && n < count; i++, n++) {
+                spin_lock(&slab_class_table[i].lock);
+                entry.kind = KMEM_KIND_SLAB;
+                entry.size = slab_class_table[i].object_size;
+                entry.stats = slab_class_table[i].stats;
+                spin_unlock(&slab_class_table[i].lock);
+                info[n] = entry;
+            }
+
+            kmem_stats_t buddy_stats[BUDDY_NUM_ORDERS];
+            spin_lock(&page_zone.lock);
+            memcpy(buddy_stats, page_zone.stats, sizeof(buddy_stats));
+            spin_unlock(&page_zone.lock);
+            for (i = 0; i < BUDDY_NUM_ORDERS && n < count; i++, n++) {
+                entry.kind = KMEM_KIND_BUDDY;
+                entry.size = PAGE_SIZE_BYTES << i;
+                entry.stats = buddy_stats[i];
+                info[n] = entry;
+            }
+            return n;
+        }
+        case KMEM_IOCTL_GET_RECORDS: {
+            /* The table is too large for the kernel stack, it is copied a batch at a time */
+            kmem_track_t* records = (kmem_track_t*)buf;
+            kmem_track_t batch[KMEM_IOCTL_BATCH];
+            i = 0;
+            while (i < KMEM_TRACK_ENTRIES && n < count) {
+                uint32_t filled = 0;
+                spin_lock(&kmem_track_lock);
+                for (; i < KMEM_TRACK_ENTRIES && filled < KMEM_IOCTL_BATCH && n + filled < count; i++) {
+                    if (kmem_track_table[i].addr) {
+                        batch[filled++] = kmem_track_table[i];
+                    }
+                }
+                spin_unlock(&kmem_track_lock);
+                for (j = 0; j < filled; j++) {
+                    records[n++] = batch[j];
+                }
+            }
+            return n;
+        }
+        case KMEM_IOCTL_GET_CACHES: {
+            kmem_cache_info_t* info = (kmem_cache_info_t*)buf;
+            kmem_cache_info_t batch[KMEM_IOCTL_BATCH];
+            i = 0;
+            while (i < KMEM_CACHE_MAX_CACHES && n < count) {
+                uint32_t filled = 0;
+                spin_lock(&kmem_cache_table_lock);
+                for (; i < KMEM_CACHE_MAX_CACHES && filled < KMEM_IOCTL_BATCH && n + filled < count; i++) {
+                    kmem_cache_t* cache = &kmem_cache_table[i];
+                    if (!cache->in_use) {
+                        continue;
+                    }
+                    spin_lock(&cache->lock);
+                    memcpy(batch[filled].name, cache->name, KMEM_CACHE_NAME_LEN);
+                    batch[filled].size = cache->size;
+                    batch[filled].stride = cache->stride;
+                    batch[filled].num_slabs = cache->num_slabs;
+                    batch[filled].stats = cache->stats;
+                    spin_unlock(&cache->lock);
+                    filled++;
+                }
+                spin_unlock(&kmem_cache_table_lock);
+                for (j = 0; j < filled; j++) {
+                    info[n++] = batch[j];
+                }
+            }
+            return n;
+        }
+        default:
+            break;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Count a successful allocation and its rounding waste
+ * 
+ * @warning Caller must hold the lock protecting stats
+*/
+static void kmem_stats_alloc(kmem_stats_t* stats, uint32_t waste)
+{
+    stats->live++;
+    if (stats->live > stats->peak) {
+        stats->peak = stats->live;
+    }
+    stats->frag_bytes += waste;
+}
+
+/**
+ * @brief Record the rounding waste of a block allocated by kmalloc()
+*/
+static void kpage_set_waste(void* kptr, uint32_t waste)
+{
+    uint32_t idx = ((uint32_t)kptr - KMEM_PAGE_START) >> PAGE_SIZE_LOG2;
+
+    spin_lock(&page_zone.lock);
+    page_zone.page_map[idx].waste = waste;
+    page_zone.stats[page_zone.page_map[idx].order].frag_bytes += waste;
+    spin_unlock(&page_zone.lock);
+}
+
+/**
+ * @brief Mark an allocated page as an object cache slab, or clear the mark
+ *        before the page is freed
+*/
+static void kpage_set_cache(void* kptr, uint32_t is_cache)
+{
+    uint32_t idx = ((uint32_t)kptr - KMEM_PAGE_START) >> PAGE_SIZE_LOG2;
+
+    spin_lock(&page_zone.lock);
+    if (is_cache) {
+        page_zone.page_map[idx].flags |= PAGE_FLAG_CACHE;
+    } else {
+        page_zone.page_map[idx].flags &= ~PAGE_FLAG_CACHE;
+    }
+    spin_unlock(&page_zone.lock);
+}
+
+/**
+ * @brief Check that a page is an allocated object cache slab
+*/
+static int32_t kpage_is_cache(void* kptr)
+{
+    if ((uint32_t)kptr < KMEM_PAGE_START || (uint32_t)kptr >= KMEM_PAGE_END) {
+        return 0;
+    }
+
+    uint32_t idx = ((uint32_t)kptr - KMEM_PAGE_START) >> PAGE_SIZE_LOG2;
+    return page_zone.page_map[idx].flags == (PAGE_FLAG_ALLOC | PAGE_FLAG_CACHE);
+}
+
+/**
+ * @brief Home slot of an address in the tracking table
+*/
+static inline uint32_t kmem_track_hash(uint32_t addr)
+{
+    /* Fibonacci hashing, objects are at least 8 byte aligned */
+    return ((addr >> 3) * 0x9E3779B1) & (KMEM_TRACK_ENTRIES - 1);
+}
+
+/**
+ * @brief Record a live object, dropped silently when the table is full
+*/
+static void kmem_track_insert(void* kptr, uint32_t size, uint32_t caller)
+{
+    pcb_t* pcb = get_curr_pcb();
+    uint32_t addr = (uint32_t)kptr;
+    uint32_t i, slot = kmem_track_hash(addr);
+
+    spin_lock(&kmem_track_lock);
+    for (i = 0; i < KMEM_TRACK_ENTRIES; i++, slot = (slot + 1) & (KMEM_TRACK_ENTRIES - 1)) {
+        if (kmem_track_table[slot].addr == 0) {
+            kmem_track_table[slot].addr = addr;
+            kmem_track_table[slot].size = size;
+            kmem_track_table[slot].caller = caller;
+            kmem_track_table[slot].pid = pcb->active ? pcb->id : KMEM_TRACK_NO_PID;
+            break;
+        }
+    }
+    spin_unlock(&kmem_track_lock);
+}
+
+/**
+ * @brief Forget a freed object, shifting later entries of its probe
+ *        sequence back so lookups never need tombstones
+*/
+static void kmem_track_remove(void* kptr)
+{
+    uint32_t addr = (uint32_t)kptr;
+    uint32_t i, slot = kmem_track_hash(addr);
+
+    spin_lock(&kmem_track_lock);
+    for (i = 0; i < KMEM_TRACK_ENTRIES; i++, slot = (slot + 1) & (KMEM_TRACK_ENTRIES - 1)) {
+        if (kmem_track_table[slot].addr == 0) {
+            spin_unlock(&kmem_track_lock);
+            return;
+        }
+        if (kmem_track_table[slot].addr == addr) {
+            break;
+        }
+    }
+    if (i == KMEM_TRACK_ENTRIES) {
+        spin_unlock(&kmem_track_lock);
+        return;
+    }
+
+    /* Backward shift deletion */
+    uint32_t hole = slot;
+    uint32_t next = (hole + 1) & (KMEM_TRACK_ENTRIES - 1);
+    while (kmem_track_table[next].addr != 0) {
+        uint32_t home = kmem_track_hash(kmem_track_table[next].addr);
+
+        /* Move the entry if the hole lies between its home and its slot */
+        if (((next - home) & (KMEM_TRACK_ENTRIES - 1)) >= ((next - hole) & (KMEM_TRACK_ENTRIES - 1))) {
+            kmem_track_table[hole] = kmem_track_table[next];
+            hole = next;
+        }
+        next = (next + 1) & (KMEM_TRACK_ENTRIES - 1);
+    }
+    kmem_track_table[hole].addr = 0;
+
+    spin_unlock(&kmem_track_lock);
+}
+
+/**
+ * @brief Push a block to the head of its order's free list
+ * 
+ * @warning Caller must hold the zone lock
+*/
+static void free_list_push(uint16_t idx, uint8_t order)
+{
+    free_block_t* area = &page_zone.free_area[order];
+    page_node_t* node = &page_zone.page_map[idx];
+
+    node->order = order;
+    node->flags = PAGE_FLAG_FREE;
+    node->prev = PAGE_NODE_NULL;
+    node->next = area->free_list;
+    if (area->free_list != PAGE_NODE_NULL) {
+        page_zone.page_map[area->free_list].prev = idx;
+    }
+
+    area->free_list = idx;
+    area->num_free++;
+}
+
+/**
+ * @brief Unlink a block from anywhere in its order's free list
+ * 
+ * @warning Caller must hold the zone lock
+*/
+static void free_list_remove(uint16_t idx, uint8_t order)
+{
+    free_block_t* area = &page_zone.free_area[order];
+    page_node_t* node = &page_zone.page_map[idx];
+
+    if (node->prev != PAGE_NODE_NULL) {
+        page_zone.page_map[node->prev].next = node->next;
+    } else {
+        area->free_list = node->next;
+    }
+
+    if (node->next != PAGE_NODE_NULL) {
+        page_zone.page_map[node->next].prev = node->prev;
+    }
+
+    node->next = PAGE_NODE_NULL;
+    node->prev = PAGE_NODE_NULL;
+    area->num_free--;
+}
+
+/**
+ * @brief Determine the integer log2()
+*/
+uint32_t log2i(uint32_t num) {
+    /* Position of the highest 1 bit, bsr is undefined for 0 */
+    if (num == 0) {
+        return 0;
+    }
+
+    return bit_scan_reverse(num);
+}
+
+/**
+ * @brief Determine the slab class for an allocation size
+ * 
+ * @return Index into the slab class table, -1 if too large
+*/
+uint32_t slab_class_index(uint32_t size)
+{
+    if (size > MAX_SLAB_OBJECT_SIZE) {
+        return -1;
+    }
+
+    return slab_size_lookup[(size + MIN_SLAB_OBJECT_SIZE - 1) / MIN_SLAB_OBJECT_SIZE];
 }
@@ -10,26 +10,38 @@
  * @brief Extra credit for dynamic memory allocation.
  * 
  * @details 4MB are set aside for slab cache allocations.
- *          96MB are set aside for page allocations using the buddy
- *          system. The buddy system is not supported currently.
+ *          92MB are set aside for page allocations using the buddy
+ *          system. Requests larger than MAX_SLAB_OBJECT_SIZE are
+ *          rounded up to a power-of-two number of pages.
  * 
  * @details Dynamic allocation calls within the kernel should be 
  *          directed towards kmalloc() and kfree(), while user space 
  *          programs should interface through malloc() and free().
  * 
  * @details User space programs have a heap memory mapped to start at
- *          136MB in virtual memory. Dynamic allocations are restrained
- *          to 32MB - 128MB in physical memory.
+ *          136MB in virtual memory. The heap is grown a region at a
+ *          time by the sbrk system call and managed by the allocator
+ *          in lib391, so most user allocations never enter the kernel.
+ *          Dynamic allocations are restrained to 8MB - 128MB in 
+ *          physical memory, cut short by the memory installed.
+ * 
+ * @details Objects from the malloc system call come from a private
+ *          object heap at USER_SPACE_KMEM_START. Each process owns its
+ *          pages and the kernel side metadata describing them, so one
+ *          process never shares a page with another and everything is
+ *          released in one pass when the process halts.
 */
 
 #define USER_SPACE_HEAP_START       0x08800000
-#define USER_SPACE_HEAP_OFFSET      USER_SPACE_HEAP_START - KMEM_CACHE_START
+#define USER_SPACE_HEAP_SIZE        0x00400000
+#define USER_SPACE_HEAP_PAGES       (USER_SPACE_HEAP_SIZE / PAGE_4KB_SIZE_B)
+#define USER_SPACE_KMEM_START       0x10000000
+#define USER_SPACE_KMEM_PAGES       512
 
 /* Call Interface */
 typedef enum kmem_flags_e {
     KMEM_ATOMIC = 1,
-    KMEM_KERNEL = 2,
-    KMEM_USER = 4
+    KMEM_KERNEL = 2
 } kmem_flags_e;
 
 /**
@@ -58,21 +70,37 @@ void kfree(void* kptr, kmem_flags_e flags);
 #define PAGE_SIZE_BYTES         4096
 #define PAGE_SIZE_LOG2          12
 #define MAX_SLAB_CACHES         1024
-#define NUM_OBJECT_ENTRIES      128
 #define MAX_SLAB_OBJECT_SIZE    512
+#define MIN_SLAB_OBJECT_SIZE    8
 #define OBJECT_FLAG_ALLOC       1
 #define OBJECT_FLAG_FREE        0
 
-/* Size in bytes */
-#define SLAB_OBJECT_SIZE_0      1
-#define SLAB_OBJECT_SIZE_1      4
-#define SLAB_OBJECT_SIZE_2      8
-#define SLAB_OBJECT_SIZE_3      16
-#define SLAB_OBJECT_SIZE_4      32
-#define SLAB_OBJECT_SIZE_5      64
-#define SLAB_OBJECT_SIZE_6      256
-#define SLAB_OBJECT_SIZE_7      512
-#define NUM_SLAB_OBJECTS        8
+/**
+ * @brief Size class table: X(object size in bytes, number of slabs)
+ * 
+ * @details Classes are multiples of MIN_SLAB_OBJECT_SIZE, spaced so that
+ *          no request wastes more than a third of its object past 32 bytes.
+ *          The slab counts must add up to MAX_SLAB_CACHES (the 4MB region).
+*/
+#define SLAB_CLASS_TABLE(X) \
+    X(8,    96)             \
+    X(16,   96)             \
+    X(32,   96)             \
+    X(48,   64)             \
+    X(64,   128)            \
+    X(96,   64)             \
+    X(128,  128)            \
+    X(192,  64)             \
+    X(256,  128)            \
+    X(384,  64)             \
+    X(512,  96)
+
+#define SLAB_CLASS_COUNT(size, slabs)   + 1
+#define SLAB_CLASS_SLABS(size, slabs)   + (slabs)
+#define NUM_SLAB_OBJECTS        (0 SLAB_CLASS_TABLE(SLAB_CLASS_COUNT))
+
+/* Lookup table indexed by (size + 7) / 8 covers every size up to MAX_SLAB_OBJECT_SIZE */
+#define SLAB_LOOKUP_ENTRIES     (MAX_SLAB_OBJECT_SIZE / MIN_SLAB_OBJECT_SIZE + 1)
 
 #define KMEM_CACHE_START        0x2000000
 #define KMEM_CACHE_END          0x2400000
@@ -80,21 +108,72 @@ void kfree(void* kptr, kmem_flags_e flags);
 #define KMEM_OBJECT_MASK        0x00000FFF
 #define KMEM_SLAB_MASK          0x003FF000
 
-#define BITMAP_ENTRY_SIZE       8
-typedef uint8_t slab_bitmap_t;
+#define BITMAP_ENTRY_SIZE       32
+#define BITMAP_WORD_FULL        0xFFFFFFFF
+typedef uint32_t slab_bitmap_t;
+
+/* Number of bitmap words needed to track one slab of the given object size */
+#define SLAB_BITMAP_WORDS(size) ((PAGE_SIZE_BYTES / (size) + BITMAP_ENTRY_SIZE - 1) / BITMAP_ENTRY_SIZE)
+
+/* Summary words mark full bitmap words, sized for the smallest object size */
+#define SLAB_SUMMARY_WORDS      ((SLAB_BITMAP_WORDS(MIN_SLAB_OBJECT_SIZE) + BITMAP_ENTRY_SIZE - 1) / BITMAP_ENTRY_SIZE)
 
+/* End of partial list marker, since slabs are linked by index */
+#define SLAB_NULL               0xFFFF
+
+/**
+ * @brief Occupancy counters kept for every slab class and buddy order
+*/
+typedef struct kmem_stats_t {
+    uint32_t live;          /* Objects or blocks currently allocated */
+    uint32_t peak;          /* Highest live count since boot */
+    uint32_t failed;        /* Allocations that could not be served */
+    uint32_t frag_bytes;    /* Bytes lost to rounding up the live allocations */
+} kmem_stats_t;
+
+/**
+ * @brief A single 4KB slab of objects of one size.
+ * 
+ * @details Bitmap bits are OBJECT_FLAG_ALLOC when the object is in use.
+ *          A summary bit is set when its bitmap word is full, so a free 
+ *          object is found with two bsf instructions instead of a scan.
+*/
 typedef struct slab_cache_t {
     uint16_t object_size;
+    uint16_t num_free;      /* Free objects left in this slab */
+    uint16_t next;          /* Next slab on the class partial list */
+    uint16_t prev;          /* Previous slab on the class partial list */
+    uint8_t class_idx;      /* Index into the slab class table */
     uint8_t* cache;
     slab_bitmap_t* bitmap;
-    spinlock_t lock;
+    uint8_t* waste;         /* Rounding waste of each live object */
+    slab_bitmap_t summary[SLAB_SUMMARY_WORDS];
 } slab_cache_t;
 
+/**
+ * @brief All slabs of one object size. Slabs with at least one free
+ *        object are kept on the partial list.
+*/
+typedef struct slab_class_t {
+    uint16_t object_size;
+    uint16_t partial;       /* First slab with free objects */
+    uint32_t num_allocs;    /* Allocations served since boot */
+    uint32_t waste_bytes;   /* Bytes lost to rounding up those allocations */
+    kmem_stats_t stats;
+    spinlock_t lock;
+} slab_class_t;
+
 /**
  * @brief Initialize all slab cache data structures
 */
 void init_kcache(void);
 
+/**
+ * @brief Print each size class with its slab tail waste and the internal
+ *        fragmentation of the allocations it has served.
+*/
+void kcache_print_classes(void);
+
 /**
  * @brief Allocate memory from slab cache 
  * 
@@ -114,26 +193,71 @@ void* kcache_alloc(uint32_t size);
  *                         considering the object size.
  *          Bits [11:0] : Index into the object/bitmap table
  * 
- * @return None
+ * @return Number of objects still allocated in the slab, 
+ *         -1 if kptr is not an allocated object
 */
-void kcache_free(void* kptr);
+int32_t kcache_free(void* kptr);
 
 /* Page Allocations: Data Structures and Function Prototypes */
 
-#define KMEM_PAGE_START     0x2400000
+/* Kernel memory is identity mapped, so the zone stops where user space starts */
+#define KMEM_PAGE_START     0x0800000
 #define KMEM_PAGE_END       0x8000000
+#define KMEM_NUM_PAGES      ((KMEM_PAGE_END - KMEM_PAGE_START) / PAGE_SIZE_BYTES)
+
+/* The slab cache and one reserved range sit inside the zone */
+#define KMEM_ZONE_HOLES     2
+
+/* Largest block is 2**12 pages (16MB), matching the largest kmalloc() order */
+#define BUDDY_MAX_ORDER     12
+#define BUDDY_NUM_ORDERS    (BUDDY_MAX_ORDER + 1)
+
+/* End of free list marker, since page nodes are linked by index */
+#define PAGE_NODE_NULL      0xFFFF
 
+#define PAGE_FLAG_FREE      0x1
+#define PAGE_FLAG_ALLOC     0x2
+#define PAGE_FLAG_CACHE     0x4     /* Allocated page is an object cache slab */
+
+/**
+ * @brief Bookkeeping for a single 4KB page in the page zone.
+ * 
+ * @details Only the first page of a block is meaningful. The page
+ *          memory itself is not mapped while it is free, so the free
+ *          lists are threaded through this array instead of the pages.
+*/
 typedef struct page_node_t {
-    uint8_t* page;
-    struct page_node_t* next;
+    uint16_t next;      /* Index of next block on the free list */
+    uint16_t prev;      /* Index of previous block on the free list */
+    uint8_t order;      /* Block holds 2**order pages */
+    uint8_t flags;      /* PAGE_FLAG_FREE or PAGE_FLAG_ALLOC, plus PAGE_FLAG_CACHE */
+    uint32_t waste;     /* Bytes of the allocated block past the kmalloc() request */
 } page_node_t;
 
+/* Per-order free list of blocks */
 typedef struct free_block_t {
-    page_node_t* free_list;
-    uint32_t* map;
+    uint16_t free_list; /* Index of first free block of this order */
+    uint16_t num_free;  /* Number of blocks on the free list */
 } free_block_t;
 
-typedef free_block_t* zone_t;
+typedef struct zone_t {
+    uint32_t end;       /* End of installed memory in the zone */
+    page_node_t page_map[KMEM_NUM_PAGES];
+    free_block_t free_area[BUDDY_NUM_ORDERS];
+    kmem_stats_t stats[BUDDY_NUM_ORDERS];
+    spinlock_t lock;
+} zone_t;
+
+/**
+ * @brief Initialize the buddy system free lists over 
+ *        KMEM_PAGE_START - KMEM_PAGE_END
+ * 
+ * @param mem_end : End of installed memory, the zone is cut short there
+ * @param reserve_start : Start of a range kept out of the zone, such as
+ *                        the file system module
+ * @param reserve_end : End of that range
+*/
+void init_kpage(uint32_t mem_end, uint32_t reserve_start, uint32_t reserve_end);
 
 /**
  * @brief Allocate page of memory using buddy system
@@ -153,4 +277,258 @@ void* kpage_alloc(uint8_t order);
 */
 void kpage_free(void* kptr);
 
+/**
+ * @brief Look up the order of an allocated block
+ * 
+ * @param kptr : Pointer to physical page returned by kpage_alloc()
+ * 
+ * @return Order of the block, -1 if kptr is not an allocated block
+*/
+int32_t kpage_order(void* kptr);
+
+/* Object Caches: Data Structures and Function Prototypes */
+
+/**
+ * @brief Named caches of one kernel object type, for objects that are
+ *        allocated and freed often (process control blocks, file
+ *        descriptor tables, pipe buffers).
+ * 
+ * @details Objects are packed at their exact size rounded up to the
+ *          cache alignment, instead of the next slab class. Each slab
+ *          is one page from the buddy system with its kmem_slab_t 
+ *          header at the start of the page, so an object finds its 
+ *          slab by masking off the page offset.
+ * 
+ * @details The constructor runs once for every object when its slab is
+ *          created, and the destructor once when the slab is returned 
+ *          to the buddy system. Objects must be freed back in their 
+ *          constructed state, so allocation never pays for the setup.
+*/
+
+#define KMEM_CACHE_MAX_CACHES   32
+#define KMEM_CACHE_NAME_LEN     16
+#define KMEM_CACHE_MIN_ALIGN    MIN_SLAB_OBJECT_SIZE
+#define KMEM_CACHE_BITMAP_WORDS SLAB_BITMAP_WORDS(KMEM_CACHE_MIN_ALIGN)
+
+typedef void (*kmem_ctor_t)(void* obj);
+
+struct kmem_cache_t;
+
+/* Header at the start of every object cache slab page */
+typedef struct kmem_slab_t {
+    struct kmem_cache_t* cache;     /* Owning cache, checked on free */
+    struct kmem_slab_t* next;       /* Next slab on the cache partial list */
+    struct kmem_slab_t* prev;       /* Previous slab on the cache partial list */
+    uint32_t num_free;              /* Free objects left in this slab */
+    slab_bitmap_t bitmap[KMEM_CACHE_BITMAP_WORDS];  /* 1 = object allocated */
+} kmem_slab_t;
+
+typedef struct kmem_cache_t {
+    int8_t name[KMEM_CACHE_NAME_LEN];
+    uint32_t size;          /* Requested object size */
+    uint32_t stride;        /* Object size rounded up to the alignment */
+    uint32_t offset;        /* Offset of the first object in a slab */
+    uint32_t num_objects;   /* Objects per slab */
+    kmem_ctor_t ctor;
+    kmem_ctor_t dtor;
+    kmem_slab_t* partial;   /* Slabs with free objects */
+    kmem_slab_t* empty;     /* One unused slab kept to absorb alloc/free churn */
+    uint32_t num_slabs;     /* Slabs held, including the empty slab */
+    kmem_stats_t stats;
+    uint8_t in_use;
+    spinlock_t lock;
+} kmem_cache_t;
+
+/**
+ * @brief Create a named object cache
+ * 
+ * @param name : Name reported by the telemetry interface
+ * @param size : Exact object size in bytes
+ * @param align : Object alignment, a power of two (0 for the default)
+ * @param ctor : Called on each object when its slab is created, or NULL
+ * @param dtor : Called on each object when its slab is released, or NULL
+ * 
+ * @return Cache handle, NULL if the size or alignment cannot fit a 
+ *         slab or every cache is in use
+*/
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size, uint32_t align, kmem_ctor_t ctor, kmem_ctor_t dtor);
+
+/**
+ * @brief Allocate a constructed object from a cache
+ * 
+ * @return Pointer to the object, NULL if out of memory
+*/
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+/**
+ * @brief Return a constructed object to its cache
+ * 
+ * @return 0 on success, -1 if obj is not a live object of this cache
+*/
+int32_t kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+/**
+ * @brief Destroy an empty cache, releasing its slabs
+ * 
+ * @return 0 on success, -1 if the cache still has live objects
+*/
+int32_t kmem_cache_destroy(kmem_cache_t* cache);
+
+/* Telemetry: Data Structures and Function Prototypes */
+
+/**
+ * @brief Allocator telemetry is read from user space with ioctl() on a 
+ *        terminal file descriptor. Buffers are described by a 
+ *        kmem_ioctl_buf_t and must live in the program page.
+ * 
+ * @details KMEM_IOCTL_GET_STATS fills kmem_class_info_t entries, one per
+ *          slab class followed by one per buddy order.
+ *          KMEM_IOCTL_GET_CACHES fills kmem_cache_info_t entries, one per
+ *          object cache.
+ *          KMEM_IOCTL_SET_TRACKING turns per-object tracking on (args = 1)
+ *          or off (args = 0). Turning it on forgets older records.
+ *          KMEM_IOCTL_GET_RECORDS fills kmem_track_t entries for live
+ *          kmalloc() objects allocated while tracking was on.
+ *          The GET commands return the number of entries written.
+*/
+#define KMEM_IOCTL_GET_STATS        16
+#define KMEM_IOCTL_SET_TRACKING     17
+#define KMEM_IOCTL_GET_RECORDS      18
+#define KMEM_IOCTL_GET_CACHES       19
+
+#define KMEM_KIND_SLAB              0
+#define KMEM_KIND_BUDDY             1
+
+/* Open addressed table of tracked objects, must be a power of two */
+#define KMEM_TRACK_ENTRIES          1024
+#define KMEM_TRACK_NO_PID           0xFFFFFFFF
+
+/* Entries kmem_ioctl snapshots on the kernel stack per lock hold */
+#define KMEM_IOCTL_BATCH            16
+
+typedef struct kmem_ioctl_buf_t {
+    void* buf;
+    uint32_t count;         /* Entries that fit in buf */
+} kmem_ioctl_buf_t;
+
+typedef struct kmem_class_info_t {
+    uint32_t kind;          /* KMEM_KIND_SLAB or KMEM_KIND_BUDDY */
+    uint32_t size;          /* Object or block size in bytes */
+    kmem_stats_t stats;
+} kmem_class_info_t;
+
+typedef struct kmem_cache_info_t {
+    int8_t name[KMEM_CACHE_NAME_LEN];
+    uint32_t size;          /* Requested object size */
+    uint32_t stride;        /* Bytes each object takes in a slab */
+    uint32_t num_slabs;
+    kmem_stats_t stats;
+} kmem_cache_info_t;
+
+typedef struct kmem_track_t {
+    uint32_t addr;          /* Object address, 0 marks an empty entry */
+    uint32_t size;          /* Requested size */
+    uint32_t caller;        /* Return address of the kmalloc() call */
+    uint32_t pid;           /* Allocating process, KMEM_TRACK_NO_PID before processes run */
+} kmem_track_t;
+
+/**
+ * @brief Copy allocator telemetry to a user buffer, see KMEM_IOCTL_*
+ * 
+ * @param command : KMEM_IOCTL_* command
+ * @param args : Command argument
+ * 
+ * @return Entries written for GET commands, 0 for SET, -1 on bad arguments
+*/
+int32_t kmem_ioctl(uint32_t command, uint32_t args);
+
+/* User Heap: Data Structures and Function Prototypes */
+
+/* Object heap size classes are powers of two from 32 to 2048 bytes */
+#define UHEAP_MIN_OBJECT_LOG2   5
+#define UHEAP_MAX_OBJECT_LOG2   11
+#define UHEAP_NUM_CLASSES       (UHEAP_MAX_OBJECT_LOG2 - UHEAP_MIN_OBJECT_LOG2 + 1)
+#define UHEAP_BITMAP_WORDS      ((PAGE_SIZE_BYTES >> UHEAP_MIN_OBJECT_LOG2) / BITMAP_ENTRY_SIZE)
+#define UHEAP_SLOT_WORDS        (USER_SPACE_KMEM_PAGES / BITMAP_ENTRY_SIZE)
+#define UHEAP_GROUP_PAGES       BITMAP_ENTRY_SIZE   /* Page descriptors per group, one slot_map word */
+#define UHEAP_NULL              0xFFFF
+
+/* Page roles, small object pages store their class index */
+#define UHEAP_PAGE_UNUSED       0xFF
+#define UHEAP_PAGE_RUN          0xFE    /* First page of a multi-page object */
+#define UHEAP_PAGE_RUN_TAIL     0xFD
+
+/**
+ * @brief Kernel side descriptor for one page of a process object heap. 
+ *        The metadata never lives in user memory, so a process cannot 
+ *        corrupt it. 
+*/
+typedef struct uheap_page_t {
+    uint16_t next;          /* Next page of this class with free objects */
+    uint16_t prev;          /* Previous page of this class with free objects */
+    uint8_t role;           /* Class index or UHEAP_PAGE_* */
+    uint16_t count;         /* Free objects, or pages in a run */
+    slab_bitmap_t bitmap[UHEAP_BITMAP_WORDS];   /* 1 = object allocated */
+} uheap_page_t;
+
+/* Private object heap owned by one process. Page descriptors come in
+ * groups of UHEAP_GROUP_PAGES, held only while one of their pages is mapped. */
+typedef struct uheap_t {
+    uheap_page_t* groups[UHEAP_SLOT_WORDS];     /* Descriptors per slot_map word, NULL if none mapped */
+    uint16_t partial[UHEAP_NUM_CLASSES];        /* Pages with free objects */
+    uint32_t slot_map[UHEAP_SLOT_WORDS];        /* 1 = virtual page mapped */
+    uint16_t num_pages;                         /* Mapped pages */
+} uheap_t;
+
+/**
+ * @brief Create the object caches for object heap headers and page 
+ *        descriptor groups
+*/
+void init_uheap(void);
+
+/**
+ * @brief Allocate an object from the current process object heap
+ * 
+ * @param size : Number of bytes requested
+ * 
+ * @return User virtual address of the object, NULL if out of memory
+*/
+void* uheap_alloc(uint32_t size);
+
+/**
+ * @brief Free an object from the current process object heap
+ * 
+ * @param ptr : User virtual address returned by uheap_alloc()
+ * 
+ * @return 0 on success, -1 if ptr is not a live object
+*/
+int32_t uheap_free(void* ptr);
+
+/**
+ * @brief Release every page of a process heap and object heap back to
+ *        the buddy system. Used when the process halts.
+ * 
+ * @param pcb : Process whose heaps are released
+ * 
+ * @return Number of pages released
+*/
+uint32_t uheap_release(pcb_t* pcb);
+
+/**
+ * @brief Number of pages currently held by a process object heap
+*/
+uint32_t uheap_num_pages(pcb_t* pcb);
+
+/**
+ * @brief Move the heap break of the current process by whole pages.
+ *        Growing maps zeroed pages from the buddy system at the old
+ *        break, shrinking unmaps and frees pages below it.
+ * 
+ * @param increment : Number of bytes to grow (> 0) or shrink (< 0) the
+ *                    heap by, rounded to whole pages
+ * 
+ * @return Previous heap break, -1 if the heap cannot be resized
+*/
+int32_t uheap_sbrk(int32_t increment);
+
 #endif /* _ALLOC_H_ */
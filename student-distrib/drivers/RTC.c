@@ -52,6 +52,7 @@ void RTC_handler(void)
             tcb[c].rtc_freq_counter = 0;
             if(tcb[c].rtc_interrupt_occurred == 0)
                 tcb[c].rtc_interrupt_occurred = 1;
+            wake_up(&tcb[c].rtc_wait);
         }   
     }
 
@@ -87,13 +88,18 @@ int32_t RTC_close(int32_t fd){
  * @brief Read RTC, wait till interrupt
  */
 int32_t RTC_read(int32_t fd, void* buf, int32_t nbytes) {
-
-    tcb[tcb_get_curr_idx()].rtc_interrupt_occurred = 0;
-    tcb[tcb_get_curr_idx()].rtc_freq_counter = 0;
-    while(!tcb[tcb_get_curr_idx()].rtc_interrupt_occurred){
-
+    int idx = tcb_get_curr_idx();
+    uint32_t flags;
+
+    /* Sleep until the rollover, interrupts stay off between the check and the sleep */
+    cli_and_save(flags);
+    tcb[idx].rtc_interrupt_occurred = 0;
+    tcb[idx].rtc_freq_counter = 0;
+    while(!tcb[idx].rtc_interrupt_occurred){
+        sleep_on(&tcb[idx].rtc_wait);
     }
-    tcb[tcb_get_curr_idx()].rtc_interrupt_occurred = 0;
+    tcb[idx].rtc_interrupt_occurred = 0;
+    restore_flags(flags);
     return 0;
 }
 
@@ -1,10 +1,9 @@
 #include "file.h"
 #include "../lib.h"
 #include "../proc/PCB.h"
+#include "../alloc.h"
 
 file_system_t file_system;
-int8_t delete_mode = 0; /* 0 -- do not delete. 1 -- delete.*/
-
 /* File op table for PCB jumps, see types.h */
 device_op_table_t file_op_table = {
     file_read,
@@ -22,48 +21,53 @@ device_op_table_t dir_op_table = {
     dir_close
 };
 
-int cur_dir; /* If we dir_read rather than file_read, this keeps track of which file we're on.*/
-
 /**
- * read_dentry_by_name
- * DESCRIPTION: Read a dentry by the given file name
- * 
+ * dentry_name_hash
+ * DESCRIPTION: FNV-1a hash of a file name, over at most FILENAME_LEN bytes
+ *              since stored names are not terminated when they fill the field
 */
-int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry){
-    if (strlen((int8_t*)fname) > FILENAME_LEN) {
-        return -1;
+static uint32_t dentry_name_hash(const uint8_t* fname) {
+    uint32_t hash = 2166136261U;
+    int i;
+    for (i = 0; i < FILENAME_LEN && fname[i] != '\0'; i++) {
+        hash = (hash ^ fname[i]) * 16777619U;
     }
+    return hash;
+}
 
-    if (dentry == NULL) {
-        return -1;
-    }
-    if (fname == NULL){ 
-        return -1;
+/**
+ * dentry_hash_insert
+ * DESCRIPTION: Add a boot block dentry to the name table. Names are never
+ *              removed, so the table only grows with the directory.
+*/
+static void dentry_hash_insert(int32_t dir_idx) {
+    uint32_t hash = dentry_name_hash(file_system.boot_block->direntries[dir_idx].filename);
+    uint32_t slot = hash & (DENTRY_HASH_SIZE - 1);
+    while (file_system.dentry_hash[slot].dir_idx != DENTRY_HASH_EMPTY) {
+        slot = (slot + 1) & (DENTRY_HASH_SIZE - 1);
     }
-    boot_block_t * bblock = file_system.boot_block;
-    /* Loop through the boot block's dentries, and terminate if we find the filename matching or if we can't find the filename*/
-    int dir_idx; /* directory index*/
-    for(dir_idx = 0; dir_idx < bblock->dir_count; dir_idx ++) {
-        dentry_t cur_dentry = bblock->direntries[dir_idx]; // get current dentry
-        const uint8_t * dentry_fname = cur_dentry.filename;
-        // strncpy(dentry_fname, cur_dentry.filename, strlen(cur_dentry.filename <= FILENAME_LEN ) ? strlen(cur_dentry.filename) : FILENAME_LEN); // get that dentry's filename
-        
-        // if (strlen((int8_t*)dentry_fname) != strlen((int8_t*)fname)) { // if the lengths of the dentry's filename doesn't match the length of the fname, continue;
-        //     continue;
-        // }
-
-
+    file_system.dentry_hash[slot].hash = hash;
+    file_system.dentry_hash[slot].dir_idx = dir_idx;
+}
 
-        int cmp_res = strncmp((int8_t*)fname, (int8_t*)dentry_fname, FILENAME_LEN); //compare the two strings
-        if (cmp_res == 0) {
-            strncpy((int8_t*)dentry->filename, (int8_t*)fname, FILENAME_LEN); // copy cur_dentry file name into dentry filename
-            dentry->filetype = cur_dentry.filetype;
-            dentry->inode_num  = cur_dentry.inode_num;
-            return 0;
+/**
+ * dentry_hash_lookup
+ * DESCRIPTION: Find the boot block dentry with the given name. Only entries
+ *              with a matching hash get a full name compare.
+ * RETURN: index into the boot block dentries, -1 if no file has that name
+*/
+static int32_t dentry_hash_lookup(const uint8_t* fname) {
+    uint32_t hash = dentry_name_hash(fname);
+    uint32_t slot = hash & (DENTRY_HASH_SIZE - 1);
+    while (file_system.dentry_hash[slot].dir_idx != DENTRY_HASH_EMPTY) {
+        dentry_hash_entry_t* entry = &file_system.dentry_hash[slot];
+        if (entry->hash == hash &&
+            !strncmp((int8_t*)fname, (int8_t*)file_system.boot_block->direntries[entry->dir_idx].filename, FILENAME_LEN)) {
+            return entry->dir_idx;
         }
+        slot = (slot + 1) & (DENTRY_HASH_SIZE - 1);
     }
     return -1;
-
 }
 
 /**
@@ -89,128 +93,635 @@ int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry){
     
 }
 
+/**
+ * inode_extent
+ * DESCRIPTION: Extent i of an extent inode, from the inode or its indirect extent block
+*/
+static extent_t* inode_extent(inode_t* inode, uint32_t i) {
+    if (i < INODE_EXTENTS) {
+        return &inode->extents[i];
+    }
+    return (extent_t*)file_system.data_block_base[inode->indirect_block].bytes + (i - INODE_EXTENTS);
+}
+
+/**
+ * inode_map_run
+ * DESCRIPTION: Find the data block holding 4kB block file_block of a file, and
+ *              how many blocks from there sit next to each other in memory, so
+ *              they can be copied at once. A hole maps to data block 0.
+ * INPUTS: max_blocks -- the run is never longer than this
+ * OUTPUTS: run -- number of adjacent data blocks, at least 1
+ * RETURN: data block number
+*/
+static uint32_t inode_map_run(inode_t* inode, uint32_t file_block, uint32_t max_blocks, uint32_t* run) {
+    *run = 1;
+
+    if (file_system.version == FS_VERSION_EXTENT) {
+        uint32_t i, base = 0;
+        for (i = 0; i < inode->num_extents; i++) {
+            extent_t* extent = inode_extent(inode, i);
+            if (file_block < base + extent->count) {
+                uint32_t skip = file_block - base;
+                *run = extent->count - skip;
+                if (*run > max_blocks) {
+                    *run = max_blocks;
+                }
+                return extent->start + skip;
+            }
+            base += extent->count;
+        }
+        return 0;
+    }
+
+    /* Block map inodes: extend the run while the next data block follows this one */
+    uint32_t dblock_idx = inode->data_block_num[file_block];
+    if (dblock_idx == 0) {
+        return 0;
+    }
+    while (*run < max_blocks && file_block + *run < MAX_DATA_BLOCKS &&
+           inode->data_block_num[file_block + *run] == dblock_idx + *run) {
+        (*run)++;
+    }
+    return dblock_idx;
+}
+
+/**
+ * inode_copy
+ * DESCRIPTION: Copy between a buffer and bytes [offset, offset + length) of a
+ *              file, one memcpy per run of adjacent data blocks. Holes read
+ *              as zeros. Writing from a NULL buffer zero fills.
+ * WARNING: Every block written must already be reserved
+*/
+static void inode_copy(inode_t* inode, uint32_t offset, uint8_t* buf, uint32_t length, int32_t to_file) {
+    uint32_t file_block = offset / BLOCK_SIZE; /* index of the 4kB block of the file*/
+    uint32_t block_pos = offset % BLOCK_SIZE; /*current position within the 4096-byte block */
+    uint32_t num_bytes_left = length;
+
+    while (num_bytes_left > 0) {
+        uint32_t run;
+        uint32_t dblock_idx = inode_map_run(inode, file_block, (block_pos + num_bytes_left + BLOCK_SIZE - 1) / BLOCK_SIZE, &run);
+        uint32_t run_bytes = run * BLOCK_SIZE - block_pos; /* bytes in this run of adjacent data blocks */
+        if (run_bytes > num_bytes_left) {
+            run_bytes = num_bytes_left;
+        }
+
+        uint8_t* data = file_system.data_block_base[dblock_idx].bytes + block_pos;
+        if (!to_file) {
+            if (dblock_idx == 0) {
+                memset(buf, 0, run_bytes);
+            } else {
+                memcpy(buf, data, run_bytes);
+            }
+        } else if (dblock_idx != 0) {
+            if (buf == NULL) {
+                memset(data, 0, run_bytes);
+            } else {
+                memcpy(data, buf, run_bytes);
+            }
+        }
+
+        if (buf != NULL) {
+            buf += run_bytes;
+        }
+        num_bytes_left -= run_bytes;
+        file_block += run;
+        block_pos = 0;
+    }
+}
+
 /**
  * read_data
  * DESCRIPTION: Read a data blocks for a given inode
+ *              Copies one run of adjacent data blocks per memcpy, so a
+ *              whole block (or more) moves with rep movsd instead of
+ *              one call per byte. Length is clamped to the end of file once.
 */
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length){
     boot_block_t * bblock = file_system.boot_block;
     if (buf == NULL) {
         return -1;
     }
-    if (inode >= bblock->inode_count || inode < 0) {
+    if (inode >= bblock->inode_count) {
         return -1;
     }
     inode_t* this_inode= &file_system.inode_base[inode]; /* Get this inode */
 
-    /*Two levels of indirection for data blocks. */
-    int num_bytes = this_inode->length; /*number of bytes for this inode*/
-    int32_t dblock_indirect_idx; /* indirect index to access where in the data_block_num field of the inode*/
-    if (offset < BLOCK_SIZE) {
-        dblock_indirect_idx = 0;
-    } else { 
-        dblock_indirect_idx = offset / BLOCK_SIZE;
+    /* Nothing past the end of the file */
+    if (offset >= this_inode->length) {
+        return 0;
+    }
+    if (length > this_inode->length - offset) {
+        length = this_inode->length - offset;
     }
 
-    int32_t dblock_idx = this_inode->data_block_num[dblock_indirect_idx]; /*index to access which data block*/
-    data_block_t* dblock= &file_system.data_block_base[dblock_idx] ; /*the current data block*/
-    
-    int cur_byte = offset; /* Current byte out of total bytes of file*/
-    int cur_pos = (offset < BLOCK_SIZE) ? offset : offset % BLOCK_SIZE; /*current position within the 4096-byte block */
-    uint8_t * start_pos_src = dblock->bytes + offset % BLOCK_SIZE; /* Find start_pos of the source where we copy data from*/
-    uint8_t * start_pos_dst = buf;                   /* Find start_pos of the source where we copy data to*/
-
-    uint32_t len_counter; /* len_counter for for loop, capped at length*/
-    uint32_t num_bytes_read = 0; /* num_bytes read*/
-    for (len_counter = 0; len_counter < length; len_counter ++){
-        if (cur_byte >= num_bytes) {
-            break;
+    inode_copy(this_inode, offset, buf, length, 0);
+    return length;
+}
+
+/**
+ * inode_num_blocks
+ * DESCRIPTION: Number of 4kB blocks covered by the file length
+*/
+static uint32_t inode_num_blocks(inode_t* inode) {
+    return (inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/**
+ * file_data_page
+ * DESCRIPTION: Address of the data block holding 4kB block file_block of a
+ *              file, so it can be mapped into user space instead of copied
+ * RETURN: NULL past the end of the file or for a hole
+*/
+uint8_t* file_data_page(uint32_t inode, uint32_t file_block) {
+    if (inode >= file_system.boot_block->inode_count) {
+        return NULL;
+    }
+    inode_t* this_inode = &file_system.inode_base[inode];
+    if (file_block >= inode_num_blocks(this_inode)) {
+        return NULL;
+    }
+    uint32_t run;
+    uint32_t dblock_idx = inode_map_run(this_inode, file_block, 1, &run);
+    if (dblock_idx == 0) {
+        return NULL;
+    }
+    return file_system.data_block_base[dblock_idx].bytes;
+}
+
+/**
+ * dir_bucket
+ * DESCRIPTION: The dentry slots of one bucket of a directory inode
+ * RETURN: first slot, NULL if the bucket has no data block
+*/
+static dentry_t* dir_bucket(inode_t* dir, uint32_t bucket) {
+    uint32_t run;
+    uint32_t dblock_idx = inode_map_run(dir, bucket, 1, &run);
+    if (dblock_idx == 0) {
+        return NULL;
+    }
+    return (dentry_t*)file_system.data_block_base[dblock_idx].bytes;
+}
+
+/**
+ * dir_find_slot
+ * DESCRIPTION: Look a name up in a directory inode, starting at the bucket
+ *              its hash picks and moving on only while buckets are full.
+ * OUTPUTS: free_slot -- if not found, the slot the name would go in, NULL
+ *                       if the directory is full (may be NULL)
+ * RETURN: the matching dentry, NULL if there is none
+*/
+static dentry_t* dir_find_slot(uint32_t dir_inode, const uint8_t* name, dentry_t** free_slot) {
+    if (free_slot != NULL) {
+        *free_slot = NULL;
+    }
+    if (file_system.version != FS_VERSION_EXTENT || dir_inode >= file_system.boot_block->inode_count) {
+        return NULL;
+    }
+    inode_t* dir = &file_system.inode_base[dir_inode];
+    uint32_t num_buckets = dir->length / BLOCK_SIZE;
+    if (num_buckets == 0) {
+        return NULL;
+    }
+
+    uint32_t bucket = dentry_name_hash(name) % num_buckets;
+    uint32_t probe, i;
+    for (probe = 0; probe < num_buckets; probe++) {
+        dentry_t* slots = dir_bucket(dir, bucket);
+        if (slots == NULL) {
+            return NULL;
         }
-        memcpy(start_pos_dst, start_pos_src, 1); /* copy one byte at a time into the buffer*/
-        num_bytes_read += 1;
-        cur_pos += 1;
-        cur_byte += 1;
-        start_pos_dst += 1;
-        start_pos_src += 1;
-        if (cur_pos == BLOCK_SIZE) {
-            dblock_indirect_idx += 1;
-            dblock_idx = this_inode->data_block_num[dblock_indirect_idx];
-            dblock = &file_system.data_block_base[dblock_idx];
-            start_pos_src = dblock->bytes;
+        for (i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+            if (slots[i].filename[0] == '\0') {
+                if (free_slot != NULL) {
+                    *free_slot = &slots[i];
+                }
+                return NULL;
+            }
+            if (!strncmp((int8_t*)name, (int8_t*)slots[i].filename, FILENAME_LEN)) {
+                return &slots[i];
+            }
         }
+        bucket = (bucket + 1) % num_buckets;
+    }
+    return NULL;
+}
 
+/**
+ * root_dir_inode
+ * DESCRIPTION: The directory inode holding root names past the boot block
+ * RETURN: its inode number, ROOT_DIR_INODE if there is none
+*/
+static uint32_t root_dir_inode(void) {
+    uint32_t root_inode = file_system.boot_block->root_inode;
+    if (file_system.version != FS_VERSION_EXTENT || root_inode >= file_system.boot_block->inode_count) {
+        return ROOT_DIR_INODE;
     }
+    return root_inode;
+}
 
-    return num_bytes_read;
+/**
+ * dir_lookup
+ * DESCRIPTION: Read the dentry of one name in a directory, the boot block
+ *              through its name table and other directories through their buckets
+*/
+static int32_t dir_lookup(uint32_t dir_inode, const uint8_t* name, dentry_t* dentry) {
+    dentry_t* found;
+    if (dir_inode == ROOT_DIR_INODE) {
+        int32_t dir_idx = dentry_hash_lookup(name); /* directory index*/
+        if (dir_idx != -1) {
+            found = &file_system.boot_block->direntries[dir_idx];
+        } else if (root_dir_inode() != ROOT_DIR_INODE) {
+            found = dir_find_slot(root_dir_inode(), name, NULL); /* root names past the boot block*/
+        } else {
+            found = NULL;
+        }
+        if (found == NULL) {
+            return -1;
+        }
+    } else {
+        found = dir_find_slot(dir_inode, name, NULL);
+        if (found == NULL) {
+            return -1;
+        }
+    }
+
+    strncpy((int8_t*)dentry->filename, (int8_t*)name, FILENAME_LEN); // copy cur_dentry file name into dentry filename
+    dentry->filetype = found->filetype;
+    dentry->inode_num  = found->inode_num;
+    return 0;
 }
 
-int32_t get_avail_data_block_num() {
-    int i;
-    for (i = 0; i < MAX_FILES * MAX_DATA_BLOCKS; i++) {
-        if (file_system.data_block_flags[i] == 0) {
-            return i;
+/**
+ * path_parent
+ * DESCRIPTION: Walk every directory of an a/b/c path from the root, one
+ *              lookup per name. Repeated and leading slashes are skipped.
+ * OUTPUTS: dir_inode -- the directory holding the last name
+ * RETURN: the last name of the path, NULL if a directory on the way is
+ *         missing, not a directory, or its name is too long
+*/
+static const uint8_t* path_parent(const uint8_t* path, uint32_t* dir_inode) {
+    uint8_t name[FILENAME_LEN + 1];
+    dentry_t dentry;
+
+    *dir_inode = ROOT_DIR_INODE;
+    while (*path == '/') {
+        path++;
+    }
+    while (1) {
+        const uint8_t* end = path;
+        while (*end != '\0' && *end != '/') {
+            end++;
+        }
+        if (*end == '\0') {
+            return path;
+        }
+
+        uint32_t len = end - path;
+        if (len > FILENAME_LEN) {
+            return NULL;
+        }
+        memcpy(name, path, len);
+        name[len] = '\0';
+        if (dir_lookup(*dir_inode, name, &dentry) == -1 || dentry.filetype != FILE_TYPE_DIR) {
+            return NULL;
+        }
+        *dir_inode = dentry.inode_num;
+
+        path = end;
+        while (*path == '/') {
+            path++;
         }
     }
-    return -1; /* no possible free data blocks*/
+}
 
+/**
+ * read_dentry_by_name
+ * DESCRIPTION: Read a dentry by the given file name, which may be an a/b/c path
+ * 
+*/
+int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry){
+    if (dentry == NULL) {
+        return -1;
+    }
+    if (fname == NULL){ 
+        return -1;
+    }
+
+    uint32_t dir_inode;
+    const uint8_t* name = path_parent(fname, &dir_inode);
+    if (name == NULL) {
+        return -1;
+    }
+    if (strlen((int8_t*)name) > FILENAME_LEN) {
+        return -1;
+    }
+    return dir_lookup(dir_inode, name, dentry);
 }
+
+/**
+ * read_dentry_in_dir
+ * DESCRIPTION: Read the next used entry of a directory, for listing it.
+ *              For the root, *index is the boot block dentry index, then
+ *              MAX_FILES plus the slot in the root directory inode. For
+ *              other directories it counts slots across the buckets.
+ * RETURN: 0 on success, -1 past the last entry
+*/
+int32_t read_dentry_in_dir (uint32_t dir_inode, uint32_t* index, dentry_t* dentry) {
+    if (index == NULL || dentry == NULL) {
+        return -1;
+    }
+    uint32_t first = 0; /* index of the directory inode's first slot*/
+    if (dir_inode == ROOT_DIR_INODE) {
+        if (*index < MAX_FILES && read_dentry_by_index(*index, dentry) == 0) {
+            (*index)++;
+            return 0;
+        }
+        dir_inode = root_dir_inode();
+        if (dir_inode == ROOT_DIR_INODE) {
+            return -1;
+        }
+        if (*index < MAX_FILES) {
+            *index = MAX_FILES;
+        }
+        first = MAX_FILES;
+    }
+    if (file_system.version != FS_VERSION_EXTENT || dir_inode >= file_system.boot_block->inode_count) {
+        return -1;
+    }
+
+    inode_t* dir = &file_system.inode_base[dir_inode];
+    uint32_t num_slots = (dir->length / BLOCK_SIZE) * DIR_ENTRIES_PER_BLOCK;
+    while (*index - first < num_slots) {
+        uint32_t slot_idx = *index - first;
+        dentry_t* slots = dir_bucket(dir, slot_idx / DIR_ENTRIES_PER_BLOCK);
+        dentry_t* slot = (slots == NULL) ? NULL : &slots[slot_idx % DIR_ENTRIES_PER_BLOCK];
+        (*index)++;
+        if (slot != NULL && slot->filename[0] != '\0') {
+            memcpy(dentry->filename, slot->filename, FILENAME_LEN);
+            dentry->filetype = slot->filetype;
+            dentry->inode_num = slot->inode_num;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * bitmap_find_free
+ * DESCRIPTION: Find a clear bit, starting at bit start and wrapping around once.
+ *              Checks 32 entries per word with bsf. Bits past the last entry
+ *              are kept set so they are never returned.
+ * RETURN: index of the clear bit, -1 if every bit is set
+*/
+static int32_t bitmap_find_free(const uint32_t* bitmap, uint32_t num_words, uint32_t start) {
+    uint32_t word_idx = start / FS_BITMAP_BITS;
+    if (word_idx >= num_words) {
+        word_idx = 0;
+        start = 0;
+    }
+
+    /* Bits before start in the first word are only checked after wrapping around */
+    uint32_t word = bitmap[word_idx] | ((1 << (start % FS_BITMAP_BITS)) - 1);
+    uint32_t i;
+    for (i = 0; i <= num_words; i++) {
+        if (word != FS_BITMAP_FULL) {
+            return word_idx * FS_BITMAP_BITS + bit_scan_forward(~word);
+        }
+        word_idx = (word_idx + 1 == num_words) ? 0 : word_idx + 1;
+        word = bitmap[word_idx];
+    }
+    return -1;
+}
+
+/* Next free data block at or after the hint */
+int32_t get_avail_data_block_num() {
+    return bitmap_find_free(file_system.data_block_bitmap, DATA_BLOCK_BITMAP_WORDS, file_system.data_block_hint); /* -1: no possible free data blocks*/
+}
+
+/* Next free inode at or after the hint */
 int32_t get_avail_inode_idx() {
-    int i;
-    for (i = 0; i < MAX_FILES; i ++) {
-        if (file_system.inode_flags[i] == 0) {
+    return bitmap_find_free(file_system.inode_bitmap, INODE_BITMAP_WORDS, file_system.inode_hint); /* -1: no possible free inodes*/
+}
+
+/* Mark a data block occupied (used = 1) or free (used = 0). Handing out a block moves the hint past it. */
+void mark_data_block(uint32_t dblock_idx, int32_t used) {
+    if (dblock_idx >= NUM_DATA_BLOCKS) {
+        return;
+    }
+    if (used) {
+        file_system.data_block_bitmap[dblock_idx / FS_BITMAP_BITS] |= (1 << (dblock_idx % FS_BITMAP_BITS));
+        file_system.data_block_hint = dblock_idx + 1;
+    } else {
+        file_system.data_block_bitmap[dblock_idx / FS_BITMAP_BITS] &= ~(1 << (dblock_idx % FS_BITMAP_BITS));
+    }
+}
+
+/* Whether a data block is handed out */
+static int32_t data_block_used(uint32_t dblock_idx) {
+    return (file_system.data_block_bitmap[dblock_idx / FS_BITMAP_BITS] >> (dblock_idx % FS_BITMAP_BITS)) & 1;
+}
 
-            return i;
+/* Whether an inode is handed out */
+static int32_t inode_used(uint32_t inode_idx) {
+    return (file_system.inode_bitmap[inode_idx / FS_BITMAP_BITS] >> (inode_idx % FS_BITMAP_BITS)) & 1;
+}
+
+/* Mark an inode occupied (used = 1) or free (used = 0). Handing out an inode moves the hint past it. */
+void mark_inode(uint32_t inode_idx, int32_t used) {
+    if (inode_idx >= MAX_INODES) {
+        return;
+    }
+    if (used) {
+        file_system.inode_bitmap[inode_idx / FS_BITMAP_BITS] |= (1 << (inode_idx % FS_BITMAP_BITS));
+        file_system.inode_hint = inode_idx + 1;
+    } else {
+        file_system.inode_bitmap[inode_idx / FS_BITMAP_BITS] &= ~(1 << (inode_idx % FS_BITMAP_BITS));
+    }
+}
+
+/**
+ * inode_init
+ * DESCRIPTION: Empty a newly handed out inode, whatever the slot held before
+*/
+static void inode_init(uint32_t inode_num) {
+    memset(&file_system.inode_base[inode_num], 0, sizeof(inode_t));
+}
+
+static int32_t inode_append_block(inode_t* inode);
+static int32_t inode_truncate(inode_t* inode, uint32_t new_length);
+
+/**
+ * dir_grow
+ * DESCRIPTION: Double the buckets of a directory inode, appending each new
+ *              bucket to its data, then put every name back in the bucket
+ *              its hash picks for the new count. An empty directory gets
+ *              its first bucket.
+ * RETURN: 0 on success, -1 if out of data blocks or memory
+*/
+static int32_t dir_grow(uint32_t dir_inode) {
+    inode_t* dir = &file_system.inode_base[dir_inode];
+    uint32_t old_buckets = dir->length / BLOCK_SIZE;
+    uint32_t new_buckets = (old_buckets == 0) ? 1 : 2 * old_buckets;
+
+    /* Names go back in from a copy, since every bucket is cleared first */
+    dentry_t* old_slots = NULL;
+    if (old_buckets > 0) {
+        old_slots = (dentry_t*)kmalloc(old_buckets * BLOCK_SIZE, KMEM_KERNEL);
+        if (old_slots == NULL) {
+            return -1;
         }
+        inode_copy(dir, 0, (uint8_t*)old_slots, old_buckets * BLOCK_SIZE, 0);
     }
-    return -1; /* no possible free inodes*/
+
+    uint32_t i;
+    for (i = old_buckets; i < new_buckets; i++) {
+        if (inode_append_block(dir) == -1) {
+            inode_truncate(dir, dir->length); /* give back the buckets appended so far*/
+            if (old_slots != NULL) {
+                kfree(old_slots, KMEM_KERNEL);
+            }
+            return -1;
+        }
+    }
+    dir->length = new_buckets * BLOCK_SIZE;
+    inode_copy(dir, 0, NULL, dir->length, 1);
+
+    for (i = 0; i < old_buckets * DIR_ENTRIES_PER_BLOCK; i++) {
+        dentry_t* slot;
+        if (old_slots[i].filename[0] != '\0') {
+            dir_find_slot(dir_inode, old_slots[i].filename, &slot);
+            *slot = old_slots[i];
+        }
+    }
+    if (old_slots != NULL) {
+        kfree(old_slots, KMEM_KERNEL);
+    }
+    return 0;
 }
 
-int32_t write_dentry_by_name (const uint8_t * fname, dentry_t * dentry) {
-    if (fname == NULL) {
+/**
+ * dir_insert_slot
+ * DESCRIPTION: Find the slot a new name goes in. A full bucket where the
+ *              hash points would make lookups spill into the next one, so
+ *              the directory doubles first. If it cannot, the name still
+ *              goes in the next bucket with room.
+ * RETURN: the free slot, NULL if the name is there already or there is no room
+*/
+static dentry_t* dir_insert_slot(uint32_t dir_inode, const uint8_t* name) {
+    dentry_t* slot;
+    if (dir_find_slot(dir_inode, name, &slot) != NULL) {
+        return NULL;
+    }
+
+    inode_t* dir = &file_system.inode_base[dir_inode];
+    uint32_t num_buckets = dir->length / BLOCK_SIZE;
+    dentry_t* home = (num_buckets == 0) ? NULL : dir_bucket(dir, dentry_name_hash(name) % num_buckets);
+    if (slot == NULL || slot < home || slot >= home + DIR_ENTRIES_PER_BLOCK) {
+        if (dir_grow(dir_inode) == 0) {
+            dir_find_slot(dir_inode, name, &slot);
+        }
+    }
+    return slot;
+}
+
+/**
+ * root_dir_get
+ * DESCRIPTION: The directory inode for root names past the boot block,
+ *              handed out empty the first time the boot block runs out
+ * RETURN: its inode number, -1 on block map images or if no inode is left
+*/
+static int32_t root_dir_get(void) {
+    if (file_system.version != FS_VERSION_EXTENT) {
         return -1;
     }
-    if (dentry == NULL) {
+    if (root_dir_inode() != ROOT_DIR_INODE) {
+        return root_dir_inode();
+    }
+
+    int32_t inode_num = get_avail_inode_idx();
+    if (inode_num == -1) {
         return -1;
     }
+    mark_inode(inode_num, 1);
+    inode_init(inode_num);
+    file_system.boot_block->root_inode = inode_num;
+    return inode_num;
+}
 
+/**
+ * dentry_create
+ * DESCRIPTION: Create an empty regular file at a path. Files in the root go
+ *              in the boot block until it is full, then like files in other
+ *              directories in a free slot of the bucket their name hashes to.
+ * OUTPUTS: dentry -- the new file's dentry (may be NULL)
+ * RETURN: 0 on success, -1 if the name exists, the directory is missing or
+ *         full, or no inode is left
+*/
+static int32_t dentry_create(const uint8_t* fname, dentry_t* dentry) {
     boot_block_t * bblock = file_system.boot_block;
-    uint32_t num_direntries = bblock->dir_count;
-    int dir_idx;
-    for ( dir_idx = 0; dir_idx < num_direntries; dir_idx ++) {
-        dentry_t cur_dentry = bblock->direntries[dir_idx];
-        const uint8_t * dentry_fname = cur_dentry.filename;
-        
-        int cmp_res = strncmp((int8_t*)fname, (int8_t*)dentry_fname, FILENAME_LEN); //compare the two strings
-        if (cmp_res == 0) {
-            strncpy((int8_t*)dentry->filename, (int8_t*)fname, FILENAME_LEN); // copy cur_dentry file name into dentry filename
-            dentry->filetype = cur_dentry.filetype;
-            dentry->inode_num  = cur_dentry.inode_num;
-            return 0;
+    dentry_t* slot = NULL;
+    dentry_t existing;
+    uint32_t dir_inode;
+    const uint8_t* name = path_parent(fname, &dir_inode);
+    if (name == NULL || name[0] == '\0' || strlen((int8_t*)name) > FILENAME_LEN) {
+        return -1;
+    }
+    if (dir_lookup(dir_inode, name, &existing) == 0) {
+        return -1; /* Already there*/
+    }
+
+    if (dir_inode == ROOT_DIR_INODE && bblock->dir_count < MAX_FILES) {
+        slot = &bblock->direntries[bblock->dir_count];
+    } else {
+        if (dir_inode == ROOT_DIR_INODE) {
+            int32_t root_inode = root_dir_get();
+            if (root_inode == -1) {
+                return -1; /* Reached max files*/
+            }
+            dir_inode = root_inode;
+        }
+        slot = dir_insert_slot(dir_inode, name);
+        if (slot == NULL) {
+            return -1; /* No room left in the directory*/
         }
     }
-    /* We didn't find a matching file name. This means we are not writing to an existing file but rather creating a new file*/
-    if (num_direntries >= MAX_FILES) {
-        return -1; /* Reached max files*/
-    } 
 
     int32_t new_inode_num = get_avail_inode_idx(); /* Get next available inode index*/
-    file_system.inode_flags[new_inode_num] = 1; /* Mark as occupied now*/
     if (new_inode_num == -1)return -1;
-
-    /* update the boot block's dentries */
-    // bblock->direntries[bblock->dir_count];
-    strncpy(bblock->direntries[bblock->dir_count].filename, (int8_t*)fname, FILENAME_LEN );
-    bblock->direntries[bblock->dir_count].filetype = FILE_TYPE_REG; /* Assuming I'm not working with a directory or the RTC...  idk what to do for that */
-    bblock->direntries[bblock->dir_count].inode_num = new_inode_num;
+    mark_inode(new_inode_num, 1); /* Mark as occupied now*/
+    inode_init(new_inode_num);
+
+    /* update the directory's dentries */
+    strncpy((int8_t*)slot->filename, (int8_t*)name, FILENAME_LEN );
+    slot->filetype = FILE_TYPE_REG; /* Assuming I'm not working with a directory or the RTC...  idk what to do for that */
+    slot->inode_num = new_inode_num;
+    if (dir_inode == ROOT_DIR_INODE) {
+        dentry_hash_insert(bblock->dir_count);
+        bblock->dir_count ++;
+    }
 
     /* Then copy to the passed in dentry */
-    strncpy((int8_t*)dentry->filename, (int8_t*)fname, FILENAME_LEN); // copy cur_dentry file name into dentry filename
-    dentry->filetype = bblock->direntries[bblock->dir_count].filetype;
-    dentry->inode_num  = bblock->direntries[bblock->dir_count].inode_num;
+    if (dentry != NULL) {
+        strncpy((int8_t*)dentry->filename, (int8_t*)name, FILENAME_LEN); // copy cur_dentry file name into dentry filename
+        dentry->filetype = slot->filetype;
+        dentry->inode_num  = slot->inode_num;
+    }
+    return 0;
+}
 
-    bblock->dir_count ++;
+int32_t write_dentry_by_name (const uint8_t * fname, dentry_t * dentry) {
+    if (fname == NULL) {
+        return -1;
+    }
+    if (dentry == NULL) {
+        return -1;
+    }
 
-    return 0;
+    if (read_dentry_by_name(fname, dentry) == 0) {
+        return 0;
+    }
+    /* We didn't find a matching file name. This means we are not writing to an existing file but rather creating a new file*/
+    return dentry_create(fname, dentry);
 
 }
 int32_t write_dentry_by_index(uint32_t index, dentry_t * dentry) {
@@ -218,163 +729,297 @@ int32_t write_dentry_by_index(uint32_t index, dentry_t * dentry) {
 }
 
 /**
- * We need to return the number of bytes written... for now??
- * DESCRIPTION: If we find a data_block_num = 0, then find a new data block, and start writing to that.
- *              Otherwise, write to the current data block.
+ * inode_append_block
+ * DESCRIPTION: Add one data block to the end of an extent inode. The last
+ *              extent grows when the block after it is free, otherwise a new
+ *              extent starts at the next free block.
+ * RETURN: data block number, -1 if out of data blocks or extents
 */
-int32_t write_data(uint32_t inode, uint32_t offset, uint8_t * buf, uint32_t length){
-    if (delete_mode == 1) {
-
-        int res = delete_data(inode, length);
-        delete_mode = 0;
-        return res;
+static int32_t inode_append_block(inode_t* inode) {
+    uint32_t n = inode->num_extents;
+    if (n > 0) {
+        extent_t* last = inode_extent(inode, n - 1);
+        uint32_t next = last->start + last->count;
+        if (next < NUM_DATA_BLOCKS && !data_block_used(next)) {
+            mark_data_block(next, 1);
+            last->count++;
+            return next;
+        }
+    }
+    if (n == MAX_EXTENTS) {
+        return -1;
     }
 
+    /* Extents past the inode spill into the indirect extent block */
+    if (n == INODE_EXTENTS && inode->indirect_block == 0) {
+        int32_t indirect = get_avail_data_block_num();
+        if (indirect == -1) {
+            return -1;
+        }
+        mark_data_block(indirect, 1);
+        inode->indirect_block = indirect;
+    }
 
-    boot_block_t * bblock = file_system.boot_block;
-    if (inode >= bblock->inode_count) {
+    int32_t dblock_idx = get_avail_data_block_num();
+    if (dblock_idx == -1) {
         return -1;
     }
-    inode_t * inode_block = &file_system.inode_base[inode];
-    uint32_t initial_length = inode_block->length; /* Initial length*/
-   
-   
-    /* We should notice that 0 is never used for a data block number... this could be slightly problematic,
-    as this deprives us of an additional 4096 bytes, but I will gloss over this for now.                    */
-
-   
-    int32_t dblock_indirect_idx; /* indirect index to access where in the data_block_num field of the inode*/
-    if (offset < BLOCK_SIZE) {
-        dblock_indirect_idx = 0;
-    } else { 
-        dblock_indirect_idx = offset / BLOCK_SIZE;
-    }
-    if (dblock_indirect_idx >= MAX_DATA_BLOCKS) { /* Used up all the data blocks. */
-        return -1;
+    mark_data_block(dblock_idx, 1);
+    extent_t* extent = inode_extent(inode, n);
+    extent->start = dblock_idx;
+    extent->count = 1;
+    inode->num_extents = n + 1;
+    return dblock_idx;
+}
+
+/**
+ * inode_reserve
+ * DESCRIPTION: Make sure 4kB blocks first_idx to last_idx of a file have data
+ *              blocks. Extent files have no holes, so every block from the
+ *              current end of the file is appended.
+ * RETURN: index of the first block that could not be reserved, last_idx + 1 if all were
+*/
+static uint32_t inode_reserve(inode_t* inode, uint32_t first_idx, uint32_t last_idx) {
+    uint32_t dblock_indirect_idx;
+
+    if (file_system.version == FS_VERSION_EXTENT) {
+        for (dblock_indirect_idx = inode_num_blocks(inode); dblock_indirect_idx <= last_idx; dblock_indirect_idx++) {
+            if (inode_append_block(inode) == -1) {
+                return dblock_indirect_idx;
+            }
+        }
+        return last_idx + 1;
     }
-    uint32_t num_bytes = inode_block->length; /* total number of bytes of the file*/
-    int32_t dblock_idx = inode_block->data_block_num[dblock_indirect_idx]; /*index to access which data block*/
-    if (dblock_idx == 0) { /* The data block number is 0. This means that we need to get a new data block.*/
-        dblock_idx = get_avail_data_block_num();
+
+    /* 0 is never used for a data block number, so it marks a hole. */
+    for (dblock_indirect_idx = first_idx; dblock_indirect_idx <= last_idx; dblock_indirect_idx++) {
+        if (inode->data_block_num[dblock_indirect_idx] != 0) {
+            continue;
+        }
+
+        int32_t dblock_idx = get_avail_data_block_num();
         if (dblock_idx == -1) {
-            return 0; /* No more data blocks. Return.*/
+            return dblock_indirect_idx; /* No more data blocks*/
         }
-        inode_block->data_block_num[dblock_indirect_idx] = dblock_idx;
-        file_system.data_block_flags[dblock_idx] = 1; /* Mark this as occupied.*/
+        mark_data_block(dblock_idx, 1); /* Mark this as occupied.*/
+        inode->data_block_num[dblock_indirect_idx] = dblock_idx;
     }
+    return last_idx + 1;
+}
 
-    data_block_t* dblock= &file_system.data_block_base[dblock_idx] ; /*the current data block*/
-    
-    int cur_byte = offset; /* Current byte out of total bytes of file*/
-    int cur_pos = (offset < BLOCK_SIZE) ? offset : offset % BLOCK_SIZE; /*current position within the 4096-byte block */
-    uint8_t * start_pos_dst = dblock->bytes + offset % BLOCK_SIZE; /* Find start_pos of the destination where we copy data TO*/
-    uint8_t * start_pos_src = buf;                   /* Find start_pos of the source where we copy data from*/
-
-    uint32_t len_counter; /* len_counter for for loop, capped at length*/
-    uint32_t num_bytes_written = 0; /* num_bytes written*/
-    for (len_counter = 0; len_counter < length; len_counter ++){
-        
-         if (cur_pos == BLOCK_SIZE) { /* We've reached the end of a data block. Move on to the next data block.*/
-            dblock_indirect_idx += 1;
-            dblock_idx = inode_block->data_block_num[dblock_indirect_idx];
-            if (dblock_idx == 0) { /* We've reached all of our currently used data blocks. Find a brand-new one. */
-                dblock_idx = get_avail_data_block_num();
-                if (dblock_idx == -1) {
-                    return num_bytes_written; /* No more data blocks. Return.*/
-                }
-                inode_block->data_block_num[dblock_indirect_idx] = dblock_idx;
-                file_system.data_block_flags[dblock_idx] = 1;/* Marked this as occupied. */
-            }
+/**
+ * inode_truncate
+ * DESCRIPTION: Cut a file down to new_length bytes, zeroing the rest of its
+ *              last block and giving back the data blocks past it. Also
+ *              gives back blocks reserved past the end of the file.
+ *              Pages of the file mapped by mmap past the kept blocks
+ *              read as zeros from then on.
+ * RETURN: 0 on success, -1 if new_length is past the end of the file
+ *         or a process runs the file
+*/
+static int32_t inode_truncate(inode_t* inode, uint32_t new_length) {
+    if (new_length > inode->length) {
+        return -1;
+    }
+    if (pcb_running_image(inode - file_system.inode_base)) {
+        return -1; /* a process runs from these blocks*/
+    }
+    if (new_length % BLOCK_SIZE) {
+        inode_copy(inode, new_length, NULL, BLOCK_SIZE - new_length % BLOCK_SIZE, 1);
+    }
+    uint32_t keep = (new_length + BLOCK_SIZE - 1) / BLOCK_SIZE; /* blocks still in use*/
+    pcb_mmap_truncate(inode - file_system.inode_base, keep); /* mappings must not see the blocks once reused*/
 
+    if (file_system.version == FS_VERSION_EXTENT) {
+        uint32_t i, total = 0;
+        for (i = 0; i < inode->num_extents; i++) {
+            total += inode_extent(inode, i)->count;
+        }
 
-            dblock = &file_system.data_block_base[dblock_idx];
-            start_pos_dst = dblock->bytes;
+        /* Trim extents from the end */
+        while (total > keep) {
+            extent_t* last = inode_extent(inode, inode->num_extents - 1);
+            uint32_t drop = total - keep;
+            if (drop > last->count) {
+                drop = last->count;
+            }
+            for (i = last->count - drop; i < last->count; i++) {
+                mark_data_block(last->start + i, 0);
+            }
+            last->count -= drop;
+            total -= drop;
+            if (last->count == 0) {
+                inode->num_extents--;
+            }
         }
-        memcpy(start_pos_dst, start_pos_src, 1); /* copy one byte at a time into the buffer*/
-        num_bytes_written += 1;
-        if (offset + num_bytes_written >= inode_block->length) { /* If we end up writing past the original length of the file*/
-            inode_block->length = offset + num_bytes_written;
+        if (inode->num_extents <= INODE_EXTENTS && inode->indirect_block != 0) {
+            mark_data_block(inode->indirect_block, 0);
+            inode->indirect_block = 0;
         }
-        cur_pos += 1;
-        cur_byte += 1;
-        start_pos_dst += 1;
-        start_pos_src += 1;
-       
+    } else {
+        uint32_t d;
+        for (d = keep; d < MAX_DATA_BLOCKS; d++) {
+            if (inode->data_block_num[d] != 0) {
+                mark_data_block(inode->data_block_num[d], 0); /* Mark as unoccupied*/
+                inode->data_block_num[d] = 0;
+            }
+        }
+    }
+
+    inode->length = new_length;
+    return 0;
+}
+
+/**
+ * write_data
+ * DESCRIPTION: Write length bytes at offset, growing the file if needed.
+ *              Every data block the write touches is reserved before any
+ *              byte is copied, each found from the free block hint. The
+ *              copy then goes one run of adjacent blocks at a time, and the
+ *              inode length is updated once at the end. If blocks run out,
+ *              the write is cut short at the first block that could not be
+ *              reserved. Writing past the end of the file zero fills the gap.
+ *              The image of a running program cannot be written.
+ * RETURN: Number of bytes written, -1 if offset is past the largest file
+ *         or a process runs the file
+*/
+int32_t write_data(uint32_t inode, uint32_t offset, uint8_t * buf, uint32_t length){
+    boot_block_t * bblock = file_system.boot_block;
+    if (inode >= bblock->inode_count) {
+        return -1;
+    }
+    if (pcb_running_image(inode)) {
+        return -1;
+    }
+    inode_t * inode_block = &file_system.inode_base[inode];
 
+    /* Block map inodes hold MAX_DATA_BLOCKS blocks, extent files are only limited by free blocks */
+    uint32_t max_blocks = (file_system.version == FS_VERSION_EXTENT) ? NUM_DATA_BLOCKS : MAX_DATA_BLOCKS;
+    uint32_t first_idx = offset / BLOCK_SIZE; /* index of the first 4kB block written*/
+    if (first_idx >= max_blocks) { /* Used up all the data blocks. */
+        return -1;
+    }
+    if (length > max_blocks * BLOCK_SIZE - offset) {
+        length = max_blocks * BLOCK_SIZE - offset;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    /* Reserve every missing block up front */
+    uint32_t last_idx = (offset + length - 1) / BLOCK_SIZE;
+    uint32_t reserved = inode_reserve(inode_block, first_idx, last_idx);
+    if (reserved <= last_idx) {
+        if (reserved <= first_idx) {
+            inode_truncate(inode_block, inode_block->length); /* give back blocks reserved for the gap*/
+            return 0;
+        }
+        length = reserved * BLOCK_SIZE - offset; /* No more data blocks, write what fits*/
     }
 
-    return num_bytes_written;
-   
+    if (offset > inode_block->length) {
+        inode_copy(inode_block, inode_block->length, NULL, offset - inode_block->length, 1);
+    }
+    inode_copy(inode_block, offset, buf, length, 1);
+
+    /* Writing past the original length of the file grows it. The rest of
+       the new last block may be left over from another file, so zero it:
+       bytes past the end of a file always read as zero once mapped. */
+    if (offset + length > inode_block->length) {
+        inode_block->length = offset + length;
+        if (inode_block->length % BLOCK_SIZE) {
+            inode_copy(inode_block, inode_block->length, NULL, BLOCK_SIZE - inode_block->length % BLOCK_SIZE, 1);
+        }
+    }
 
-     
+    return length;
 }
 
-/* Helper for backspace -- offset is always assumed to be the length of the file*/
+/* Helper for backspace -- removes length bytes from the end of the file*/
 int32_t delete_data(uint32_t inode, uint32_t length) {
-    
     boot_block_t * bblock = file_system.boot_block;
     if (inode >= bblock->inode_count) {
         return -1;
     }
     inode_t * inode_block = &file_system.inode_base[inode];
     uint32_t initial_length = inode_block->length; /* Initial length*/
-   
-   
-    /* We should notice that 0 is never used for a data block number... this could be slightly problematic,
-    as this deprives us of an additional 4096 bytes, but I will gloss over this for now.                    */
-
-   
-    int32_t dblock_indirect_idx; /* indirect index to access where in the data_block_num field of the inode*/
-   
-    dblock_indirect_idx = initial_length / BLOCK_SIZE;
-    
-    uint32_t num_bytes = inode_block->length; /* total number of bytes of the file*/
-    int32_t dblock_idx = inode_block->data_block_num[dblock_indirect_idx]; /*index to access which data block*/
-   
 
-    data_block_t* dblock= &file_system.data_block_base[dblock_idx] ; /*the current data block*/
-    
-    int cur_byte = num_bytes; /* Current byte out of total bytes of file*/
-    int cur_pos = (num_bytes < BLOCK_SIZE) ? num_bytes : num_bytes % BLOCK_SIZE; /*current position within the 4096-byte block */
-    uint8_t * start_pos_dst = dblock->bytes + num_bytes % BLOCK_SIZE; /* Find start_pos of the destination where we copy data TO*/
+    uint32_t new_length = (length >= initial_length) ? 0 : initial_length - length;
+    if (inode_truncate(inode_block, new_length)) {
+        return -1;
+    }
 
-    uint32_t len_counter; /* len_counter for for loop, capped at length*/
-    uint32_t num_bytes_written = 0; /* num_bytes written*/
-    for (len_counter = 0; len_counter < length; len_counter ++){
-        
-         if (cur_pos < 0) { /* We've reached the end of a data block. Move on to the next data block.*/
-            if (dblock_indirect_idx == 0) { /* We've cleared the whole file! */
-                return num_bytes_written;
+    return initial_length - new_length;
+}
+
+/**
+ * inode_mark_blocks
+ * DESCRIPTION: Mark every data block of an inode in the image as in use
+*/
+static void inode_mark_blocks(inode_t* inode) {
+    if (file_system.version == FS_VERSION_EXTENT) {
+        uint32_t i, b;
+        if (inode->indirect_block != 0) {
+            mark_data_block(inode->indirect_block, 1);
+        }
+        for (i = 0; i < inode->num_extents; i++) {
+            extent_t* extent = inode_extent(inode, i);
+            for (b = 0; b < extent->count; b++) {
+                mark_data_block(extent->start + b, 1);
             }
-            file_system.data_block_flags[dblock_idx] = 0; /* Mark as unoccupied*/
-            inode_block->data_block_num[dblock_indirect_idx] = 0;
-            dblock_indirect_idx -= 1;
-            dblock_idx = inode_block->data_block_num[dblock_indirect_idx];
-            dblock = &file_system.data_block_base[dblock_idx];
-            start_pos_dst = dblock->bytes[BLOCK_SIZE - 1];
         }
-        *start_pos_dst = 0;
-        num_bytes_written += 1;
-        inode_block->length -= 1;
-        cur_pos -= 1;
-        cur_byte -= 1;
-        start_pos_dst -= 1;
-       
-
+        return;
     }
+    int dblock_indirect_idx = 0;
+    int dblock_idx = inode->data_block_num[dblock_indirect_idx];
+    while (dblock_idx != 0 && dblock_indirect_idx < MAX_DATA_BLOCKS) {
+        mark_data_block(dblock_idx, 1);
+        dblock_indirect_idx += 1;
+        dblock_idx = inode->data_block_num[dblock_indirect_idx];
+    }
+}
 
-    return num_bytes_written;
-
+/**
+ * dentry_mark_inode
+ * DESCRIPTION: Mark the data blocks behind a dentry as in use, and for a
+ *              directory everything below it. The caller marks the inode.
+*/
+static void dentry_mark_inode(dentry_t* dentry) {
+    if (dentry->filetype == FILE_TYPE_REG) {
+        inode_mark_blocks(&file_system.inode_base[dentry->inode_num]);
+        return;
+    }
+    if (dentry->filetype != FILE_TYPE_DIR || dentry->inode_num == ROOT_DIR_INODE ||
+        file_system.version != FS_VERSION_EXTENT || dentry->inode_num >= file_system.boot_block->inode_count) {
+        return;
+    }
 
+    inode_mark_blocks(&file_system.inode_base[dentry->inode_num]);
+    uint32_t index = 0;
+    dentry_t entry;
+    while (read_dentry_in_dir(dentry->inode_num, &index, &entry) == 0) {
+        if (entry.inode_num >= file_system.boot_block->inode_count || inode_used(entry.inode_num)) {
+            continue; /* Marked through another name, which also stops loops*/
+        }
+        mark_inode(entry.inode_num, 1);
+        dentry_mark_inode(&entry);
+    }
 }
 
 /* parses the file system */
-uint32_t parse_filesystem (uint32_t mod_start) {
+uint32_t parse_filesystem (uint32_t mod_start, uint32_t mod_end) {
     /* null pointer checks */
     if (!mod_start) return -1;
-    memset(file_system.inode_flags, 0, MAX_FILES);
-    memset(file_system.data_block_flags, 0 ,MAX_FILES * MAX_DATA_BLOCKS);
-    file_system.data_block_flags[0] = 1; /* 0 is never used for a data block number*/ 
+    memset(file_system.inode_bitmap, 0, sizeof(file_system.inode_bitmap));
+    memset(file_system.data_block_bitmap, 0, sizeof(file_system.data_block_bitmap));
+    file_system.inode_hint = 0;
+    file_system.data_block_hint = 0;
+
+    /* Bits past the last data block number are never handed out */
+    if (NUM_DATA_BLOCKS % FS_BITMAP_BITS) {
+        file_system.data_block_bitmap[DATA_BLOCK_BITMAP_WORDS - 1] = FS_BITMAP_FULL << (NUM_DATA_BLOCKS % FS_BITMAP_BITS);
+    }
+    mark_data_block(0, 1); /* 0 is never used for a data block number*/ 
 
 
     /* Setting the pointers to the appropriate blocks */
@@ -382,22 +1027,56 @@ uint32_t parse_filesystem (uint32_t mod_start) {
     /* The first inode is one after the boot block --- Should we just set these to the file_system member variables or do it like this for byte offsets?*/
     file_system.inode_base = (inode_t*)file_system.boot_block + 1;
     file_system.data_block_base = (data_block_t*)(file_system.inode_base + file_system.boot_block->inode_count);
+
+    /* Images without the magic number are the original block map format */
+    file_system.version = FS_VERSION_BLOCK_MAP;
+    if (file_system.boot_block->magic == FS_MAGIC && file_system.boot_block->version == FS_VERSION_EXTENT) {
+        file_system.version = FS_VERSION_EXTENT;
+    }
+
+    /* Blocks past the image, or past the mapped part of the module, are not backed by it, so files only grow into the image */
+    uint32_t data_end = file_system.boot_block->data_count;
+    uint32_t mapped_blocks = (mod_end > (uint32_t)file_system.data_block_base) ? (mod_end - (uint32_t)file_system.data_block_base) / BLOCK_SIZE : 0;
+    if (data_end > mapped_blocks) {
+        data_end = mapped_blocks;
+    }
+    uint32_t dblock_idx;
+    for (dblock_idx = data_end; dblock_idx < NUM_DATA_BLOCKS; dblock_idx ++) {
+        file_system.data_block_bitmap[dblock_idx / FS_BITMAP_BITS] |= (1 << (dblock_idx % FS_BITMAP_BITS));
+    }
     
     
+    /* Only the image's inodes exist, the rest would land on data blocks */
+    uint32_t inode_idx = file_system.boot_block->inode_count;
+    uint32_t max_inodes = (file_system.version == FS_VERSION_EXTENT) ? MAX_INODES : MAX_FILES;
+    if (inode_idx > max_inodes) {
+        inode_idx = max_inodes;
+    }
+    for (; inode_idx < INODE_BITMAP_WORDS * FS_BITMAP_BITS; inode_idx ++) {
+        file_system.inode_bitmap[inode_idx / FS_BITMAP_BITS] |= (1 << (inode_idx % FS_BITMAP_BITS));
+    }
+
     int dir_idx;
+    for (dir_idx = 0; dir_idx < DENTRY_HASH_SIZE; dir_idx ++) {
+        file_system.dentry_hash[dir_idx].dir_idx = DENTRY_HASH_EMPTY;
+    }
     for (dir_idx = 0; dir_idx < file_system.boot_block->dir_count; dir_idx ++) {
         int inode_num = file_system.boot_block->direntries[dir_idx].inode_num;
-        file_system.inode_flags[inode_num] = 1; /* in use*/
-        inode_t cur_inode = file_system.inode_base[inode_num];
-        int dblock_indirect_idx = 0;
-        int dblock_idx = cur_inode.data_block_num[dblock_indirect_idx];
-        while (dblock_idx != 0) {
-            file_system.data_block_flags[dblock_idx] = 1;
-            dblock_indirect_idx += 1;
-            dblock_idx = cur_inode.data_block_num[dblock_indirect_idx];
-
+        dentry_hash_insert(dir_idx); /* look up by name */
+        if (inode_used(inode_num)) {
+            continue; /* "." and "rtc" share inode 0, only mark it once */
         }
-        
+        mark_inode(inode_num, 1); /* in use*/
+        dentry_mark_inode(&file_system.boot_block->direntries[dir_idx]);
+    }
+
+    /* Root names past the boot block */
+    if (root_dir_inode() != ROOT_DIR_INODE && !inode_used(root_dir_inode())) {
+        dentry_t root_dir;
+        root_dir.filetype = FILE_TYPE_DIR;
+        root_dir.inode_num = root_dir_inode();
+        mark_inode(root_dir.inode_num, 1);
+        dentry_mark_inode(&root_dir);
     }
 
     
@@ -419,12 +1098,8 @@ int32_t file_ioctl(int32_t fd, uint32_t command, uint32_t arg1)
         case CLEAR_FILE: {
             return clear_file( (uint8_t * )arg1);
         }
-        case SET_FILE_POS_CUR_LENGTH:{
-            return set_file_pos_cur_length(arg1);
-        }
-        case SDM:
-        {
-            return sdm(arg1);
+        case TRUNCATE_FILE: {
+            return truncate_file(fd, arg1);
         }
         default:
             break;
@@ -437,27 +1112,7 @@ int32_t create_new_file(uint8_t * fname) {
     if (fname == NULL) {
         return -1;
     }
-    
-
-    boot_block_t * bblock = file_system.boot_block;
-    uint32_t num_direntries = bblock->dir_count;
-    /* We didn't find a matching file name. This means we are not writing to an existing file but rather creating a new file*/
-    if (num_direntries >= MAX_FILES) {
-        return -1; /* Reached max files*/
-    } 
-
-    int32_t new_inode_num = get_avail_inode_idx(); /* Get next available inode index*/
-    file_system.inode_flags[new_inode_num] = 1; /* Mark as occupied now*/
-    if (new_inode_num == -1)return -1;
-
-    /* update the boot block's dentries */
-    // bblock->direntries[bblock->dir_count];
-    strncpy(bblock->direntries[bblock->dir_count].filename, (int8_t*)fname, FILENAME_LEN );
-    bblock->direntries[bblock->dir_count].filetype = FILE_TYPE_REG; /* Assuming I'm not working with a directory or the RTC...  idk what to do for that */
-    bblock->direntries[bblock->dir_count].inode_num = new_inode_num;
-    bblock->dir_count ++;
-
-    return 0;
+    return dentry_create(fname, NULL);
 }
 
 
@@ -470,38 +1125,17 @@ int32_t clear_file(uint8_t * fname)  {
     write_dentry_by_name(fname, &temp_dentry) ; /* Fill in the dentry, which we use to get the inode number*/
     int inode_num = temp_dentry.inode_num; /* Get the inode number*/
     inode_t * inode = &file_system.inode_base[inode_num]; /* Get the inode */
-    int num_data_blocks = inode->length / BLOCK_SIZE; /* Find number of data blocks to clear*/
-    if (inode->length % BLOCK_SIZE > 0) {
-        num_data_blocks ++;
-    }
+    return inode_truncate(inode, 0); /* Give back every data block*/
 
-    int d;
-    for (d = 0 ; d < num_data_blocks ;d ++ ){
-        int dblock_idx = inode->data_block_num[d];
-        data_block_t * cur_block = &file_system.data_block_base[dblock_idx];
-        memset( cur_block->bytes, 0 , BLOCK_SIZE); /* Clear the data blocks*/
-        inode->data_block_num[d] = 0;
-    }
-
-    inode->length = 0;
- 
-    
-    return 0;    
-
-}
-
-int32_t set_file_pos_cur_length(int fd) {
-    int inode_num = pcb_get_inode(fd);
-    if (inode_num == -1) return -1;
-    int length = file_system.inode_base[inode_num].length;
-    pcb_set_file_pos(fd, length);
-    return 0;
 }
 
-/* Set delete mode */
-int32_t sdm(int fd) {
-    delete_mode = 1;
-    return 0;
+/* Shorten the regular file open on fd to length bytes, its position is left alone */
+int32_t truncate_file(int32_t fd, uint32_t length) {
+    if (-1 == pcb_check_valid_fd(fd) || get_curr_pcb()->file_array[fd].op_table != &file_op_table) {
+        return -1;
+    }
+    inode_t * inode = &file_system.inode_base[pcb_get_inode(fd)];
+    return inode_truncate(inode, length);
 }
 /* Reads n number of bytes from a file into the buffer */
 int32_t file_read(int32_t fd, void* buf, int32_t nbytes) {
@@ -524,42 +1158,43 @@ int32_t file_write(int32_t fd, const void* buf, int32_t nbytes) {
     if (-1 == file_pos) return -1;
     if (-1 == inode) return -1;
     int num_bread = write_data(inode, file_pos, buf,nbytes);
-    if (! delete_mode) {
+    if (num_bread == -1) return -1;
     file_pos += num_bread;
-    } else {
-        file_pos -= num_bread;
-        if (file_pos < 0 ) file_pos = 0;
-    }
     pcb_set_file_pos(fd,file_pos);
     return num_bread ;
 }
 
 int32_t file_open(const uint8_t* filename) {
-    delete_mode = 0;
     return 0;
     /* Otherwise open the file */
     //return PCB_open(0, dentry.inode_num);
 }
 
 int32_t file_close(int32_t fd) {
-    delete_mode = 0;
     return 0;
     //return PCB_close(fd);
 }
 
 /* Read number of bytes from a directory */
+/* The fd's file position is the index of the next entry, so each open has its own cursor */
 int32_t dir_read(int32_t fd, void* buf, int32_t nbytes) {
-    if (cur_dir < 0 || cur_dir >= file_system.boot_block->dir_count) {
+    int32_t index = pcb_get_file_pos(fd);
+    if (index < 0) {
         return 0;
     }
+    int32_t dir_inode = pcb_get_inode(fd); /* the directory opened on this fd*/
+    if (dir_inode == -1) {
+        dir_inode = ROOT_DIR_INODE;
+    }
     dentry_t dentry;
-    int ret = read_dentry_by_index(cur_dir, &dentry);
+    int ret = read_dentry_in_dir(dir_inode, (uint32_t*)&index, &dentry);
     if (ret == -1) {
         return 0;
     }
+    pcb_set_file_pos(fd, index);
     uint8_t* name_of_file = dentry.filename;
-    strncpy((int8_t*)buf, (int8_t*)name_of_file, FILENAME_LEN + 1);
-    cur_dir += 1;
+    strncpy((int8_t*)buf, (int8_t*)name_of_file, FILENAME_LEN);
+    ((int8_t*)buf)[FILENAME_LEN] = '\0';
     if (strlen(buf) < FILENAME_LEN) {
         return strlen(buf);
     } else {
@@ -567,17 +1202,45 @@ int32_t dir_read(int32_t fd, void* buf, int32_t nbytes) {
     }
 }
 
+/* Fill buf with as many entries as fit, from the same cursor as dir_read */
+int32_t dir_getdents(int32_t fd, void* buf, int32_t nbytes) {
+    if (buf == NULL || nbytes < (int32_t)sizeof(dirent_t)) {
+        return -1;
+    }
+    int32_t index = pcb_get_file_pos(fd);
+    if (index < 0) {
+        return 0;
+    }
+    int32_t dir_inode = pcb_get_inode(fd); /* the directory opened on this fd*/
+    if (dir_inode == -1) {
+        dir_inode = ROOT_DIR_INODE;
+    }
+
+    dirent_t* entries = (dirent_t*)buf;
+    uint32_t max_entries = nbytes / sizeof(dirent_t);
+    uint32_t count = 0;
+    dentry_t dentry;
+    while (count < max_entries && read_dentry_in_dir(dir_inode, (uint32_t*)&index, &dentry) == 0) {
+        dirent_t* entry = &entries[count++];
+        entry->inode_num = dentry.inode_num;
+        entry->filetype = dentry.filetype;
+        entry->size = (dentry.filetype == FILE_TYPE_REG) ? file_system.inode_base[dentry.inode_num].length : 0;
+        memcpy(entry->filename, dentry.filename, FILENAME_LEN);
+        entry->filename[FILENAME_LEN] = '\0';
+    }
+    pcb_set_file_pos(fd, index);
+    return count * sizeof(dirent_t);
+}
+
 int32_t dir_write(int32_t fd, const void* buf, int32_t nbytes) {
     return -1;
 }
 
 
 int32_t dir_open(const uint8_t* filename) {
-    cur_dir = 0;
     return 0;
 }
 
 int32_t dir_close(int32_t fd) {
-    cur_dir = 0;
     return 0;
 }
@@ -6,12 +6,30 @@
 #define FILE_TYPE_DIR 1
 #define FILE_TYPE_REG 2
 #define FILE_TYPE_RTC 0
-#define MAX_FILES 63
+#define MAX_FILES 63 /* dentries in the boot block, which is the root directory */
+#define MAX_INODES 4096 /* inodes an extent image may have, block map images use at most MAX_FILES */
 #define MAX_DATA_BLOCKS 1023 /* number of datablocks in a single inode*/
+#define NUM_DATA_BLOCKS (MAX_FILES * MAX_DATA_BLOCKS) /* data block numbers the file system can hand out */
+#define FS_BITMAP_BITS 32
+#define FS_BITMAP_FULL 0xFFFFFFFF
+#define INODE_BITMAP_WORDS ((MAX_INODES + FS_BITMAP_BITS - 1) / FS_BITMAP_BITS)
+#define DATA_BLOCK_BITMAP_WORDS ((NUM_DATA_BLOCKS + FS_BITMAP_BITS - 1) / FS_BITMAP_BITS)
+#define FS_MAGIC 0x31393346 /* "F391" at the start of the boot block reserved bytes */
+#define FS_VERSION_BLOCK_MAP 1 /* inodes list every data block (images without FS_MAGIC) */
+#define FS_VERSION_EXTENT 2 /* inodes list (start, count) extents of data blocks */
+#define INODE_EXTENTS ((BLOCK_SIZE - 3 * sizeof(uint32_t)) / sizeof(extent_t)) /* extents held in the inode itself */
+#define INDIRECT_EXTENTS (BLOCK_SIZE / sizeof(extent_t)) /* extents held in the indirect extent block */
+#define MAX_EXTENTS (INODE_EXTENTS + INDIRECT_EXTENTS)
+#define ROOT_DIR_INODE 0 /* "." in the boot block, directory entries of inode 0 are the boot block's */
+#define DIR_ENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(dentry_t)) /* dentry slots in one directory bucket */
+#define DENTRY_HASH_SIZE 128 /* open addressed name table, a power of two at least twice MAX_FILES */
+#define DENTRY_HASH_EMPTY -1
 #define CREATE_NEW_FILE 0
 #define CLEAR_FILE 1
-#define SET_FILE_POS_CUR_LENGTH 2
-#define SDM 3
+#define TRUNCATE_FILE 4 /* ioctl on an open file, arg is the new length */
+#define SEEK_SET 0 /* lseek from the start of the file */
+#define SEEK_CUR 1 /* lseek from the file position */
+#define SEEK_END 2 /* lseek from the end of the file */
 typedef struct {
     uint8_t filename[FILENAME_LEN];
     uint32_t filetype;
@@ -20,31 +38,81 @@ typedef struct {
 
 } dentry_t;
 
+/* One directory entry as filled in by getdents, the name is NUL terminated */
+typedef struct {
+    uint32_t inode_num;
+    uint32_t filetype;
+    uint32_t size; /* length in bytes of a regular file, 0 otherwise */
+    uint8_t filename[FILENAME_LEN + 1];
+} dirent_t;
+
 typedef struct  {
     uint32_t dir_count; /*directory count*/
     uint32_t inode_count; /*count of inode blocks*/
     uint32_t data_count; /*count of data blocks*/
-    unsigned char reserved[52]; /* Need 52 Reserved bytes of the boot block*/
+    uint32_t magic; /* FS_MAGIC if the version field is valid*/
+    uint32_t version; /* FS_VERSION_* */
+    uint32_t root_inode; /* extent images: directory inode holding root names past the boot block, 0 if none */
+    unsigned char reserved[40]; /* Need 52 Reserved bytes of the boot block, 12 used by magic, version and root_inode*/
     dentry_t direntries[63]; /*We can store 63 Directory entries */
 } boot_block_t;
 
+/* A run of count data blocks starting at data block number start */
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} extent_t;
+
 typedef struct {
     uint32_t length; /* size of the file in bytes*/
-    uint32_t data_block_num[MAX_DATA_BLOCKS]; /* number of 4kB (4096 bytes) data blocks */
+    union {
+        /* FS_VERSION_BLOCK_MAP: one entry per 4kB block of the file, 0 for none */
+        uint32_t data_block_num[MAX_DATA_BLOCKS]; /* number of 4kB (4096 bytes) data blocks */
+
+        /* FS_VERSION_EXTENT: the file is the concatenation of its extents */
+        struct {
+            uint32_t num_extents; /* extents in use, the first INODE_EXTENTS live here */
+            uint32_t indirect_block; /* data block holding the rest of the extents, 0 if none */
+            extent_t extents[INODE_EXTENTS];
+        };
+    };
 } inode_t;
 
 typedef struct {
     uint8_t bytes[BLOCK_SIZE];
 } data_block_t;
 
+/*
+ * Directories other than the root (extent images only) are inodes of
+ * FILE_TYPE_DIR whose data is length / BLOCK_SIZE buckets of
+ * DIR_ENTRIES_PER_BLOCK dentries. A name lives in bucket
+ * hash % buckets, or the next bucket with room when that one is full.
+ * Slots fill from the front and are never emptied, so an empty name ends
+ * both a bucket and the search. A name whose bucket is full first doubles
+ * the buckets, appending the new ones to the inode and putting every name
+ * back where its hash now points.
+ *
+ * The root is the boot block's dentries. Once those are used up on an
+ * extent image, further root names go in the directory inode root_inode.
+ */
+
+typedef struct {
+    uint32_t hash; /* full name hash, compared before the name itself */
+    int32_t dir_idx; /* index into the boot block dentries, DENTRY_HASH_EMPTY if unused */
+} dentry_hash_entry_t;
+
 typedef struct file_system_t {
     boot_block_t* boot_block; /* pointer to the boot block */
     inode_t* inode_base; /* pointer to the first inode */
     data_block_t* data_block_base; /* pointer to the first data block */
-    int8_t inode_flags[MAX_FILES]; /* If an inode # (out of 63) is used by a certain file*/         
-                                    /* 1 means occupied, 0 means not occupied */
-    int8_t data_block_flags[MAX_FILES * MAX_DATA_BLOCKS]; /* If a datablock # (out of 63 * 1023) is used by an inode*/
-                                                          /* 1 means occupied, 0 means not occupied*/
+    uint32_t inode_bitmap[INODE_BITMAP_WORDS]; /* If an inode # (out of 63) is used by a certain file*/
+                                               /* bit set means occupied, clear means not occupied */
+    uint32_t data_block_bitmap[DATA_BLOCK_BITMAP_WORDS]; /* If a datablock # (out of 63 * 1023) is used by an inode*/
+                                                        /* bit set means occupied, clear means not occupied*/
+    uint32_t version; /* FS_VERSION_* of the loaded image */
+    dentry_hash_entry_t dentry_hash[DENTRY_HASH_SIZE]; /* boot block dentries by file name */
+    uint32_t inode_hint; /* Search for a free inode starts here */
+    uint32_t data_block_hint; /* Search for a free data block starts here, just past the last one handed out */
 
 } file_system_t;
 
@@ -52,8 +120,12 @@ extern file_system_t file_system;
 
 /* Read a dentry by the given file name */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry);
+/* Read the next used entry of a directory from slot *index on, advancing *index past it */
+int32_t read_dentry_in_dir (uint32_t dir_inode, uint32_t* index, dentry_t* dentry);
 /*  Read a dentry by the given index */
 int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry);
+/* Address of the data block holding 4kB block file_block of a file, NULL past the end or for a hole */
+uint8_t* file_data_page(uint32_t inode, uint32_t file_block);
 /* Read a data blocks for a given inode */
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
@@ -65,15 +137,17 @@ int32_t get_avail_data_block_num();
 
 int32_t get_avail_inode_idx();
 
+void mark_data_block(uint32_t dblock_idx, int32_t used);
+
+void mark_inode(uint32_t inode_idx, int32_t used);
+
 int32_t file_ioctl(int32_t fd, uint32_t command, uint32_t args );
 
 int32_t create_new_file( uint8_t * fname);
 
 int32_t clear_file(uint8_t * fname);
 
-int32_t set_file_pos_cur_length(int fd);
-
-int32_t sdm(int forget);
+int32_t truncate_file(int32_t fd, uint32_t length);
 
 int32_t delete_data(uint32_t inode, uint32_t length); 
 
@@ -83,9 +157,10 @@ int32_t delete_data(uint32_t inode, uint32_t length);
  * @brief Parses the filesystem structure into struct architecture. Look at file.h
  * 
  * @param mod_start pointer to the start of the module
+ * @param mod_end end of the mapped part of the module, data blocks past it are never used
  * @return -1 on fail, 0 on success
 */
-uint32_t parse_filesystem (uint32_t mod_start);
+uint32_t parse_filesystem (uint32_t mod_start, uint32_t mod_end);
 
 /**
  * @brief Reads data from a file into the buffer
@@ -133,6 +208,18 @@ int32_t file_close(int32_t fd);
 */
 int32_t dir_read(int32_t fd, void* buf, int32_t nbytes);
 
+/**
+ * @brief Fills a buffer with as many dirent_t entries of a directory as fit,
+ *        continuing from the position of the fd
+ * 
+ * @param fd file descriptor index of a directory
+ * @param buf buffer to place the entries in
+ * @param nbytes size of the buffer
+ * @return -1 if not even one entry fits, 0 past the last entry,
+ *         number of bytes placed in buffer otherwise
+*/
+int32_t dir_getdents(int32_t fd, void* buf, int32_t nbytes);
+
 /**
  * @brief Does nothing, returns -1
  * 
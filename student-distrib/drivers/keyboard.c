@@ -5,6 +5,8 @@
 
 #include "RTC.h"
 
+extern terminal_info_t tcb[MAX_NUM_TERMINAL];
+
 /* Keyboard op table for PCB jumps, see types.h */
 device_op_table_t keyboard_op_table = {
     keyboard_read,
@@ -189,6 +191,9 @@ void keyboard_handler(void)
 
             /* Send keycode to terminal */
             putc(keycode);
+
+            /* Let a sleeping terminal_read recheck the line buffer */
+            wake_up(&tcb[get_active_tcb_idx()].line_wait);
         }   
 
         /* Handle special keys */
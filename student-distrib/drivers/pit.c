@@ -18,12 +18,16 @@ void initialize_pit(void) {
     enable_irq(PIT_IRQ);
 }
 
+irq_frame_t* pit_irq_frame;
+
 /**
  * @brief Interrupt handler for programmable interval timer on IRQ0
 */
 void pit_handler(void) {
-    
+    /* Read before anything can switch stacks */
+    uint32_t user = (pit_irq_frame->cs & PIT_CS_RPL_MASK) == PIT_USER_RPL;
+
     send_eoi(PIT_IRQ);
 
-    context_switch();
+    sched_tick(user);
 }
@@ -14,11 +14,28 @@
 /* channel 0, lo/hi, mode 2 */
 #define PIT_COMMAND_WORD 0x34
 
+/* Privilege level of the interrupted code segment, 3 for user code */
+#define PIT_CS_RPL_MASK 0x3
+#define PIT_USER_RPL 0x3
+
+/* Pushed by the processor on IRQ0, esp and ss follow only when user code was interrupted */
+typedef struct irq_frame_t {
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+} irq_frame_t;
+
+/* Set by interrupt_0x20_linkage before pit_handler runs */
+extern irq_frame_t* pit_irq_frame;
+
 /**
  * @brief Initialize
 */
 void initialize_pit(void);
 
+/**
+ * @brief Interrupt handler for IRQ0, reads the interrupted context through pit_irq_frame
+*/
 void pit_handler(void);
 
 #endif /* _PIT_H */
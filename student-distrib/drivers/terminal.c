@@ -5,6 +5,7 @@
 #include "../i8259.h"
 #include "../proc/PCB.h"
 #include "../page.h"
+#include "../alloc.h"
 
 #if BUILD_TERMINAL
 
@@ -402,7 +403,10 @@ void next_terminal(void)
     activate_proc_vidmem(tcb[active_tcb_idx].curr_pcb->id);
     
     /* Flush TLB */
-    load_page_directory((uint32_t*)get_proc_page(get_curr_pcb()->id)->proc_pdirectory);
+    const proc_page_t* proc_page = get_proc_page(get_curr_pcb()->id);
+    if (proc_page != NULL) {
+        load_page_directory((uint32_t*)proc_page->proc_pdirectory);
+    }
 
     /* Redraw screen */
     memcpy((uint16_t*)video_mem, tcb[active_tcb_idx].screen_buffer, 2 * NUM_ROWS * NUM_COLS);
@@ -530,11 +534,17 @@ int terminal_read(int32_t fd, void* buf, int32_t nbytes)
     /* Check arguments */
     if (fd < 0 || nbytes < 0 || buf == NULL) {return -1;}
 
+    uint32_t flags;
+
     tcb[tcb_idx].terminal_rd = 1;
     clear_line_buffer();
 
-    /* Return terminal line buffer upon a newline or overflow */
-    while (tcb[tcb_idx].line_buffer[tcb[tcb_idx].buffer_idx - 1] != '\n' && tcb[tcb_idx].buffer_idx < nbytes - 1 && tcb[tcb_idx].buffer_idx != MAX_CHAR_BUFFER_SIZE - 2);
+    /* Sleep until a newline or overflow, interrupts stay off between the check and the sleep */
+    cli_and_save(flags);
+    while (tcb[tcb_idx].line_buffer[tcb[tcb_idx].buffer_idx - 1] != '\n' && tcb[tcb_idx].buffer_idx < nbytes - 1 && tcb[tcb_idx].buffer_idx != MAX_CHAR_BUFFER_SIZE - 2) {
+        sleep_on(&tcb[tcb_idx].line_wait);
+    }
+    restore_flags(flags);
 
     /* Append a Newline and null Termination */
     if (tcb[tcb_idx].buffer_idx == MAX_CHAR_BUFFER_SIZE - 2 || tcb[tcb_idx].buffer_idx == nbytes - 2) {
@@ -632,6 +642,13 @@ int32_t terminal_ioctl(int32_t fd, uint32_t command, uint32_t args)
             stop_audio();
             break;
         }
+        /* Allocator telemetry */
+        case KMEM_IOCTL_GET_STATS:
+        case KMEM_IOCTL_SET_TRACKING:
+        case KMEM_IOCTL_GET_RECORDS:
+        case KMEM_IOCTL_GET_CACHES: {
+            return kmem_ioctl(command, args);
+        }
         default:
             break;
     }
@@ -688,6 +705,14 @@ void tcb_set_pcb(uint8_t idx, pcb_t* pcb) {
     tcb[idx].curr_pcb = pcb;
 }
 
+int32_t tcb_pass_pcb(pcb_t* from, pcb_t* to) {
+    if (tcb[from->tcb_idx].curr_pcb != from) {
+        return -1;
+    }
+    tcb[from->tcb_idx].curr_pcb = to;
+    return 0;
+}
+
 uint8_t tcb_get_curr_idx(void) {
     return tcb_idx;
 }
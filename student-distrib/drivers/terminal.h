@@ -5,6 +5,7 @@
 #include "../types.h"
 #include "keyboard.h"
 #include "../proc/PCB.h"
+#include "../waitq.h"
 
 extern device_op_table_t terminal_op_table;
 
@@ -103,12 +104,16 @@ typedef struct terminal_info_t {
     /* Index to the end position of line buffer */   
     volatile uint8_t buffer_idx;
 
+    /* terminal_read sleeps here until the keyboard adds to the line buffer */
+    wait_queue_t line_wait;
+
     pcb_t* curr_pcb;
 
     /* RTC internal state variables for each terminal. */
     int rtc_freq_counter;
     int rtc_freq_rollover;
     volatile int rtc_interrupt_occurred;
+    wait_queue_t rtc_wait;
 
 } terminal_info_t;
 
@@ -298,6 +303,15 @@ pcb_t* tcb_get_pcb(uint8_t idx);
 
 void tcb_set_pcb(uint8_t idx, pcb_t* pcb);
 
+/**
+ * @brief Hand the foreground of from's terminal to another process, only if
+ *        from holds it. A background job running a program stays in the
+ *        background, and so does its child.
+ * 
+ * @return 0 if to is now the foreground process, -1 if from was not
+*/
+int32_t tcb_pass_pcb(pcb_t* from, pcb_t* to);
+
 uint8_t tcb_get_curr_idx(void);
 
 void tcb_set_curr_idx(uint8_t idx);
@@ -2,6 +2,7 @@
 #include "x86_desc.h"
 #include "idt_handler.h"
 #include "syscalls.h"
+#include "loader.h"
 
 /**
  * @brief Handler desciptor table. Holds exception, interrupt, and system call
@@ -31,7 +32,7 @@ void init_handlers(void)
     SET_STUB_DESCRIPTOR_TIDT(0x0B);
     SET_STUB_DESCRIPTOR_TIDT(0x0C);
     SET_STUB_DESCRIPTOR_TIDT(0x0D);
-    SET_STUB_DESCRIPTOR_TIDT(0x0E);
+    SET_STUB_DESCRIPTOR_IIDT(0x0E);   /* Interrupt gate, CR2 must be read before anything can fault again */
     SET_STUB_DESCRIPTOR_TIDT(0x0F);
     SET_STUB_DESCRIPTOR_TIDT(0x10);
     SET_STUB_DESCRIPTOR_TIDT(0x11);
@@ -130,6 +131,13 @@ void page_fault_handler_0x0E(void)
 
     /* Handle page fault by allocating new physical page */
     uint32_t linear_address = page_fault_linear_address();
+
+    /* Not present faults in the program window page the executable in, the access is then retried */
+    if (!(page_fault_err_code & PAGE_FAULT_PRESENT) && load_program_page(linear_address) == 0) {
+        restore_flags(eflags);
+        return;
+    }
+
     KDEBUG("Page Fault: Invalid Memory Location 0x%x\n", linear_address);
     KDEBUG("ErrCode: %x\n", page_fault_err_code);
 
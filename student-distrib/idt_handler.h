@@ -50,6 +50,9 @@ do {                                                            \
 #define PAGE_FAULT_HANDLER 14
 extern uint32_t page_fault_err_code;
 
+/* Error code bit 0: 1 = protection violation | 0 = page not present */
+#define PAGE_FAULT_PRESENT 0x1
+
 #define ASSERTION_HANDLER 15
 
 #define SYS_CALL_HANDLER 0x80
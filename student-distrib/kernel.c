@@ -24,6 +24,10 @@
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags, bit)   ((flags) & (1 << (bit)))
 
+/* mem_upper counts the KB of memory above 1MB */
+#define MEM_UPPER_START         0x100000
+#define MEM_UPPER_UNIT          1024
+
 /* Check if MAGIC is valid and print the Multiboot information structure
    pointed by ADDR. */
 void entry(unsigned long magic, unsigned long addr) {
@@ -150,6 +154,13 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Save data to be used after paging is initialized */
     module_t* mods_addr = (module_t*)mbi->mods_addr;
     uint32_t mod_start = mods_addr->mod_start;
+    uint32_t mod_end = mods_addr->mod_end;
+
+    /* Without a memory size, assume the whole buddy zone is installed */
+    uint32_t mem_end = KMEM_PAGE_END;
+    if (CHECK_FLAG(mbi->flags, 0) && mbi->mem_upper < (KMEM_PAGE_END - MEM_UPPER_START) / MEM_UPPER_UNIT) {
+        mem_end = MEM_UPPER_START + mbi->mem_upper * MEM_UPPER_UNIT;
+    }
 
     /* Initialize IDT Handlers */
     init_handlers();
@@ -157,6 +168,9 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Initialize Paging */
     init_paging();
 
+    /* Images larger than the kernel page are mapped 4KB at a time */
+    mod_end = map_module(mod_start, mod_end);
+
     /* Init the PIC */
     i8259_init();
     initialize_RTC();
@@ -166,13 +180,15 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
 
-    parse_filesystem(mod_start);
+    parse_filesystem(mod_start, mod_end);
 
-    /* Ensure pcb memory is empty before we start */
+    /* No process is alive before we start */
     initialize_all_pcbs();
 
     /* Initialize dynamic memory allocation structures */
     init_kcache();
+    init_kpage(mem_end, mod_start, mod_end);
+    init_uheap();
 
     /* Initialize SoundBlaster 16 Audio Card */
     initialize_audio();
@@ -184,18 +200,14 @@ void entry(unsigned long magic, unsigned long addr) {
     asm volatile (".2: hlt; jmp .2;");
 #endif
 
-    /* Set up two fake shells */
-    setup_shell();
-    setup_shell();
+    /* Set up the context that runs while every process is blocked */
+    setup_idle();
 
-    /* Start by setting the terminals to the 2 fake shells */
-    setup_terminals();
-    tcb_set_pcb(1, (pcb_t*)(KERNEL_BOTTOM - KSTACK_SIZE * (1+1)));
-    tcb_set_pcb(2, (pcb_t*)(KERNEL_BOTTOM - KSTACK_SIZE * (2+1)));
+    /* Set up fake shells for terminals 1 and 2 */
+    setup_shell(1);
+    setup_shell(2);
 
-    /* Tell the fake shells what terminals they belong to */
-    ((pcb_t*)(KERNEL_BOTTOM - KSTACK_SIZE * (1+1)))->tcb_idx = 1;
-    ((pcb_t*)(KERNEL_BOTTOM - KSTACK_SIZE * (2+1)))->tcb_idx = 2;
+    setup_terminals();
 
     /* Enable interrupts */
     // sti();
@@ -168,6 +168,42 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Returns the index of the least significant set bit of word.
+ * The result is undefined if word is 0 */
+static inline uint32_t bit_scan_forward(uint32_t word) {
+    uint32_t idx;
+    asm volatile ("bsfl %1, %0"
+            : "=r"(idx)
+            : "rm"(word)
+            : "cc"
+    );
+    return idx;
+}
+
+/* Returns the index of the most significant set bit of word.
+ * The result is undefined if word is 0 */
+static inline uint32_t bit_scan_reverse(uint32_t word) {
+    uint32_t idx;
+    asm volatile ("bsrl %1, %0"
+            : "=r"(idx)
+            : "rm"(word)
+            : "cc"
+    );
+    return idx;
+}
+
+/* Returns the low 32 bits of the time stamp counter, enough to
+ * time short benchmarks in cycles */
+static inline uint32_t rdtsc(void) {
+    uint32_t low;
+    asm volatile ("rdtsc"
+            : "=a"(low)
+            :
+            : "edx"
+    );
+    return low;
+}
+
 /* Generally waits around 1-4 us, writes to an unused port
  * Taken from os dev */
 static inline void io_wait(void) {
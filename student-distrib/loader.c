@@ -1,11 +1,21 @@
 #include "loader.h"
 #include "lib.h"
+#include "page.h"
 
 static elf_header_info_t elf_header;
 
 /* This will contain the memory address of the entry point. When loading this, it must be casted as a pointer. */
 uint32_t entry_point;
 
+/* Little endian fields of the ELF header */
+static uint32_t elf_word(const unsigned char* field) {
+    return (field[3] << 24) | (field[2] << 16) | (field[1] << 8) | field[0];
+}
+
+static uint32_t elf_half(const unsigned char* field) {
+    return (field[1] << 8) | field[0];
+}
+
 /**
  * DESCRIPTION: This function reads the filename for an executable, then fills in a struct called the elf_header.
  * Then, it also gets the entry point, which is the page address of where the program image should be loaded in memory.
@@ -27,7 +37,7 @@ int read_header(const uint8_t *filename) {
 
     /* We can't use a PCB here... we need some way to read the first */
     ret = read_data(inode_idx, 0, (uint8_t *)&elf_header, ELF_HEADER_SIZE);
-    if (ret == -1) {
+    if (ret != ELF_HEADER_SIZE) {
         return -1;
     }
     if (elf_header.ei_magic[0] != FIRST_BYTE || elf_header.ei_magic[1] != SECOND_BYTE || elf_header.ei_magic[2] != THIRD_BYTE || elf_header.ei_magic[3] != FOURTH_BYTE) {
@@ -36,32 +46,163 @@ int read_header(const uint8_t *filename) {
     if (dentry.filetype != FILE_TYPE_REG) {
         return -1;
     }
-    entry_point = (elf_header.e_entry[3] << 24 ) | (elf_header.e_entry[2] << 16) | (elf_header.e_entry[1] << 8) | (elf_header.e_entry[0]); /* this bitshifting ensures that the entry point is the correct value
-                                                                                                                                            (left shifting 24 moves into 3rd byte, 16 moves into 2nd byte, 8 into 1st byte, 0 into 0th byte)   */
+    entry_point = elf_word(elf_header.e_entry);
     return 0;
 }
 /**
- * DESCRIPTION:
- * WARNING: This assumes that the page has already been set up
+ * DESCRIPTION: Prepares a program image to be paged in on demand. The PT_LOAD entries of the program
+ * header table are checked against the program window and recorded in the pcb. Nothing is copied here,
+ * the program window is emptied and page_fault_handler_0x0E fills each page from the segments as it is touched.
+ * WARNING: Call this right after read_header for the same file, and before loading the page directory
+ * of the pcb, so no stale translation survives
  *  INPUTS: filename -- name of file
- *          prog_mem -- page where we copy the ELF file's data to (thus loading the program image at)
+ *          pcb -- process the image is loaded for
  * OUTPUTS: -1 on failure, 0 on success
 */
-int load_program(const uint8_t *filename,  uint8_t *prog_mem) {
-    if (filename == NULL){ 
+int load_program(const uint8_t *filename, pcb_t *pcb) {
+    if (filename == NULL || pcb == NULL){ 
         return -1;
     }
 
     dentry_t dentry;
-    int ret;
-    if ( (ret = read_dentry_by_name((uint8_t*)filename, &dentry) )== -1) {
+    if (read_dentry_by_name((uint8_t*)filename, &dentry) == -1) {
         return -1;
     }
-    int inode_idx = dentry.inode_num;
-    int length = file_system.inode_base[inode_idx].length;
+    uint32_t length = file_system.inode_base[dentry.inode_num].length;
+
+    uint32_t phnum = elf_half(elf_header.e_phnum);
+    if (elf_half(elf_header.e_phentsize) != ELF_PHDR_SIZE || phnum == 0 || phnum > ELF_MAX_PHDRS) {
+        return -1;
+    }
+    elf_program_header_t phdrs[ELF_MAX_PHDRS];
+    if (read_data(dentry.inode_num, elf_word(elf_header.e_phoff), (uint8_t*)phdrs, phnum * ELF_PHDR_SIZE) != (int32_t)(phnum * ELF_PHDR_SIZE)) {
+        return -1;
+    }
+
+    uint32_t i, num_segments = 0;
+    for (i = 0; i < phnum; i++) {
+        if (phdrs[i].p_type != PT_LOAD) {
+            continue;
+        }
+        if (num_segments == PROG_SEGMENT_ARRAY_SIZE) {
+            return -1;
+        }
+        /* Segments must fit in the program window and their file bytes in the file */
+        if (phdrs[i].p_vaddr < USER_SPACE_PROG_START || phdrs[i].p_vaddr >= USER_SPACE_PROG_END ||
+            phdrs[i].p_memsz > USER_SPACE_PROG_END - phdrs[i].p_vaddr || phdrs[i].p_filesz > phdrs[i].p_memsz ||
+            phdrs[i].p_offset > length || phdrs[i].p_filesz > length - phdrs[i].p_offset) {
+            return -1;
+        }
+        pcb->prog_segments[num_segments].vaddr = phdrs[i].p_vaddr;
+        pcb->prog_segments[num_segments].offset = phdrs[i].p_offset;
+        pcb->prog_segments[num_segments].file_size = phdrs[i].p_filesz;
+        pcb->prog_segments[num_segments].mem_size = phdrs[i].p_memsz;
+        pcb->prog_segments[num_segments].flags = phdrs[i].p_flags;
+        num_segments++;
+    }
+    if (num_segments == 0) {
+        return -1;
+    }
+
+    pcb->prog_inode = dentry.inode_num;
+    pcb->prog_num_segments = num_segments;
+
+    /* Forget the pages of whatever image this process ran before */
+    proc_prog_unmap_all(pcb->id);
+
+    return 0;
+}
 
-    /* Adjustment for fish program */
-    ret = read_data(inode_idx, 0, prog_mem, length); /* length is not the exact amount, but read_data should account for going past the file*/
+/**
+ * DESCRIPTION: Finds the data block a program page can be shared from. A page qualifies when it overlaps
+ * a single segment, that segment is read only and laid out in the file at the same offset within a page as
+ * in memory, and no bss of the segment falls in the page. Every process running the image then maps the
+ * same block of the in-memory file system, which acts as the image cache keyed by inode.
+ *  INPUTS: pcb -- process running the image
+ *          page -- page aligned address in the program window
+ * OUTPUTS: data block to map read only, NULL if the page needs a private copy
+*/
+static uint8_t* prog_shared_page(pcb_t* pcb, uint32_t page) {
+    uint32_t page_end = page + PAGE_4KB_SIZE_B;
+    uint8_t* shared = NULL;
+    uint32_t i;
+    for (i = 0; i < pcb->prog_num_segments; i++) {
+        prog_segment_t segment = pcb->prog_segments[i];
+        if (segment.vaddr >= page_end || segment.vaddr + segment.mem_size <= page) {
+            continue;
+        }
+        if (shared != NULL || (segment.flags & PF_W) || ((segment.vaddr - segment.offset) & (PAGE_4KB_SIZE_B - 1))) {
+            return NULL;
+        }
+        if (segment.mem_size > segment.file_size && segment.vaddr + segment.file_size < page_end) {
+            return NULL;
+        }
+        /* Same offset within a page in file and memory, so the page starts on a block boundary */
+        shared = file_data_page(pcb->prog_inode, (segment.offset + (page - segment.vaddr)) / PAGE_4KB_SIZE_B);
+        if (shared == NULL) {
+            return NULL;
+        }
+    }
+    return shared;
+}
+
+/**
+ * DESCRIPTION: Resolves a fault in the program window of the current process. Read only text is mapped
+ * straight from the file system when prog_shared_page allows it. Other pages get a private page from the
+ * buddy system and only the file bytes of the segments they cover are read in.
+ * Bss, gaps between segments and the stack come back as zeros. File bytes are read at fault time, not
+ * at execute, which is only sound because write_data and inode_truncate refuse the image of a running
+ * process (see pcb_running_image).
+ *  INPUTS: va -- faulting virtual address
+ * OUTPUTS: -1 if the address is not in the program window or memory ran out, 0 once the page is present
+*/
+int load_program_page(uint32_t va) {
+    if (va < USER_SPACE_PROG_START || va >= USER_SPACE_PROG_END) {
+        return -1;
+    }
+
+    pcb_t* pcb = get_curr_pcb();
+    uint32_t page = va & PAGE_4KB_BASE_ADDR_MASK;
+    uint32_t page_end = page + PAGE_4KB_SIZE_B;
+
+    uint8_t* shared = prog_shared_page(pcb, page);
+    if (shared != NULL) {
+        map_page((uint8_t*)page, shared, pcb->id, ALLOC_4KB | ALLOC_USER | ALLOC_PROG | ALLOC_READ_ONLY);
+        flush_tlb_page((uint8_t*)page);
+        return 0;
+    }
+
+    /* Private pages come from the buddy system, halt gives them back */
+    uint8_t* frame = (uint8_t*)kpage_alloc(0);
+    if (frame == NULL) {
+        return -1;
+    }
+    map_page((uint8_t*)page, frame, pcb->id, ALLOC_4KB | ALLOC_USER | ALLOC_PROG);
+    flush_tlb_page((uint8_t*)page);
+
+    /* Pages made only of file bytes are not cleared first */
+    uint32_t i;
+    for (i = 0; i < pcb->prog_num_segments; i++) {
+        prog_segment_t segment = pcb->prog_segments[i];
+        if (segment.vaddr <= page && segment.vaddr + segment.file_size >= page_end) {
+            break;
+        }
+    }
+    if (i == pcb->prog_num_segments) {
+        memset_dword((void*)page, 0, PAGE_4KB_SIZE_B / sizeof(uint32_t));
+    }
+
+    for (i = 0; i < pcb->prog_num_segments; i++) {
+        prog_segment_t segment = pcb->prog_segments[i];
+        uint32_t start = (segment.vaddr > page) ? segment.vaddr : page;
+        uint32_t end = segment.vaddr + segment.file_size;
+        if (end > page_end) {
+            end = page_end;
+        }
+        if (start < end) {
+            read_data(pcb->prog_inode, segment.offset + (start - segment.vaddr), (uint8_t*)start, end - start);
+        }
+    }
 
     return 0;
 }
@@ -5,7 +5,13 @@
 #define SECOND_BYTE 'E'
 #define THIRD_BYTE 'L'
 #define FOURTH_BYTE 'F'
-#define ELF_HEADER_SIZE 40
+#define ELF_HEADER_SIZE 52
+
+/* Program header table */
+#define ELF_PHDR_SIZE 32
+#define ELF_MAX_PHDRS 8
+#define PT_LOAD 1
+#define PF_W 0x2
 
 /* Program images are linked to execute at virtual address 0x08048000 */
 #define PROGRAM_START_MEM 0x8048000
@@ -35,5 +41,17 @@ typedef struct {
 
 } elf_header_info_t;
 
+typedef struct {
+    uint32_t p_type; /* PT_LOAD segments are the only ones placed in memory */
+    uint32_t p_offset; /* file offset of the first byte of the segment */
+    uint32_t p_vaddr; /* virtual address the segment is placed at */
+    uint32_t p_paddr; /* unused */
+    uint32_t p_filesz; /* bytes backed by the file */
+    uint32_t p_memsz; /* bytes in memory, anything past p_filesz is bss */
+    uint32_t p_flags; /* segment permissions */
+    uint32_t p_align; /* segment alignment */
+} elf_program_header_t;
+
 int read_header(const uint8_t *filename);
-int load_program(const uint8_t *filename, uint8_t *prog_mem);
+int load_program(const uint8_t *filename, pcb_t *pcb);
+int load_program_page(uint32_t va);
@@ -2,15 +2,32 @@
 #include "drivers/terminal.h" 
 
 /**
- * @brief The following data structure is used to hold all the page directories/tables
- *        for all the running processes in the system (NUM_PROCESS). Each process is given
- *        a page directory and a page table. The page directory should contain a 4MB page 
- *        at virtual address 128 MB, which is mapped to physical address 8MB + (pid * 4MB).
- *        The first process should be given pid 0. Additionally, each process should
- *        have a 4MB kernel page  at virtual and physical address 4MB. The video memory will
- *        be allocated a 4KB page in the page table. 
+ * @brief Page directory used while no process owns the CPU: at boot, and
+ *        while a terminal's last shell is torn down and restarted. Process
+ *        page directories are allocated from the buddy system by
+ *        proc_page_create().
 */
-static proc_page_t proc_pd[NUM_PROCESS];
+static pde_t kernel_pdirectory[PAGING_ENTRY_NUM] __attribute__((aligned (4096)));
+
+/**
+ * @brief Kernel page tables shared by every process page directory. Kernel
+ *        memory is identity mapped and looks the same to every process, so a
+ *        kernel mapping change is a single PTE write instead of one per process.
+*/
+/* Kernel memory [0MB - 4MB]: video memory and DMA blocks */
+static pte_t kernel_ptable[PAGING_ENTRY_NUM] __attribute__((aligned (4096)));
+
+/* Buddy system zone [8MB - 128MB], around slab cache memory [32MB - 36MB] */
+static pte_t kpage_ptable[NUM_KPAGE_PTABLES][PAGING_ENTRY_NUM] __attribute__((aligned (4096)));
+
+/* Object cache for proc_page_t, created by init_paging() */
+static kmem_cache_t* proc_page_cache;
+
+static void init_kernel_pdes(pde_t* pdirectory);
+static void* proc_table_alloc(void);
+static void proc_table_free(void* table);
+static proc_page_t* proc_page_of(uint32_t pid);
+static void proc_prog_free_all(proc_page_t* proc_page);
 
 /**
  * @brief Entrypoint function to initialize all paging structures and 
@@ -19,117 +36,264 @@ static proc_page_t proc_pd[NUM_PROCESS];
 void init_paging(void)
 {
     /* Assembly linkage to load page directory to CR3 */
-    load_page_directory((uint32_t*)proc_pd);
+    load_page_directory((uint32_t*)kernel_pdirectory);
 
-    /* Initialize page directories/tables for all processes */
+    /* Initialize the shared kernel page tables */
     init_proc_paging();
 
+    /* Process paging structures get their own object cache */
+    proc_page_cache = kmem_cache_create("proc_page", sizeof(proc_page_t), 0, NULL, NULL);
+
     /* Assembly linkage to enable page flags in CR0 and CR4 */
     enable_paging();
 }
 
 /**
- * @brief Initializes the page array for all the given processes in the system.
+ * @brief Initializes the shared kernel page tables and the kernel page directory.
 */
 void init_proc_paging(void)
 {
-    /* Empty out page directories for all processes */
+    /* Initialize shared kernel memory 0MB - 4MB as 4KB pages */
     {
-    int i;
-    for (i = 0; i < NUM_PROCESS; i++) {
-        int j;
-        for(j = 0; j < PAGING_ENTRY_NUM; j++) {
+    int j;
+    for(j = 0; j < PAGING_ENTRY_NUM; j++) {
+        /* Initializes Video memory page  */
+        if ((j * PAGE_4KB_SIZE_B) == VIDEO_MEM_START) {
+            /* Entry attributes: R/W, superuser, and present */
+            kernel_ptable[j].raw_pte = (j * PAGE_4KB_SIZE_B) | DEFAULT_KERNEL_4KB_PAGE_ENTRY; 
+        } 
+        /* Initializes DMA page blocks */
+        else if (DMA_BLOCK_START_ADDR <= (j * PAGE_4KB_SIZE_B) && (j * PAGE_4KB_SIZE_B) < DMA_BLOCK_END_ADDR) {
+            /* Entry attributes: R/W, superuser, and present */
+            kernel_ptable[j].raw_pte = (j * PAGE_4KB_SIZE_B) | DEFAULT_KERNEL_4KB_PAGE_ENTRY; 
+        } else {
             /* Entry attributes: R/W, superuser, and not present */
-            proc_pd[i].proc_pdirectory[j].raw_pde = DEFAULT_BLANK_PAGE;
+            kernel_ptable[j].raw_pte = DEFAULT_BLANK_PAGE;
         }
     }
     }
 
-    /* Initialize kernel memory 0MB - 4MB as 4KB pages for each process */
+    /* Initialize kernel memory 8MB - 128MB as 4KB pages for slab cache and buddy system memory */
     {
     int i;
-    for (i = 0; i < NUM_PROCESS; i++) {
+    for (i = 0; i < NUM_KPAGE_PTABLES; i++) {
         int j;
         for(j = 0; j < PAGING_ENTRY_NUM; j++) {
-            /* Initializes Video memory page  */
-            if ((j * PAGE_4KB_SIZE_B) == VIDEO_MEM_START) {
-                /* Entry attributes: R/W, superuser, and present */
-                proc_pd[i].proc_ptable[j].raw_pte = (j * PAGE_4KB_SIZE_B) | DEFAULT_KERNEL_4KB_PAGE_ENTRY; 
-            } 
-            /* Initializes DMA page blocks */
-            else if (DMA_BLOCK_START_ADDR <= (j * PAGE_4KB_SIZE_B) && (j * PAGE_4KB_SIZE_B) < DMA_BLOCK_END_ADDR) {
-                /* Entry attributes: R/W, superuser, and present */
-                proc_pd[i].proc_ptable[j].raw_pte = (j * PAGE_4KB_SIZE_B) | DEFAULT_KERNEL_4KB_PAGE_ENTRY; 
-            } else {
-                /* Entry attributes: R/W, superuser, and not present */
-                proc_pd[i].proc_ptable[j].raw_pte = DEFAULT_BLANK_PAGE;
-            }
+            /* Entry attributes: R/W, superuser, and not present */
+            kpage_ptable[i][j].raw_pte = DEFAULT_BLANK_PAGE;
         }
     }
     }
 
-    /* Initialize kernel memory 32MB - 36MB as 4KB pages for slab cache memory */
+    /* The kernel page directory maps nothing but the kernel */
     {
-    int i;
-    for (i = 0; i < NUM_PROCESS; i++) {
-        int j;
-        for(j = 0; j < PAGING_ENTRY_NUM; j++) {
-            /* Entry attributes: R/W, superuser, and present */
-            proc_pd[i].proc_ptable3[j].raw_pte = DEFAULT_BLANK_PAGE; 
-        }
+    int j;
+    for(j = 0; j < PAGING_ENTRY_NUM; j++) {
+        /* Entry attributes: R/W, superuser, and not present */
+        kernel_pdirectory[j].raw_pde = DEFAULT_BLANK_PAGE;
     }
     }
+    init_kernel_pdes(kernel_pdirectory);
+}
 
-    /* Setup page directory entries for each process */
-    {
-    int i;
-    for (i = 0; i < NUM_PROCESS; i++) {
-        /* Set kernel page directory entry 32 [128MB - 132MB] */
-        /* Initialize virtual address 128MB to physical address 8MB + (pid * 4MB) */
-        /* Entry attributes: 4MB, R/W, User, Present */
-        proc_pd[i].proc_pdirectory[PDE_128MB].raw_pde = (KERNEL_PAGE_END + (i * KERNEL_PAGE_START)) | DEFAULT_USER_4MB_PAGE_ENTRY;
-
-        /* Set kernel page directory entry 8 [32MB - 36MB] */
-        /* Entry attributes: 4KB, R/W, Super User, Present */
-        proc_pd[i].proc_pdirectory[PDE_32MB].raw_pde = (uint32_t)proc_pd[i].proc_ptable3 | DEFAULT_KERNEL_4KB_PAGE_ENTRY;
-        
-        /* Set kernel page directory entry 1 [4MB - 8MB] */
-        /* Entry attributes: 4MB, R/W, Super User, Present */
-        proc_pd[i].proc_pdirectory[PDE_4MB].raw_pde = KERNEL_PAGE_START | DEFAULT_KERNEL_4MB_PAGE_ENTRY;
-
-        /* Set kernel page directory entry 0 [0MB - 4MB] */
-        /* Entry attributes: 4KB, R/W, Super User, Present */
-        proc_pd[i].proc_pdirectory[PDE_0MB].raw_pde = (uint32_t)proc_pd[i].proc_ptable | DEFAULT_KERNEL_4KB_PAGE_ENTRY;
+/**
+ * @brief Point the kernel entries of a page directory at the shared kernel
+ *        page tables
+ * 
+ * @param pdirectory : page directory to fill in
+*/
+static void init_kernel_pdes(pde_t* pdirectory)
+{
+    /* Set kernel page directory entries 2 - 31 [8MB - 128MB] */
+    /* Entry attributes: 4KB, R/W, Super User, Present */
+    int j;
+    for (j = 0; j < NUM_KPAGE_PTABLES; j++) {
+        pdirectory[PDE_8MB + j].raw_pde = (uint32_t)kpage_ptable[j] | DEFAULT_KERNEL_4KB_PAGE_ENTRY;
     }
+
+    /* Set kernel page directory entry 1 [4MB - 8MB] */
+    /* Entry attributes: 4MB, R/W, Super User, Present */
+    pdirectory[PDE_4MB].raw_pde = KERNEL_PAGE_START | DEFAULT_KERNEL_4MB_PAGE_ENTRY;
+
+    /* Set kernel page directory entry 0 [0MB - 4MB] */
+    /* Entry attributes: 4KB, R/W, Super User, Present */
+    pdirectory[PDE_0MB].raw_pde = (uint32_t)kernel_ptable | DEFAULT_KERNEL_4KB_PAGE_ENTRY;
+}
+
+/**
+ * @brief Load the kernel page directory into CR3
+*/
+void load_kernel_page_directory(void)
+{
+    load_page_directory((uint32_t*)kernel_pdirectory);
+}
+
+/**
+ * @brief Allocate and initialize the paging structures of a new process
+ * 
+ * @return Paging structures of the process, NULL if out of memory
+*/
+proc_page_t* proc_page_create(void)
+{
+    proc_page_t* proc_page = (proc_page_t*)kmem_cache_alloc(proc_page_cache);
+    if (proc_page == NULL) {
+        return NULL;
+    }
+
+    proc_page->proc_pdirectory = (pde_t*)proc_table_alloc();
+    proc_page->proc_prog_ptable = (pte_t*)proc_table_alloc();
+    proc_page->proc_ptable2 = (pte_t*)proc_table_alloc();
+    proc_page->proc_ptable3 = (pte_t*)proc_table_alloc();
+    proc_page->proc_heap_ptable = (pte_t*)proc_table_alloc();
+    proc_page->proc_mmap_ptable = (pte_t*)proc_table_alloc();
+    if (proc_page->proc_pdirectory == NULL || proc_page->proc_prog_ptable == NULL || proc_page->proc_ptable2 == NULL ||
+        proc_page->proc_ptable3 == NULL || proc_page->proc_heap_ptable == NULL || proc_page->proc_mmap_ptable == NULL) {
+        proc_page_destroy(proc_page);
+        return NULL;
     }
+
+    /* Set program page directory entry 32 [128MB - 132MB] */
+    /* Pages come from the buddy system and are mapped as they fault */
+    /* Entry attributes: 4KB, R/W, User, Present */
+    proc_page->proc_pdirectory[PDE_128MB].raw_pde = (uint32_t)proc_page->proc_prog_ptable | DEFAULT_USER_4KB_PAGE_ENTRY;
+
+    /* Set user heap page directory entry 34 [136MB - 140MB] */
+    /* Entry attributes: 4KB, R/W, User, Present */
+    proc_page->proc_pdirectory[PDE_136MB].raw_pde = (uint32_t)proc_page->proc_heap_ptable | DEFAULT_USER_4KB_PAGE_ENTRY;
+
+    /* Set file mapping page directory entry 35 [140MB - 144MB] */
+    /* Entry attributes: 4KB, R/W, User, Present, pages themselves are read only */
+    proc_page->proc_pdirectory[PDE_140MB].raw_pde = (uint32_t)proc_page->proc_mmap_ptable | DEFAULT_USER_4KB_PAGE_ENTRY;
+
+    init_kernel_pdes(proc_page->proc_pdirectory);
+
+    return proc_page;
 }
 
 /**
- * @brief Getter function for pointers to page directories given a pid
+ * @brief Free the paging structures of a process, along with its private
+ *        program pages and the page tables allocated on first use
+ * 
+ * @param proc_page : Paging structures returned by proc_page_create()
+ * 
+ * @warning proc_page must not be the loaded page directory
+*/
+void proc_page_destroy(proc_page_t* proc_page)
+{
+    if (proc_page == NULL) {
+        return;
+    }
+
+    /* A process that failed to get all of its tables has nothing mapped yet */
+    if (proc_page->proc_pdirectory != NULL && proc_page->proc_prog_ptable != NULL) {
+        proc_prog_free_all(proc_page);
+
+        /* User heap page tables allocated on first use by map_page() */
+        int i;
+        for (i = 0; i < PAGING_ENTRY_NUM; i++) {
+            pde_t pde = proc_page->proc_pdirectory[i];
+            pte_t* ptable = (pte_t*)(pde.kpt_base_address << PAGE_TABLE_BIT_OFFSET);
+            if (pde.kpresent && pde.kuser_supervisor && !pde.kpage_size &&
+                ptable != proc_page->proc_prog_ptable && ptable != proc_page->proc_ptable2 && ptable != proc_page->proc_ptable3 &&
+                ptable != proc_page->proc_heap_ptable && ptable != proc_page->proc_mmap_ptable) {
+                proc_table_free(ptable);
+            }
+        }
+    }
+
+    proc_table_free(proc_page->proc_pdirectory);
+    proc_table_free(proc_page->proc_prog_ptable);
+    proc_table_free(proc_page->proc_ptable2);
+    proc_table_free(proc_page->proc_ptable3);
+    proc_table_free(proc_page->proc_heap_ptable);
+    proc_table_free(proc_page->proc_mmap_ptable);
+    kmem_cache_free(proc_page_cache, proc_page);
+}
+
+/**
+ * @brief Allocate one page directory or page table, every entry not present
  * 
- * @param pid Process ID, index to processes page directory
+ * @return The table, NULL if out of memory
 */
-const proc_page_t* get_proc_page(uint8_t pid)
+static void* proc_table_alloc(void)
 {
-    if (pid >= NUM_PROCESS) {
+    uint32_t* table = (uint32_t*)kpage_alloc(0);
+    if (table == NULL) {
         return NULL;
     }
+    map_kernel_page((uint8_t*)table, (uint8_t*)table, ALLOC_4KB | ALLOC_KERNEL | ALLOC_PAGE);
 
-    return &proc_pd[pid];
+    /* Entry attributes: R/W, superuser, and not present */
+    memset_dword(table, DEFAULT_BLANK_PAGE, PAGING_ENTRY_NUM);
+    return table;
+}
+
+/**
+ * @brief Give a table from proc_table_alloc() back to the buddy system
+*/
+static void proc_table_free(void* table)
+{
+    if (table != NULL) {
+        unmap_kernel_page((uint8_t*)table);
+        kpage_free(table);
+    }
+}
+
+/**
+ * @brief Paging structures of a live process
+*/
+static proc_page_t* proc_page_of(uint32_t pid)
+{
+    pcb_t* pcb = get_pcb_by_pid(pid);
+    return (pcb != NULL) ? pcb->page : NULL;
+}
+
+/**
+ * @brief Free the private program pages of a process and mark the whole
+ *        program window not present. Read only pages belong to the file
+ *        system and are only unmapped.
+*/
+static void proc_prog_free_all(proc_page_t* proc_page)
+{
+    int i;
+    for (i = 0; i < PAGING_ENTRY_NUM; i++) {
+        pte_t pte = proc_page->proc_prog_ptable[i];
+        if (pte.kpresent && pte.kread_write) {
+            kpage_free((void*)(pte.raw_pte & PAGE_4KB_BASE_ADDR_MASK));
+        }
+    }
+
+    /* Entry attributes: R/W, superuser, and not present */
+    memset_dword(proc_page->proc_prog_ptable, DEFAULT_BLANK_PAGE, PAGING_ENTRY_NUM);
+}
+
+/**
+ * @brief Getter function for pointers to page directories given a pid
+ * 
+ * @param pid Process ID of a live process
+*/
+const proc_page_t* get_proc_page(uint32_t pid)
+{
+    return proc_page_of(pid);
 }
 
 /**
  * @brief Setup user program video memory mapped at 132MB
  * 
- * @param pid Process ID, index to processes page directory
+ * @param pid Process ID of a live process
 */
-void proc_user_vidmap(uint8_t pid)
+void proc_user_vidmap(uint32_t pid)
 {
+    proc_page_t* proc_page = proc_page_of(pid);
+    if (proc_page == NULL) {
+        return;
+    }
+
     /* Set page directory entry corresponding to 132MB to point to page table */
-    proc_pd[pid].proc_pdirectory[PDE_132MB].raw_pde = (uint32_t)proc_pd[pid].proc_ptable2 | DEFAULT_USER_4KB_PAGE_ENTRY;
+    proc_page->proc_pdirectory[PDE_132MB].raw_pde = (uint32_t)proc_page->proc_ptable2 | DEFAULT_USER_4KB_PAGE_ENTRY;
 
     /* Set page table entry to physical address of video memory */
-    proc_pd[pid].proc_ptable2[VIDEO_MEM_START / PAGE_4KB_SIZE_B].raw_pte = VIDEO_MEM_START | DEFAULT_USER_4KB_PAGE_ENTRY;
+    proc_page->proc_ptable2[VIDEO_MEM_START / PAGE_4KB_SIZE_B].raw_pte = VIDEO_MEM_START | DEFAULT_USER_4KB_PAGE_ENTRY;
 }
 
 /**
@@ -140,10 +304,12 @@ void proc_user_vidmap(uint8_t pid)
  * @param pid : process id number
  * @param flags : page flags
 */
-void map_page(uint8_t* va, uint8_t* pa, uint8_t pid, map_page_flags_e flags)
+void map_page(uint8_t* va, uint8_t* pa, uint32_t pid, map_page_flags_e flags)
 {
+    proc_page_t* proc_page = proc_page_of(pid);
+
     /* Check virtual and physical addresses */
-    if (va == NULL || pa == NULL) {
+    if (va == NULL || pa == NULL || proc_page == NULL) {
         /* Could throw signal */
         return;
     }
@@ -155,7 +321,7 @@ void map_page(uint8_t* va, uint8_t* pa, uint8_t pid, map_page_flags_e flags)
     uint32_t pt_idx = ((uint32_t)va & PAGE_TABLE_MASK) >> PAGE_TABLE_BIT_OFFSET;
 
     /* Grab page directory entry */
-    pde_t* pde = &(proc_pd[pid].proc_pdirectory[pd_idx]);
+    pde_t* pde = &(proc_page->proc_pdirectory[pd_idx]);
 
     if (flags & ALLOC_4MB) {
         /* Set page directory entry */
@@ -169,26 +335,61 @@ void map_page(uint8_t* va, uint8_t* pa, uint8_t pid, map_page_flags_e flags)
             return;
     } 
     else if (flags & ALLOC_4KB) {
-        if (flags & ALLOC_SLAB) {
-            /* Set page directory entry */
-            pde->raw_pde = (uint32_t)proc_pd[pid].proc_ptable3;
-            uint32_t page_base_addr = (uint32_t)pa & PAGE_4KB_BASE_ADDR_MASK;
-            if (flags & ALLOC_KERNEL) {
-                pde->raw_pde |= DEFAULT_KERNEL_4KB_PAGE_ENTRY;
-                proc_pd[pid].proc_ptable3[pt_idx].raw_pte = page_base_addr | DEFAULT_KERNEL_4KB_PAGE_ENTRY;
+        /* Kernel mappings are shared by every process */
+        if (flags & ALLOC_KERNEL) {
+            map_kernel_page(va, pa, flags);
+            return;
+        }
+        else if (!(flags & ALLOC_USER)) {
+            /* Could throw signal */
+            return;
+        }
+
+        uint32_t page_base_addr = (uint32_t)pa & PAGE_4KB_BASE_ADDR_MASK;
+        if (flags & ALLOC_HEAP) {
+            /* Heap pages always live in the process heap page table */
+            if (pd_idx != PDE_136MB) {
+                /* Could throw signal */
+                return;
             }
-            else if (flags & ALLOC_USER) {
-                pde->raw_pde |= DEFAULT_USER_4KB_PAGE_ENTRY;
-                proc_pd[pid].proc_ptable3[pt_idx].raw_pte = page_base_addr | DEFAULT_USER_4KB_PAGE_ENTRY;
+            proc_page->proc_heap_ptable[pt_idx].raw_pte = page_base_addr | DEFAULT_USER_4KB_PAGE_ENTRY;
+        }
+        else if (flags & ALLOC_MMAP) {
+            /* File pages are shared with the file system image, so user space only reads them */
+            if (pd_idx != PDE_140MB) {
+                /* Could throw signal */
+                return;
             }
-            else {
+            proc_page->proc_mmap_ptable[pt_idx].raw_pte = page_base_addr | DEFAULT_USER_RO_4KB_PAGE_ENTRY;
+        }
+        else if (flags & ALLOC_PROG) {
+            /* Program pages always live in the process program page table */
+            if (pd_idx != PDE_128MB) {
                 /* Could throw signal */
                 return;
             }
+            if (flags & ALLOC_READ_ONLY)
+                proc_page->proc_prog_ptable[pt_idx].raw_pte = page_base_addr | DEFAULT_USER_RO_4KB_PAGE_ENTRY;
+            else
+                proc_page->proc_prog_ptable[pt_idx].raw_pte = page_base_addr | DEFAULT_USER_4KB_PAGE_ENTRY;
+        }
+        else if (flags & ALLOC_SLAB) {
+            /* Set page directory entry */
+            pde->raw_pde = (uint32_t)proc_page->proc_ptable3 | DEFAULT_USER_4KB_PAGE_ENTRY;
+            proc_page->proc_ptable3[pt_idx].raw_pte = page_base_addr | DEFAULT_USER_4KB_PAGE_ENTRY;
         }
         else if (flags & ALLOC_PAGE) {
-            /* Could throw signal */
-            return;
+            /* User heap page tables are allocated on first use from the buddy system */
+            if (pde->kpresent == 0) {
+                pte_t* ptable = (pte_t*)proc_table_alloc();
+                if (ptable == NULL) {
+                    /* Could throw signal */
+                    return;
+                }
+                pde->raw_pde = (uint32_t)ptable | DEFAULT_USER_4KB_PAGE_ENTRY;
+            }
+            pte_t* ptable = (pte_t*)(pde->kpt_base_address << PAGE_TABLE_BIT_OFFSET);
+            ptable[pt_idx].raw_pte = page_base_addr | DEFAULT_USER_4KB_PAGE_ENTRY;
         }
         else {
             /* Could throw signal */
@@ -201,6 +402,114 @@ void map_page(uint8_t* va, uint8_t* pa, uint8_t pid, map_page_flags_e flags)
     }
 }
 
+/**
+ * @brief Map a 4KB kernel page in the shared kernel page tables
+ * 
+ * @param va : virtual memory address
+ * @param pa : physical memory address
+ * @param flags : page flags, ALLOC_SLAB or ALLOC_PAGE selects the region
+*/
+void map_kernel_page(uint8_t* va, uint8_t* pa, map_page_flags_e flags)
+{
+    /* Check virtual and physical addresses */
+    if (va == NULL || pa == NULL) {
+        /* Could throw signal */
+        return;
+    }
+
+    uint32_t pd_idx = ((uint32_t)va & PAGE_DIRECTORY_MASK) >> PAGE_DIRECTORY_BIT_OFFSET;
+    uint32_t pt_idx = ((uint32_t)va & PAGE_TABLE_MASK) >> PAGE_TABLE_BIT_OFFSET;
+    uint32_t page_base_addr = (uint32_t)pa & PAGE_4KB_BASE_ADDR_MASK;
+
+    if (((flags & ALLOC_SLAB) && pd_idx == PDE_32MB) ||
+        ((flags & ALLOC_PAGE) && PDE_8MB <= pd_idx && pd_idx < PDE_128MB && pd_idx != PDE_32MB)) {
+        kpage_ptable[pd_idx - PDE_8MB][pt_idx].raw_pte = page_base_addr | DEFAULT_KERNEL_4KB_PAGE_ENTRY;
+    }
+    else {
+        /* Could throw signal */
+        return;
+    }
+
+    flush_tlb_page(va);
+}
+
+/**
+ * @brief Unmap a 4KB kernel page from the shared kernel page tables
+ * 
+ * @param va : virtual memory address
+*/
+void unmap_kernel_page(uint8_t* va)
+{
+    uint32_t pd_idx = ((uint32_t)va & PAGE_DIRECTORY_MASK) >> PAGE_DIRECTORY_BIT_OFFSET;
+    uint32_t pt_idx = ((uint32_t)va & PAGE_TABLE_MASK) >> PAGE_TABLE_BIT_OFFSET;
+
+    if (PDE_8MB <= pd_idx && pd_idx < PDE_128MB) {
+        kpage_ptable[pd_idx - PDE_8MB][pt_idx].kpresent = 0;
+    }
+    else {
+        /* Could throw signal */
+        return;
+    }
+
+    flush_tlb_page(va);
+}
+
+/**
+ * @brief Map the part of a boot module past the kernel page, so all of 
+ *        it can be read in place
+ * 
+ * @param start : Physical address of the module
+ * @param end : Physical address just past the module
+ * 
+ * @return End of the mapped module, cut short at the slab cache
+*/
+uint32_t map_module(uint32_t start, uint32_t end)
+{
+    /* Slab cache pages are handed out whatever lies there */
+    if (end > KMEM_CACHE_START) {
+        end = KMEM_CACHE_START;
+    }
+
+    /* The kernel page already maps everything below 8MB */
+    uint32_t addr = (start < KERNEL_PAGE_END) ? KERNEL_PAGE_END : (start & PAGE_4KB_BASE_ADDR_MASK);
+    for (; addr < end; addr += PAGE_4KB_SIZE_B) {
+        map_kernel_page((uint8_t*)addr, (uint8_t*)addr, ALLOC_4KB | ALLOC_KERNEL | ALLOC_PAGE);
+    }
+
+    return end;
+}
+
+/**
+ * @brief Look up the physical page a 4KB virtual page is mapped to
+ * 
+ * @param va : virtual memory address
+ * @param pid : process id number
+*/
+uint8_t* get_mapped_page(uint8_t* va, uint32_t pid)
+{
+    proc_page_t* proc_page = proc_page_of(pid);
+    if (proc_page == NULL) {
+        return NULL;
+    }
+
+    /* Calculate page directory offset */
+    uint32_t pd_idx = ((uint32_t)va & PAGE_DIRECTORY_MASK) >> PAGE_DIRECTORY_BIT_OFFSET;
+
+    /* Calculate page table offset */
+    uint32_t pt_idx = ((uint32_t)va & PAGE_TABLE_MASK) >> PAGE_TABLE_BIT_OFFSET;
+
+    /* Grab page directory entry */
+    pde_t* pde = &(proc_page->proc_pdirectory[pd_idx]);
+
+    /* Only 4KB pages are looked up */
+    if (pde->kpresent == 0 || pde->mpage_size) { return NULL; }
+
+    pte_t* pte = &(((pte_t*)(pde->kpt_base_address << PAGE_TABLE_BIT_OFFSET))[pt_idx]);
+    if (pte->kpresent == 0) { return NULL; }
+
+    return (uint8_t*)(pte->raw_pte & PAGE_4KB_BASE_ADDR_MASK);
+}
+
 /**
  * @brief Check if the virtual memory page is mapped, if so
  *        mark the page as not present.
@@ -208,10 +517,12 @@ void map_page(uint8_t* va, uint8_t* pa, uint8_t pid, map_page_flags_e flags)
  * @param va : virtual memory address
  * @param pid : process id number
 */
-void mark_page_not_present(uint8_t* va, uint8_t pid)
+void mark_page_not_present(uint8_t* va, uint32_t pid)
 {
+    proc_page_t* proc_page = proc_page_of(pid);
+
     /* Check virtual address */
-    if (va == NULL) {
+    if (va == NULL || proc_page == NULL) {
         return;
     }
 
@@ -222,41 +533,61 @@ void mark_page_not_present(uint8_t* va, uint8_t pid)
     uint32_t pt_idx = ((uint32_t)va & PAGE_TABLE_MASK) >> PAGE_TABLE_BIT_OFFSET;
 
     /* Grab page directory entry */
-    pde_t* pde = &(proc_pd[pid].proc_pdirectory[pd_idx]);
+    pde_t* pde = &(proc_page->proc_pdirectory[pd_idx]);
 
     /* Return if page directory entry is not present */
     if (pde->kpresent == 0) { return; }
 
-    /* Grab page table entry */
-    pte_t* pte = &(((pte_t*)(pde->kpt_base_address << PAGE_TABLE_BIT_OFFSET))[pt_idx]);
-
     /* Check 4MB page */
     if (pde->mpage_size) {
         /* Set 4MB page not present */
         pde->mpresent = 0;
     } else {
-        /* Set 4KB page not present */
+        /* Set 4KB page not present, the page table may still map other pages */
+        pte_t* pte = &(((pte_t*)(pde->kpt_base_address << PAGE_TABLE_BIT_OFFSET))[pt_idx]);
         pte->kpresent = 0;
-        pde->mpresent = 0;
+    }
+}
+
+/**
+ * @brief Mark every page of the program window not present
+ * 
+ * @param pid : process id number
+*/
+void proc_prog_unmap_all(uint32_t pid)
+{
+    proc_page_t* proc_page = proc_page_of(pid);
+    if (proc_page != NULL) {
+        proc_prog_free_all(proc_page);
     }
 }
 
 /**
  * @brief Allocate page for non-display memory for a given process
 */
-void activate_proc_vidmem(uint8_t pid)
+void activate_proc_vidmem(uint32_t pid)
 {
+    proc_page_t* proc_page = proc_page_of(pid);
+    if (proc_page == NULL) {
+        return;
+    }
+
     /* Move vidmap page table entry to 0xB8000 */
-    proc_pd[pid].proc_ptable2[VIDEO_MEM_START / PAGE_4KB_SIZE_B].raw_pte = VIDEO_MEM_START | DEFAULT_USER_4KB_PAGE_ENTRY;
+    proc_page->proc_ptable2[VIDEO_MEM_START / PAGE_4KB_SIZE_B].raw_pte = VIDEO_MEM_START | DEFAULT_USER_4KB_PAGE_ENTRY;
 }
 
 /**
  * @brief Deallocate page for non-display memory for a given process
 */
-void deactivate_proc_vidmem(uint8_t pid)
+void deactivate_proc_vidmem(uint32_t pid)
 {
+    pcb_t* pcb = get_pcb_by_pid(pid);
+    if (pcb == NULL) {
+        return;
+    }
+
     /* Move vidmap page table entry to terminal buffer */
-    uint8_t tcb_index = ((pcb_t*)(KERNEL_BOTTOM - KSTACK_SIZE * (pid + 1)))->tcb_idx;
-    uint16_t* buffer_base_address = get_tcb_screen_buffer(tcb_index);
-    proc_pd[pid].proc_ptable2[VIDEO_MEM_START / PAGE_4KB_SIZE_B].raw_pte = (uint32_t)buffer_base_address | DEFAULT_USER_4KB_PAGE_ENTRY;
+    uint16_t* buffer_base_address = get_tcb_screen_buffer(pcb->tcb_idx);
+    proc_page_t* proc_page = pcb->page;
+    proc_page->proc_ptable2[VIDEO_MEM_START / PAGE_4KB_SIZE_B].raw_pte = (uint32_t)buffer_base_address | DEFAULT_USER_4KB_PAGE_ENTRY;
 }
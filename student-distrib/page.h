@@ -11,13 +11,17 @@
 #include "alloc.h"
 
 #define PAGING_ENTRY_NUM            1024
-#define NUM_PROCESS                 6
 #define PDE_0MB                     0
 #define PDE_4MB                     1
+#define PDE_8MB                     2
 #define PDE_32MB                    8              
 #define PDE_128MB                   32
 #define PDE_132MB                   33
 #define PDE_136MB                   34
+#define PDE_140MB                   35
+
+/* Page tables covering kernel memory [8MB - 128MB], the slab cache included */
+#define NUM_KPAGE_PTABLES           (PDE_128MB - PDE_8MB)
 
 #define PAGE_4KB_SIZE_B             0x1000
 #define PAGE_4MB_SIZE_B             0x400000
@@ -28,12 +32,21 @@
 #define VIDEO_MEM_START_USER        0x084B8000
 #define VIDEO_MEM_END_USER          0x084B9000
 
+/* Program image and user stack, paged in on demand [128MB - 132MB] */
+#define USER_SPACE_PROG_START       0x08000000
+#define USER_SPACE_PROG_END         0x08400000
+
+/* Read-only file mappings from the mmap system call [140MB - 144MB] */
+#define USER_SPACE_MMAP_START       0x08C00000
+#define USER_SPACE_MMAP_END         0x09000000
+
 #define KERNEL_PAGE_START           0x00400000
 #define KERNEL_PAGE_END             0x00800000
 
 #define DEFAULT_BLANK_PAGE                  0x00000002
 #define DEFAULT_KERNEL_4KB_PAGE_ENTRY       0x00000003
 #define DEFAULT_USER_4KB_PAGE_ENTRY         0x00000007
+#define DEFAULT_USER_RO_4KB_PAGE_ENTRY      0x00000005
 #define DEFAULT_KERNEL_4MB_PAGE_ENTRY       0x00000183
 #define DEFAULT_USER_4MB_PAGE_ENTRY         0x00000187
 
@@ -85,6 +98,13 @@ extern void enable_paging(void);
 */
 extern uint32_t page_fault_linear_address(void);
 
+/**
+ * @brief Invalidates the TLB entry for the page containing va
+ * 
+ * @param va : virtual memory address
+*/
+extern void flush_tlb_page(uint8_t* va);
+
 /* ASM Data Structures */
 typedef union pde_t {
     uint32_t raw_pde;
@@ -136,18 +156,26 @@ typedef union pte_t {
 } pte_t;
 
 /* Paging data structure for each process */
+/* Kernel page tables are shared by every process, see page.c */
+/* Each table is its own 4KB page from the buddy system */
 typedef struct proc_page_t {
     /* Main page directory */
-    pde_t proc_pdirectory[PAGING_ENTRY_NUM] __attribute__((aligned (4096)));
+    pde_t* proc_pdirectory;
 
-    /* Kernel Video Memory */
-    pte_t proc_ptable[PAGING_ENTRY_NUM] __attribute__((aligned (4096)));
+    /* Program Image [128MB - 132MB] */
+    pte_t* proc_prog_ptable;
 
     /* Vidmap Video Memory */
-    pte_t proc_ptable2[PAGING_ENTRY_NUM] __attribute__((aligned (4096)));
+    pte_t* proc_ptable2;
+
+    /* User Kmem Cache Page */
+    pte_t* proc_ptable3;
+
+    /* User Heap [136MB - 140MB] */
+    pte_t* proc_heap_ptable;
 
-    /* Kmem Cache Page */
-    pte_t proc_ptable3[PAGING_ENTRY_NUM] __attribute__((aligned (4096)));
+    /* Read-only File Mappings [140MB - 144MB] */
+    pte_t* proc_mmap_ptable;
 } proc_page_t;
 
 /* Function Prototypes */
@@ -158,23 +186,47 @@ typedef struct proc_page_t {
 extern void init_paging(void);
 
 /**
- * @brief Initializes the page array for all the given processes in the system.
+ * @brief Initializes the shared kernel page tables and the kernel page directory.
 */
 void init_proc_paging(void);
 
+/**
+ * @brief Load the kernel page directory into CR3, for when no process
+ *        owns the CPU
+*/
+void load_kernel_page_directory(void);
+
+/**
+ * @brief Allocate and initialize the paging structures of a new process
+ * 
+ * @return Paging structures of the process, NULL if out of memory
+*/
+proc_page_t* proc_page_create(void);
+
+/**
+ * @brief Free the paging structures of a process, along with its private
+ *        program pages and the page tables allocated on first use
+ * 
+ * @param proc_page : Paging structures returned by proc_page_create()
+ * 
+ * @warning proc_page must not be the loaded page directory
+*/
+void proc_page_destroy(proc_page_t* proc_page);
+
 /**
  * @brief Getter function for pointers to page directories given a pid
  * 
- * @param pid Process ID, index to processes page directory
+ * @param pid Process ID of a live process
+ * @return NULL if no process has that pid
 */
-const proc_page_t* get_proc_page(uint8_t pid);
+const proc_page_t* get_proc_page(uint32_t pid);
 
 /**
  * @brief Setup user program video memory mapped at 132MB
  * 
- * @param pid Process ID, index to processes page directory
+ * @param pid Process ID of a live process
 */
-void proc_user_vidmap(uint8_t pid);
+void proc_user_vidmap(uint32_t pid);
 
 typedef enum map_page_flags_e {
     ALLOC_4KB = 0x1,
@@ -182,7 +234,11 @@ typedef enum map_page_flags_e {
     ALLOC_USER = 0x4,
     ALLOC_KERNEL = 0x8,
     ALLOC_SLAB = 0x10,
-    ALLOC_PAGE = 0x20
+    ALLOC_PAGE = 0x20,
+    ALLOC_HEAP = 0x40,
+    ALLOC_MMAP = 0x80,
+    ALLOC_PROG = 0x100,
+    ALLOC_READ_ONLY = 0x200
 } map_page_flags_e;
 
 /**
@@ -193,7 +249,44 @@ typedef enum map_page_flags_e {
  * @param pid : process id number
  * @param flags : page flags
 */
-void map_page(uint8_t* va, uint8_t* pa, uint8_t pid, map_page_flags_e flags);
+void map_page(uint8_t* va, uint8_t* pa, uint32_t pid, map_page_flags_e flags);
+
+/**
+ * @brief Map a 4KB kernel page in the shared kernel page tables,
+ *        visible to every process. 
+ * 
+ * @param va : virtual memory address
+ * @param pa : physical memory address
+ * @param flags : page flags, ALLOC_SLAB or ALLOC_PAGE selects the region
+*/
+void map_kernel_page(uint8_t* va, uint8_t* pa, map_page_flags_e flags);
+
+/**
+ * @brief Unmap a 4KB kernel page from the shared kernel page tables
+ * 
+ * @param va : virtual memory address
+*/
+void unmap_kernel_page(uint8_t* va);
+
+/**
+ * @brief Map the part of a boot module past the kernel page
+ * 
+ * @param start : Physical address of the module
+ * @param end : Physical address just past the module
+ * 
+ * @return End of the mapped module, cut short at the slab cache
+*/
+uint32_t map_module(uint32_t start, uint32_t end);
+
+/**
+ * @brief Look up the physical page a 4KB virtual page is mapped to
+ * 
+ * @param va : virtual memory address
+ * @param pid : process id number
+ * 
+ * @return Physical page address, NULL if the page is not present
+*/
+uint8_t* get_mapped_page(uint8_t* va, uint32_t pid);
 
 /**
  * @brief Check if the virtual memory page is mapped, if so
@@ -202,7 +295,16 @@ void map_page(uint8_t* va, uint8_t* pa, uint8_t pid, map_page_flags_e flags);
  * @param va : virtual memory address
  * @param pid : process id number
 */
-void mark_page_not_present(uint8_t* va, uint8_t pid);
+void mark_page_not_present(uint8_t* va, uint32_t pid);
+
+/**
+ * @brief Mark every page of the program window not present, so a new
+ *        image is paged in again as it is touched. Private pages are
+ *        given back to the buddy system.
+ * 
+ * @param pid : process id number
+*/
+void proc_prog_unmap_all(uint32_t pid);
 
 /**
  * @brief Allocate page for non-display memory for a given process
@@ -211,11 +313,11 @@ void mark_page_not_present(uint8_t* va, uint8_t pid);
  *          corresponding to non-active video memory. This is choosen to 
  *          
 */
-void activate_proc_vidmem(uint8_t pid);
+void activate_proc_vidmem(uint32_t pid);
 
 /**
  * @brief Deallocate page for non-display memory for a given process
 */
-void deactivate_proc_vidmem(uint8_t pid);
+void deactivate_proc_vidmem(uint32_t pid);
 
 #endif /* _PAGE_H */
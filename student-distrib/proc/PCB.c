@@ -4,12 +4,25 @@
 #include "../drivers/terminal.h"
 #include "../drivers/RTC.h"
 #include "../lib.h"
+#include "../page.h"
+#include "../switch.h"
+#include "../alloc.h"
 
 static const pcb_t empty_pcb = {0};
 
+/* Live processes by pid, chained through pcb_t.pid_next */
+static pcb_t* pid_hash[PID_HASH_SIZE];
+static uint32_t next_pid = 1;
+
+/* File descriptor tables, one per pcb_init()ed pcb */
+static kmem_cache_t* fd_table_cache;
+
+/* Mapped after every file mapping and over holes, so reads past the data see zeros */
+static uint8_t mmap_zero_page[PAGE_4KB_SIZE_B] __attribute__((aligned (4096)));
+
 int32_t pcb_open(const uint8_t* filename) {
     pcb_t* pcb = get_curr_pcb();
-    if (!pcb || !filename) {
+    if (!pcb || !pcb->file_array || !filename) {
         KDEBUG("ERROR: Failed to call pcb_open!\n");
         return -1;
     }
@@ -105,6 +118,248 @@ int32_t pcb_ioctl(int32_t fd, uint32_t command, uint32_t args)
     return get_curr_pcb()->file_array[fd].op_table->ioctl(fd, command, args);
 }
 
+int32_t pcb_getdents(int32_t fd, void* buf, int32_t nbytes) {
+    if (-1 == pcb_check_valid_fd(fd)) return -1;
+
+    /* Only directories have entries to list */
+    if (get_curr_pcb()->file_array[fd].op_table != &dir_op_table) return -1;
+
+    return dir_getdents(fd, buf, nbytes);
+}
+
+int32_t pcb_pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset) {
+    if (-1 == pcb_check_valid_fd(fd)) return -1;
+    pcb_t* pcb = get_curr_pcb();
+
+    /* Only regular files have positions to read from */
+    if (pcb->file_array[fd].op_table != &file_op_table || !buf || nbytes < 0) return -1;
+    uint32_t inode = pcb->file_array[fd].inode;
+    if (offset >= file_system.inode_base[inode].length) return 0;
+
+    return read_data(inode, offset, (uint8_t*)buf, nbytes);
+}
+
+int32_t pcb_pwrite(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset) {
+    if (-1 == pcb_check_valid_fd(fd)) return -1;
+    pcb_t* pcb = get_curr_pcb();
+
+    if (pcb->file_array[fd].op_table != &file_op_table || !buf || nbytes < 0) return -1;
+
+    return write_data(pcb->file_array[fd].inode, offset, (uint8_t*)buf, nbytes);
+}
+
+int32_t pcb_lseek(int32_t fd, int32_t offset, int32_t whence) {
+    if (-1 == pcb_check_valid_fd(fd)) return -1;
+    pcb_t* pcb = get_curr_pcb();
+
+    if (pcb->file_array[fd].op_table != &file_op_table) return -1;
+    int32_t base;
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = pcb->file_array[fd].file_pos; break;
+        case SEEK_END: base = file_system.inode_base[pcb->file_array[fd].inode].length; break;
+        default: return -1;
+    }
+    /* The position may pass the end of the file, a write there zero fills the gap */
+    if ((offset < 0 && base + offset < 0) || (offset > 0 && base + offset < base)) return -1;
+
+    pcb->file_array[fd].file_pos = base + offset;
+    return base + offset;
+}
+
+int32_t pcb_fstat(int32_t fd, stat_t* buf) {
+    if (-1 == pcb_check_valid_fd(fd) || !buf) return -1;
+    pcb_t* pcb = get_curr_pcb();
+    device_op_table_t* op_table = pcb->file_array[fd].op_table;
+
+    if (op_table == &file_op_table) {
+        buf->filetype = FILE_TYPE_REG;
+        buf->size = file_system.inode_base[pcb->file_array[fd].inode].length;
+    } else if (op_table == &dir_op_table) {
+        buf->filetype = FILE_TYPE_DIR;
+        buf->size = 0;
+    } else if (op_table == &RTC_op_table) {
+        buf->filetype = FILE_TYPE_RTC;
+        buf->size = 0;
+    } else {
+        /* stdin and stdout are not files */
+        return -1;
+    }
+    buf->inode_num = pcb->file_array[fd].inode;
+    return 0;
+}
+
+/* Copy one process's statistics into a procstat entry */
+static void pcb_fill_stat(proc_stat_t* stat, pcb_t* pcb) {
+    stat->pid = (pcb->state == PROC_STATE_IDLE) ? IDLE_PID : pcb->id;
+    stat->parent_pid = pcb->parent_pcb ? pcb->parent_pcb->id : stat->pid;
+    stat->tcb_idx = pcb->tcb_idx;
+    stat->state = pcb->state;
+    stat->priority = pcb->priority;
+    stat->user_ticks = pcb->user_ticks;
+    stat->kernel_ticks = pcb->kernel_ticks;
+    memcpy(stat->name, pcb->name, PROC_NAME_LEN + 1);
+}
+
+int32_t pcb_procstat(proc_stat_t* buf, int32_t count) {
+    if (!buf || count <= 0) return -1;
+    int32_t filled = 0;
+    int i;
+
+    for (i = 0; i < PID_HASH_SIZE && filled < count - 1; i++) {
+        pcb_t* pcb;
+        for (pcb = pid_hash[i]; pcb != NULL && filled < count - 1; pcb = pcb->pid_next) {
+            pcb_fill_stat(&buf[filled++], pcb);
+        }
+    }
+
+    /* The idle context always comes last, so a full table still shows it */
+    pcb_fill_stat(&buf[filled++], get_idle_pcb());
+    return filled;
+}
+
+int32_t pcb_mmap(int32_t fd, uint32_t length) {
+    if (-1 == pcb_check_valid_fd(fd)) return -1;
+    pcb_t* pcb = get_curr_pcb();
+
+    /* Only regular files have data blocks to map */
+    if (pcb->file_array[fd].op_table != &file_op_table || length == 0) return -1;
+    uint32_t inode = pcb->file_array[fd].inode;
+    uint32_t file_length = file_system.inode_base[inode].length;
+    if (length > file_length) {
+        length = file_length;
+    }
+    /* The file's pages, then a page of zeros */
+    uint32_t num_pages = (length + PAGE_4KB_SIZE_B - 1) / PAGE_4KB_SIZE_B + 1;
+
+    /* Find a free region entry */
+    int32_t i, slot = -1;
+    for (i = 0; i < MMAP_ARRAY_SIZE; i++) {
+        if (pcb->mmaps[i].num_pages == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) return -1;
+
+    /* First fit in the mmap window, stepping past every region in the way */
+    uint32_t start = USER_SPACE_MMAP_START;
+    uint32_t moved = 1;
+    while (moved) {
+        moved = 0;
+        for (i = 0; i < MMAP_ARRAY_SIZE; i++) {
+            mmap_region_t region = pcb->mmaps[i];
+            uint32_t region_end = region.start + region.num_pages * PAGE_4KB_SIZE_B;
+            if (region.num_pages != 0 && region.start < start + num_pages * PAGE_4KB_SIZE_B && start < region_end) {
+                start = region_end;
+                moved = 1;
+            }
+        }
+    }
+    if (num_pages > (USER_SPACE_MMAP_END - start) / PAGE_4KB_SIZE_B) return -1;
+
+    /* Point the page table straight at the data blocks */
+    uint32_t sysflags;
+    cli_and_save(sysflags);
+    uint32_t page;
+    for (page = 0; page < num_pages; page++) {
+        uint8_t* pa = (page + 1 < num_pages) ? file_data_page(inode, page) : NULL;
+        if (pa == NULL || ((uint32_t)pa & (PAGE_4KB_SIZE_B - 1))) {
+            pa = mmap_zero_page;
+        }
+        map_page((uint8_t*)(start + page * PAGE_4KB_SIZE_B), pa, pcb->id, ALLOC_4KB | ALLOC_USER | ALLOC_MMAP);
+    }
+    pcb->mmaps[slot].start = start;
+    pcb->mmaps[slot].num_pages = num_pages;
+    pcb->mmaps[slot].inode = inode;
+    restore_flags(sysflags);
+
+    return start;
+}
+
+int32_t pcb_munmap(uint32_t addr) {
+    pcb_t* pcb = get_curr_pcb();
+    if (!pcb) return -1;
+
+    int32_t i;
+    for (i = 0; i < MMAP_ARRAY_SIZE; i++) {
+        mmap_region_t region = pcb->mmaps[i];
+        if (region.num_pages == 0 || region.start != addr) continue;
+
+        uint32_t page;
+        for (page = 0; page < region.num_pages; page++) {
+            uint8_t* va = (uint8_t*)(region.start + page * PAGE_4KB_SIZE_B);
+            mark_page_not_present(va, pcb->id);
+            flush_tlb_page(va);
+        }
+        pcb->mmaps[i].start = 0;
+        pcb->mmaps[i].num_pages = 0;
+        return 0;
+    }
+    return -1;
+}
+
+void pcb_munmap_all(void) {
+    pcb_t* pcb = get_curr_pcb();
+    if (!pcb) return;
+
+    int32_t i;
+    for (i = 0; i < MMAP_ARRAY_SIZE; i++) {
+        if (pcb->mmaps[i].num_pages != 0) {
+            pcb_munmap(pcb->mmaps[i].start);
+        }
+    }
+}
+
+int32_t pcb_running_image(uint32_t inode) {
+    uint32_t sysflags;
+    cli_and_save(sysflags);
+
+    int32_t i;
+    for (i = 0; i < PID_HASH_SIZE; i++) {
+        pcb_t* pcb;
+        for (pcb = pid_hash[i]; pcb != NULL; pcb = pcb->pid_next) {
+            /* Zombies never run again, their image can go */
+            if (pcb->prog_num_segments == 0 || pcb->state == PROC_STATE_ZOMBIE) continue;
+            if ((uint32_t)pcb->prog_inode == inode) {
+                restore_flags(sysflags);
+                return 1;
+            }
+        }
+    }
+
+    restore_flags(sysflags);
+    return 0;
+}
+
+void pcb_mmap_truncate(uint32_t inode, uint32_t keep) {
+    uint32_t sysflags;
+    cli_and_save(sysflags);
+
+    int32_t i, j;
+    for (i = 0; i < PID_HASH_SIZE; i++) {
+        pcb_t* pcb;
+        for (pcb = pid_hash[i]; pcb != NULL; pcb = pcb->pid_next) {
+            for (j = 0; j < MMAP_ARRAY_SIZE; j++) {
+                mmap_region_t region = pcb->mmaps[j];
+                if (region.num_pages == 0 || region.inode != inode) continue;
+
+                /* The blocks may go to another file, so the pages read as past the end */
+                uint32_t page;
+                for (page = keep; page + 1 < region.num_pages; page++) {
+                    uint8_t* va = (uint8_t*)(region.start + page * PAGE_4KB_SIZE_B);
+                    map_page(va, mmap_zero_page, pcb->id, ALLOC_4KB | ALLOC_USER | ALLOC_MMAP);
+                    if (pcb == get_curr_pcb()) {
+                        flush_tlb_page(va);
+                    }
+                }
+            }
+        }
+    }
+
+    restore_flags(sysflags);
+}
+
 int32_t pcb_get_file_pos(int32_t fd) {
     if (-1 == pcb_check_valid_fd(fd)) return -1;
 
@@ -131,7 +386,7 @@ int32_t pcb_get_inode(int32_t fd) {
 
 int32_t pcb_check_valid_fd(int32_t fd) {
     pcb_t* pcb = get_curr_pcb();
-    if (!pcb) {
+    if (!pcb || !pcb->file_array) {
         KDEBUG("ERROR: Invalid PCB!\n");
         return -1;
     }
@@ -156,8 +411,19 @@ int32_t pcb_init(pcb_t* pcb) {
     /* Clear the pcb */
     *pcb = empty_pcb;
 
+    pcb->file_array = (fd_t*)kmem_cache_alloc(fd_table_cache);
+    if (!pcb->file_array) {
+        KDEBUG("ERROR: Could not allocate fd table!\n");
+        return -1;
+    }
+    memset(pcb->file_array, 0, FILE_ARRAY_SIZE * sizeof(fd_t));
+
     if (-1 == pcb_std(pcb)) return -1;
 
+    /* New processes start at the top priority */
+    pcb->priority = SCHED_PRIO_INTERACTIVE;
+    pcb->timeslice = SCHED_QUANTUM(SCHED_PRIO_INTERACTIVE);
+
     /* Activate the pcb */
     pcb->active = 1;
 
@@ -165,11 +431,57 @@ int32_t pcb_init(pcb_t* pcb) {
     return 0;
 }
 
+int32_t pcb_create(pcb_t* pcb) {
+    if (-1 == pcb_init(pcb)) return -1;
+
+    pcb->page = proc_page_create();
+    if (!pcb->page) {
+        KDEBUG("ERROR: Could not allocate page directory!\n");
+        kmem_cache_free(fd_table_cache, pcb->file_array);
+        *pcb = empty_pcb;
+        return -1;
+    }
+
+    /* Pids are not reused until the counter wraps, skip any still alive.
+     * 0 is never a pid, waitpid returns it for a child still running. */
+    while (next_pid == 0 || next_pid == IDLE_PID || get_pcb_by_pid(next_pid)) {
+        next_pid++;
+    }
+    pcb->id = next_pid++;
+
+    pcb->pid_next = pid_hash[PID_HASH(pcb->id)];
+    pid_hash[PID_HASH(pcb->id)] = pcb;
+
+    /* Success. */
+    return 0;
+}
+
 int32_t pcb_destroy(pcb_t* pcb) {
     if (!pcb) {
         KDEBUG("ERROR: Failed to destroy pcb!\n");
         return -1;
     }
+    /* Only created pcbs own a page directory and a pid */
+    if (pcb->page) {
+        /* Heap pages are found through the page directory, free them first */
+        uheap_release(pcb);
+
+        pcb_t* prev = NULL;
+        pcb_t* curr = pid_hash[PID_HASH(pcb->id)];
+        while (curr && curr != pcb) {
+            prev = curr;
+            curr = curr->pid_next;
+        }
+        if (curr && prev) {
+            prev->pid_next = pcb->pid_next;
+        } else if (curr) {
+            pid_hash[PID_HASH(pcb->id)] = pcb->pid_next;
+        }
+        proc_page_destroy(pcb->page);
+    }
+    if (pcb->file_array) {
+        kmem_cache_free(fd_table_cache, pcb->file_array);
+    }
     /* Clear the pcb */
     *pcb = empty_pcb;
 
@@ -200,30 +512,69 @@ int32_t pcb_std(pcb_t* pcb) {
 }
 
 pcb_t* alloc_pcb(void) {
+    /* Buddy blocks are aligned to their size, so get_curr_pcb() finds the pcb
+     * at the bottom of the stack */
+    pcb_t* pcb = (pcb_t*)kpage_alloc(KSTACK_ORDER);
+    if (!pcb) {
+        KDEBUG("ERROR: Could not allocate PCB!\n");
+        return NULL;
+    }
     int i;
-    for (i = 0; i < MAX_TASKS; i++) {
-        /* +1 here because pcb0 points to 8MB - 8kB */
-        pcb_t* pcb = (pcb_t*) (KERNEL_BOTTOM - KSTACK_SIZE * (i+1));
-        if (pcb->active) continue;
-
-        /* Free space found, initialize */
-        if (-1 == pcb_init(pcb)) {
-            return NULL;
-        }
-        pcb->id = i;
-        return pcb;
+    for (i = 0; i < KSTACK_SIZE; i += PAGE_4KB_SIZE_B) {
+        map_kernel_page((uint8_t*)pcb + i, (uint8_t*)pcb + i, ALLOC_4KB | ALLOC_KERNEL | ALLOC_PAGE);
+    }
+
+    if (-1 == pcb_create(pcb)) {
+        kpage_free(pcb);
+        return NULL;
     }
+    return pcb;
+}
+
+void free_pcb(pcb_t* pcb) {
+    /* The boot stack below KERNEL_BOTTOM is never given back */
+    if ((uint32_t)pcb >= KMEM_PAGE_START && (uint32_t)pcb < KMEM_PAGE_END) {
+        kpage_free(pcb);
+    }
+}
 
-    /* Max number of processes reached... */
-    KDEBUG("ERROR: Could not allocate PCB!\n");
+pcb_t* get_pcb_by_pid(uint32_t pid) {
+    pcb_t* pcb;
+    for (pcb = pid_hash[PID_HASH(pid)]; pcb != NULL; pcb = pcb->pid_next) {
+        if (pcb->id == pid) return pcb;
+    }
     return NULL;
 }
 
+pcb_t* pcb_find_child(pcb_t* parent, int32_t pid) {
+    pcb_t* found = NULL;
+    int i;
+
+    if (pid != WAIT_ANY) {
+        pcb_t* pcb = get_pcb_by_pid(pid);
+        return (pcb && pcb->spawned && pcb->parent_pcb == parent) ? pcb : NULL;
+    }
+
+    for (i = 0; i < PID_HASH_SIZE; i++) {
+        pcb_t* pcb;
+        for (pcb = pid_hash[i]; pcb != NULL; pcb = pcb->pid_next) {
+            if (!pcb->spawned || pcb->parent_pcb != parent) continue;
+            if (pcb->state == PROC_STATE_ZOMBIE) return pcb;
+            found = pcb;
+        }
+    }
+    return found;
+}
+
 void initialize_all_pcbs(void) {
     int i;
-    /* Ensure all pcbs in memory are empty */
-    for (i = 0; i < MAX_TASKS; i++) {
-        pcb_t* pcb = (pcb_t*) (KERNEL_BOTTOM - KSTACK_SIZE * (i+1));
-        *pcb = empty_pcb;
+    /* No process is alive yet */
+    for (i = 0; i < PID_HASH_SIZE; i++) {
+        pid_hash[i] = NULL;
     }
+    /* The boot stack becomes the first shell, see system_execute */
+    *get_curr_pcb() = empty_pcb;
+
+    /* Only the descriptor is claimed now, slabs are taken once processes start */
+    fd_table_cache = kmem_cache_create("fd_table", FILE_ARRAY_SIZE * sizeof(fd_t), 0, NULL, NULL);
 }
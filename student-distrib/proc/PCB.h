@@ -8,10 +8,16 @@
 #include "../types.h"
 #include "../x86_desc.h"
 
-#define MAX_TASKS 6
 #define KSTACK_SIZE 8192
 #define KERNEL_BOTTOM 0x800000
 
+/* Kernel stacks are 2**KSTACK_ORDER pages from the buddy system */
+#define KSTACK_ORDER 1
+
+/* Live processes are found by pid through a chained hash */
+#define PID_HASH_SIZE 64
+#define PID_HASH(pid) ((pid) & (PID_HASH_SIZE - 1))
+
 /* We can have up to 8 open files */
 #define FILE_ARRAY_SIZE 8
 
@@ -20,6 +26,31 @@
 
 #define FLAG_IN_USE 0x1
 
+/* Scheduler states. A runnable process is running or on a run queue, a
+ * blocked one sleeps on a wait queue or waits in execute for its child.
+ * Only the idle context is idle, it runs while every process is blocked.
+ * A spawned process that halted is a zombie until its parent waits for it. */
+#define PROC_STATE_RUNNABLE 0
+#define PROC_STATE_BLOCKED 1
+#define PROC_STATE_IDLE 2
+#define PROC_STATE_ZOMBIE 3
+
+/* waitpid: any spawned child, and return at once if none has halted */
+#define WAIT_ANY -1
+#define WNOHANG 0x1
+
+/* Program name kept for process statistics, as long as a file name */
+#define PROC_NAME_LEN 32
+
+/* pid reported for the idle context */
+#define IDLE_PID 0xFFFFFFFF
+
+/* Up to 8 regions mapped by mmap at a time */
+#define MMAP_ARRAY_SIZE 8
+
+/* Up to 4 loadable segments in a program image */
+#define PROG_SEGMENT_ARRAY_SIZE 4
+
 typedef struct file_descriptor_t {
     device_op_table_t* op_table;
     int32_t inode;
@@ -27,18 +58,71 @@ typedef struct file_descriptor_t {
     int32_t flags;
 } fd_t;
 
+/* File information filled in by fstat */
+typedef struct stat_t {
+    uint32_t inode_num;
+    uint32_t filetype;
+    uint32_t size; /* length in bytes of a regular file, 0 otherwise */
+} stat_t;
+
+/* One process in the table filled in by procstat */
+typedef struct proc_stat_t {
+    uint32_t pid;
+    uint32_t parent_pid;    /* pid itself without a parent, like a terminal's first shell */
+    uint32_t tcb_idx;
+    uint32_t state;
+    uint32_t priority;
+    uint32_t user_ticks;    /* PIT ticks spent in user mode */
+    uint32_t kernel_ticks;  /* PIT ticks spent in the kernel */
+    uint8_t name[PROC_NAME_LEN + 1];
+} proc_stat_t;
+
+/* Pages [start, start + num_pages * 4kB) mapped by mmap from inode, num_pages is 0 if unused */
+typedef struct mmap_region_t {
+    uint32_t start;
+    uint32_t num_pages;
+    uint32_t inode;
+} mmap_region_t;
+
+/* Bytes [vaddr, vaddr + file_size) come from the file at offset, the rest up to mem_size is zero */
+typedef struct prog_segment_t {
+    uint32_t vaddr;
+    uint32_t offset;
+    uint32_t file_size;
+    uint32_t mem_size;
+    uint32_t flags;     /* ELF p_flags */
+} prog_segment_t;
+
 typedef struct __attribute__((packed)) pcb_t {
     uint8_t active;
     uint32_t id;
-    fd_t file_array[FILE_ARRAY_SIZE]; /* */
+    fd_t* file_array;           /* FILE_ARRAY_SIZE entries from the fd table cache */
     struct pcb_t* parent_pcb;
+    uint8_t spawned;            /* Runs beside its parent, reaped by waitpid */
+    int32_t exit_status;        /* Halt status of a zombie */
+    struct pcb_t* pid_next;     /* Next process in the same pid hash bucket */
+    struct proc_page_t* page;   /* Page directory and user page tables */
+    struct uheap_t* uheap;      /* Object heap, allocated on first use */
     uint32_t old_ebp;
     uint32_t switch_ebp;
+    volatile uint8_t state;
+    uint8_t priority;           /* Run queue level, see switch.h */
+    uint32_t timeslice;         /* PIT ticks left before the process is preempted */
+    struct pcb_t* run_next;     /* Next process on the same run queue */
+    struct pcb_t* wait_next;    /* Next process on the same wait queue */
+    uint32_t user_ticks;        /* CPU time, counted by pit_handler */
+    uint32_t kernel_ticks;
+    uint8_t name[PROC_NAME_LEN + 1];
     uint8_t args[MAX_ARGS];
     int32_t tcb_idx;
     uint32_t rtc_freq;
     uint32_t rtc_val;
     uint32_t rtc_int_occ;
+    uint32_t heap_pages;    /* Pages mapped at USER_SPACE_HEAP_START by sbrk */
+    mmap_region_t mmaps[MMAP_ARRAY_SIZE]; /* File mappings at USER_SPACE_MMAP_START */
+    int32_t prog_inode;     /* Executable paged in on demand */
+    uint32_t prog_num_segments;
+    prog_segment_t prog_segments[PROG_SEGMENT_ARRAY_SIZE]; /* PT_LOAD segments, the rest of the window is zero filled */
 } pcb_t;
 
 extern pcb_t* get_curr_pcb(void);
@@ -96,6 +180,113 @@ int32_t pcb_write(int32_t fd, const void* buf, int32_t nbytes);
 */
 int32_t pcb_ioctl(int32_t fd, uint32_t command, uint32_t args);
 
+/**
+ * @brief Entry point for a procstat syscall. Lists every live process
+ *        followed by the idle context.
+ * 
+ * @param buf table to fill in
+ * @param count number of entries that fit in buf
+ * @return -1 on fail, number of entries filled in on success
+*/
+int32_t pcb_procstat(proc_stat_t* buf, int32_t count);
+
+/**
+ * @brief Entry point for a mmap syscall. Maps the data blocks of an open
+ *        file read only into the mmap window, without copying them.
+ * 
+ * @details The mapping is followed by at least one page of zeros, and the
+ *          bytes past the end of the file in its last block are zero, so
+ *          text can be scanned up to a NUL.
+ * 
+ * @param fd file descriptor index of a regular file
+ * @param length bytes to map, clamped to the length of the file
+ * @return -1 on fail, user address of the first byte on success
+*/
+int32_t pcb_mmap(int32_t fd, uint32_t length);
+
+/**
+ * @brief Entry point for a munmap syscall
+ * 
+ * @param addr address returned by pcb_mmap
+ * @return -1 on fail, 0 on success
+*/
+int32_t pcb_munmap(uint32_t addr);
+
+/**
+ * @brief Unmap every region mapped by mmap, for halt
+*/
+void pcb_munmap_all(void);
+
+/**
+ * @brief Check whether a live process runs the image in an inode. Its text
+ *        pages map the file's data blocks and the rest is read in as it
+ *        faults, so the file must not change underneath it.
+ * 
+ * @param inode inode about to be written or truncated
+ * @return 1 if some process that has not halted runs it, 0 otherwise
+*/
+int32_t pcb_running_image(uint32_t inode);
+
+/**
+ * @brief Point every process's mappings of an inode past its first keep
+ *        blocks at zeros, before a truncate gives those blocks back
+ * 
+ * @param inode inode being truncated
+ * @param keep number of data blocks the inode keeps
+*/
+void pcb_mmap_truncate(uint32_t inode, uint32_t keep);
+
+/**
+ * @brief Entry point for a getdents syscall
+ * 
+ * @param fd file descriptor index of a directory
+ * @param buf buffer to place dirent_t entries in
+ * @param nbytes size of the buffer
+ * @return -1 on fail, 0 past the last entry, number of bytes placed in buffer otherwise
+*/
+int32_t pcb_getdents(int32_t fd, void* buf, int32_t nbytes);
+
+/**
+ * @brief Entry point for a pread syscall, reads without moving the file position
+ * 
+ * @param fd file descriptor index of a regular file
+ * @param buf buffer to write data to
+ * @param nbytes number of bytes to read
+ * @param offset byte of the file to start at
+ * @return -1 on fail, number of bytes placed in buffer on success
+*/
+int32_t pcb_pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+
+/**
+ * @brief Entry point for a pwrite syscall, writes without moving the file position
+ * 
+ * @param fd file descriptor index of a regular file
+ * @param buf buffer to write data from
+ * @param nbytes number of bytes to write
+ * @param offset byte of the file to start at
+ * @return -1 on fail, number of bytes written on success
+*/
+int32_t pcb_pwrite(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
+
+/**
+ * @brief Entry point for a lseek syscall
+ * 
+ * @param fd file descriptor index of a regular file
+ * @param offset bytes to move by
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END
+ * @return -1 on fail, new file position on success
+*/
+int32_t pcb_lseek(int32_t fd, int32_t offset, int32_t whence);
+
+/**
+ * @brief Entry point for a fstat syscall
+ * 
+ * @param fd file descriptor index of a file, directory or the rtc
+ * @param buf filled with the type, inode and length of the file
+ * @return -1 on fail, 0 on success
+*/
+int32_t pcb_fstat(int32_t fd, stat_t* buf);
+
 /**
  * @brief Grabs the file position from a given fd index.
  * @warning Assumes you have selected the correct pcb beforehand
@@ -146,7 +337,7 @@ void pcb_set_inode(int32_t fd, int32_t inode_num);
 int32_t pcb_check_valid_fd(int32_t fd);
 
 /**
- * @brief Empties the pcb and activates it
+ * @brief Empties the pcb, gives it an fd table and activates it
  * 
  * @param pcb pcb to initialize
  * @return -1 on fail, 0 on success
@@ -154,7 +345,17 @@ int32_t pcb_check_valid_fd(int32_t fd);
 int32_t pcb_init(pcb_t* pcb);
 
 /**
- * @brief Empties the pcb
+ * @brief Initializes the pcb as a new process: gives it a pid, its own
+ *        page directory, and enters it in the pid hash
+ * 
+ * @param pcb pcb to create
+ * @return -1 on fail, 0 on success
+ */
+int32_t pcb_create(pcb_t* pcb);
+
+/**
+ * @brief Empties the pcb, removes it from the pid hash and frees its
+ *        fd table, page directory and program pages
  * 
  * @param pcb pcb to destroy
  * @return -1 on fail, 0 on success
@@ -171,12 +372,29 @@ int32_t pcb_destroy(pcb_t* pcb);
 int32_t pcb_std(pcb_t* pcb);
 
 /**
- * @brief Allocates space for a new pcb and initializes it
+ * @brief Allocates a kernel stack for a new pcb and creates it
  * 
  * @return pointer to the alloced pcb, NULL if failed
  */
 pcb_t* alloc_pcb(void);
 
+/**
+ * @brief Gives the kernel stack of a destroyed pcb back to the buddy system
+ * 
+ * @param pcb pcb returned by alloc_pcb
+ * @warning The stack stays mapped, so a halting process may free its own
+ *          stack with interrupts disabled right before leaving it
+ */
+void free_pcb(pcb_t* pcb);
+
+/**
+ * @brief Looks up a live process by pid
+ * 
+ * @param pid process id
+ * @return pointer to the pcb, NULL if no process has that pid
+ */
+pcb_t* get_pcb_by_pid(uint32_t pid);
+
 /**
  * @brief Finds the current pcb of the process
  * 
@@ -185,7 +403,18 @@ pcb_t* alloc_pcb(void);
 extern pcb_t* get_curr_pcb(void);
 
 /**
- * @brief Empties all memory where pcbs are supposed to be.
+ * @brief Looks for a spawned child of a process
+ * 
+ * @param parent process whose children are searched
+ * @param pid pid of the child, WAIT_ANY for any child
+ * @return a zombie child if one matches, otherwise any matching child,
+ *         NULL if none matches
+ */
+pcb_t* pcb_find_child(pcb_t* parent, int32_t pid);
+
+/**
+ * @brief Empties the boot context pcb and the pid hash, and creates the 
+ *        fd table cache.
  * 
  */
 void initialize_all_pcbs(void);
@@ -6,24 +6,150 @@
 #include "drivers/RTC.h"
 #include "page.h"
 
-void context_switch(void) {
-    /* next tcb will rotate between 0, 1, and 2 */
+/* FIFO of runnable processes, linked through pcb_t.run_next */
+typedef struct run_queue_t {
+    pcb_t* head;
+    pcb_t* tail;
+} run_queue_t;
 
+/* One run queue per priority level, the running process is on none of them */
+static run_queue_t run_queues[SCHED_NUM_PRIO];
 
+/* Runs when every process is blocked. Its PCB sits at the bottom of its own
+ * kernel stack, like a process's, so get_curr_pcb() works while idling. */
+static union {
+    pcb_t pcb;
+    uint8_t kstack[KSTACK_SIZE];
+} idle_task __attribute__((aligned (KSTACK_SIZE)));
 
-    uint8_t next_tcb_idx = (tcb_get_curr_idx() + 1) % MAX_NUM_TERMINAL;
+/* Halt until an interrupt, then hand the CPU to anything it woke */
+static void idle_loop(void) {
+    while (1) {
+        cli();
+        context_switch();
+        asm volatile ("sti; hlt" : : : "memory");
+    }
+}
 
-    /* Inform the tcb that we are at a new index */
-    tcb_set_curr_idx(next_tcb_idx);
+void setup_idle(void) {
+    uint32_t* esp = (uint32_t*)(idle_task.kstack + KSTACK_SIZE);
+
+    idle_task.pcb.state = PROC_STATE_IDLE;
+    strcpy((int8_t*)idle_task.pcb.name, (int8_t*)"idle");
+
+    /* The first context switch to idle leaves and returns into idle_loop */
+    *--esp = (uint32_t)idle_loop;
+    *--esp = (uint32_t)(idle_task.kstack + KSTACK_SIZE);
+    idle_task.pcb.switch_ebp = (uint32_t)esp;
+}
+
+pcb_t* get_idle_pcb(void) {
+    return &idle_task.pcb;
+}
+
+void sched_enqueue(pcb_t* pcb) {
+    run_queue_t* queue = &run_queues[pcb->priority];
+
+    pcb->state = PROC_STATE_RUNNABLE;
+    pcb->run_next = NULL;
+    if (queue->tail != NULL) {
+        queue->tail->run_next = pcb;
+    } else {
+        queue->head = pcb;
+    }
+    queue->tail = pcb;
+}
+
+pcb_t* sched_dequeue(void) {
+    int prio;
+    for (prio = 0; prio < SCHED_NUM_PRIO; prio++) {
+        pcb_t* pcb = run_queues[prio].head;
+        if (pcb == NULL) continue;
+
+        run_queues[prio].head = pcb->run_next;
+        if (run_queues[prio].head == NULL) {
+            run_queues[prio].tail = NULL;
+        }
+        pcb->run_next = NULL;
+        return pcb;
+    }
+
+    return NULL;
+}
+
+void sched_wake(pcb_t* pcb) {
+    /* Sleeping means waiting on a device, reward it with the top priority */
+    pcb->priority = SCHED_PRIO_INTERACTIVE;
+    pcb->timeslice = SCHED_QUANTUM(SCHED_PRIO_INTERACTIVE);
+
+    sched_enqueue(pcb);
+}
+
+void sched_tick(uint32_t user_mode) {
+    pcb_t* curr_pcb = get_curr_pcb();
+    int prio;
+
+    /* Charge the tick to whoever it interrupted, idle time counts as kernel time */
+    if (user_mode) {
+        curr_pcb->user_ticks++;
+    } else {
+        curr_pcb->kernel_ticks++;
+    }
+
+    /* Idle, switch if anyone has woken up since */
+    if (curr_pcb->state != PROC_STATE_RUNNABLE) {
+        context_switch();
+        return;
+    }
+
+    /* Used up the whole timeslice, looks like a CPU hog: lower priority, longer timeslice */
+    if (curr_pcb->timeslice <= 1) {
+        if (curr_pcb->priority < SCHED_PRIO_BATCH) {
+            curr_pcb->priority++;
+        }
+        curr_pcb->timeslice = SCHED_QUANTUM(curr_pcb->priority);
+        context_switch();
+        return;
+    }
+    curr_pcb->timeslice--;
+
+    /* Preempt for a more urgent process, the rest of the timeslice is kept */
+    for (prio = 0; prio < curr_pcb->priority; prio++) {
+        if (run_queues[prio].head != NULL) {
+            context_switch();
+            return;
+        }
+    }
+}
 
+void context_switch(void) {
     pcb_t* curr_pcb = get_curr_pcb();
+    pcb_t* next_pcb;
+
+    /* Take turns with the processes at the same priority */
+    if (curr_pcb->state == PROC_STATE_RUNNABLE) {
+        sched_enqueue(curr_pcb);
+    }
 
-    /* Get the next pcb associated with the next terminal */
-    pcb_t* next_pcb = tcb_get_pcb(next_tcb_idx);
+    next_pcb = sched_dequeue();
+    if (next_pcb == NULL) {
+        /* Already idle, nothing has woken up */
+        if (curr_pcb == &idle_task.pcb) return;
 
-    load_page_directory((uint32_t*)get_proc_page(next_pcb->id)->proc_pdirectory);
+        /* Every process is blocked. Idle in the address space of the one
+         * that just went to sleep, it stays alive until it is woken. */
+        next_pcb = &idle_task.pcb;
+        next_pcb->id = curr_pcb->id;
+        next_pcb->tcb_idx = curr_pcb->tcb_idx;
+    }
+    if (next_pcb == curr_pcb) return;
+
+    /* Inform the tcb that we are at a new index */
+    tcb_set_curr_idx(next_pcb->tcb_idx);
 
-  
+    if (next_pcb != &idle_task.pcb) {
+        load_page_directory((uint32_t*)next_pcb->page->proc_pdirectory);
+    }
 
     /* Set tss appropriately */
     tss.esp0 = (uint32_t)next_pcb + KSTACK_SIZE;
@@ -44,12 +170,36 @@ void context_switch(void) {
     );
 }
 
+void sched_exit(void) {
+    pcb_t* next_pcb = sched_dequeue();
 
-int32_t setup_shell(void) {
-    /* Since we call this from kernel, just pretend the first shell is active. */
-    /* This will allow terminal 0 to associate with shell 0, etc. */
-    get_curr_pcb()->active = 1;
+    /* The kernel page directory stays loaded while idling */
+    if (next_pcb == NULL) {
+        next_pcb = &idle_task.pcb;
+        next_pcb->id = IDLE_PID;
+        next_pcb->tcb_idx = tcb_get_curr_idx();
+    }
+
+    tcb_set_curr_idx(next_pcb->tcb_idx);
+
+    if (next_pcb != &idle_task.pcb) {
+        load_page_directory((uint32_t*)next_pcb->page->proc_pdirectory);
+    }
 
+    tss.esp0 = (uint32_t)next_pcb + KSTACK_SIZE;
+    tss.ss0 = KERNEL_DS;
+
+    /* Return from the context_switch() the next process made, nothing is saved here */
+    asm volatile (
+        "movl %[next_ebp], %%ebp    \n\t"
+        "leave                      \n\t"
+        "ret                        \n\t"
+        :
+        : [next_ebp] "r" (next_pcb->switch_ebp)
+    );
+}
+
+int32_t setup_shell(uint8_t tcb_idx) {
     /* Mimick execute: */
     /* Read the header. */
     uint8_t command_buf[FILENAME_LEN + 1] = "shell\0";
@@ -61,13 +211,27 @@ int32_t setup_shell(void) {
 
     /* Set the parent to 0, i.e. kernel. */
     pcb->parent_pcb = 0;
+
+    /* The shell is the first process of its terminal */
+    pcb->tcb_idx = tcb_idx;
+    tcb_set_pcb(tcb_idx, pcb);
     
-    /* Load pages and program. */
-    load_page_directory((uint32_t*)get_proc_page(pcb->id)->proc_pdirectory);
-    if (load_program(command_buf, (uint8_t*)PROGRAM_START_MEM) != 0) {
+    /* Load program and pages. */
+    if (load_program(command_buf, pcb) != 0) {
         return -1;
     }
+    load_page_directory((uint32_t*)pcb->page->proc_pdirectory);
+
+    strcpy((int8_t*)pcb->name, (int8_t*)command_buf);
+
+    /* Runs from fake_iret the first time it is scheduled */
+    sched_start(pcb);
 
+    /* Success. */
+    return 0;
+}
+
+void sched_start(pcb_t* pcb) {
     uint32_t eflags;
     asm volatile (
         "pushl %%eax             \n\t"
@@ -104,9 +268,5 @@ int32_t setup_shell(void) {
         : "eax"
     );
 
-    /* Stop pretending like the first shell is active. */    
-    get_curr_pcb()->active = 0;
-
-    /* Success. */
-    return 0;
+    sched_enqueue(pcb);
 }
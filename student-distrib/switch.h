@@ -3,17 +3,93 @@
 
 #include "types.h"
 
+struct pcb_t;
+
+/* Priority levels, 0 is the most urgent. Woken processes start at the top,
+ * processes that use up a whole timeslice drop a level. */
+#define SCHED_NUM_PRIO 3
+#define SCHED_PRIO_INTERACTIVE 0
+#define SCHED_PRIO_BATCH (SCHED_NUM_PRIO - 1)
+
+/* Timeslice in PIT ticks (10ms), doubling at every lower priority level */
+#define SCHED_BASE_QUANTUM 2
+#define SCHED_QUANTUM(prio) (SCHED_BASE_QUANTUM << (prio))
+
 /**
- * @brief Perform a context switch to next process according to
- *        the round robin scheduler.
+ * @brief Perform a context switch to the most urgent runnable process.
+ * 
+ * @details A runnable current process goes to the back of its run queue,
+ *          so processes at the same priority take turns. A blocked current
+ *          process switches to the idle context when nothing else can run.
+ *          Called with interrupts disabled.
 */
 void context_switch(void);
 
+/**
+ * @brief Switch to the most urgent runnable process for good, for a
+ *        process that has freed itself. Nothing is saved or queued for
+ *        the current process.
+ * 
+ * @warning Never returns. Called with interrupts disabled.
+*/
+void sched_exit(void);
+
+/**
+ * @brief Build the first kernel stack frame of a new process and queue it.
+ *        The first context switch to it irets to entry_point in user space.
+ * 
+ * @param pcb Process whose program is loaded, not yet queued
+*/
+void sched_start(struct pcb_t* pcb);
+
+/**
+ * @brief Charge the current process for a PIT tick, and preempt it when its
+ *        timeslice runs out or a more urgent process is runnable.
+ * 
+ * @param user_mode nonzero when the tick interrupted user code
+*/
+void sched_tick(uint32_t user_mode);
+
+/**
+ * @brief Add a process to the back of the run queue for its priority
+ * 
+ * @param pcb Runnable process, not already queued and not running
+*/
+void sched_enqueue(struct pcb_t* pcb);
+
+/**
+ * @brief Take the most urgent process off the run queues
+ * 
+ * @return The process, NULL when the run queues are empty
+*/
+struct pcb_t* sched_dequeue(void);
+
+/**
+ * @brief Make a blocked process runnable, boosted to the top priority so
+ *        interactive processes respond quickly
+ * 
+ * @param pcb Process leaving a wait queue
+*/
+void sched_wake(struct pcb_t* pcb);
+
+/**
+ * @brief Sets up the idle context, which halts while every process is blocked
+*/
+void setup_idle(void);
+
+/**
+ * @brief Get the idle context's PCB, for its statistics
+ * 
+ * @return The idle PCB
+*/
+struct pcb_t* get_idle_pcb(void);
+
 /**
  * @brief Sets up fake shells by mimicking execute without the iret.
  * 
+ * @param tcb_idx terminal the shell belongs to
  * @return 0 on success, -1 on failure
  */
-int32_t setup_shell(void);
+int32_t setup_shell(uint8_t tcb_idx);
 
 #endif /* _SWITCH_H */
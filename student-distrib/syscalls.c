@@ -5,6 +5,11 @@
 #include "proc/PCB.h"
 #include "drivers/terminal.h"
 #include "alloc.h"
+#include "switch.h"
+#include "waitq.h"
+
+/* Parents sleep here in waitpid until a spawned child halts */
+static wait_queue_t child_exit_wait = WAIT_QUEUE_INIT;
 
 /* halt system call: Index 1 */
 int32_t system_halt (uint32_t status)
@@ -19,12 +24,50 @@ int32_t system_halt (uint32_t status)
     /* Close video memory from vidmap system call */
     mark_page_not_present((uint8_t*) VIDEO_MEM_START_USER, get_curr_pcb()->id);
 
+    /* Drop file mappings, the pages belong to the file system */
+    pcb_munmap_all();
+
+    /* Give every heap page back in one pass, leaked objects included */
+    pcb_t* curr_pcb = get_curr_pcb();
+    uheap_release(curr_pcb);
+
+    /* Halted background children are reaped, running ones carry on without us */
+    pcb_t* child;
+    while ((child = pcb_find_child(curr_pcb, WAIT_ANY)) != NULL) {
+        if (child->state == PROC_STATE_ZOMBIE) {
+            pcb_destroy(child);
+            free_pcb(child);
+        } else {
+            child->parent_pcb = NULL;
+        }
+    }
+
+    /* A background process leaves its status to waitpid, or frees itself once orphaned */
+    if (curr_pcb->spawned) {
+        if (curr_pcb->parent_pcb) {
+            curr_pcb->exit_status = status;
+            curr_pcb->state = PROC_STATE_ZOMBIE;
+            wake_up(&child_exit_wait);
+            context_switch();
+        } else {
+            load_kernel_page_directory();
+            pcb_destroy(curr_pcb);
+            free_pcb(curr_pcb);
+            sched_exit();
+        }
+
+        /* This should never be reached */
+        return -1;
+    }
+
     /* Restore parent data */
-    pcb_t* parent_pcb = get_curr_pcb()->parent_pcb;
+    pcb_t* parent_pcb = curr_pcb->parent_pcb;
     
     /* If the parent pcb is NULL, we have halted all processes -> restart shell */
     if (!parent_pcb) {
-        if (-1 == pcb_destroy(get_curr_pcb())) {
+        /* The shell's page directory is freed, run on the kernel's meanwhile */
+        load_kernel_page_directory();
+        if (-1 == pcb_destroy(curr_pcb)) {
             sti(); return -1;
         }
         system_execute((uint8_t*)"shell");
@@ -34,19 +77,25 @@ int32_t system_halt (uint32_t status)
     }
 
     /* Inform the tcb that a child has been killed, go back to the parent */
-    tcb_set_pcb(parent_pcb->tcb_idx, parent_pcb);
+    tcb_pass_pcb(curr_pcb, parent_pcb);
 
     /* Restore parent paging */
-    load_page_directory((uint32_t*)get_proc_page(parent_pcb->id)->proc_pdirectory);
+    load_page_directory((uint32_t*)parent_pcb->page->proc_pdirectory);
     
     /* Destroy the pcb */
-    if (-1 == pcb_destroy(get_curr_pcb())) {
+    if (-1 == pcb_destroy(curr_pcb)) {
         sti(); return -1;
     }
 
+    /* Still running on this stack, nothing can take it before we leave it */
+    free_pcb(curr_pcb);
+
     /* Restore the TSS */
     tss.esp0 = (uint32_t)parent_pcb + KSTACK_SIZE;
 
+    /* The parent carries on in the child's place */
+    parent_pcb->state = PROC_STATE_RUNNABLE;
+
     /* Enable interrupts */
     // sti();
 
@@ -67,15 +116,20 @@ int32_t system_halt (uint32_t status)
     return -1;
 }
 
-/* execute system call: Index 2 */
-int32_t system_execute (const uint8_t* command)
+/**
+ * @brief Splits a command into the program name and its arguments, and reads
+ *        the program's header
+ * 
+ * @param command command passed to execute or spawn
+ * @param command_buf filled with the NUL terminated program name
+ * @param args set to the arguments, stripped of leading spaces
+ * @return -1 if the program cannot be run, 0 on success
+*/
+static int32_t parse_command (const uint8_t* command, uint8_t* command_buf, const uint8_t** args)
 {
-    /* Disable interrupts */
-    cli();
-
     /* Parse Args */
     if (command == NULL) {
-        sti(); return -1;
+        return -1;
     }
 
     unsigned int cmd_start = 0;
@@ -89,7 +143,6 @@ int32_t system_execute (const uint8_t* command)
 
     /* Copy command word into buffer */
     int arg_flag = 1;
-    uint8_t command_buf[FILENAME_LEN + 1];                  //Extra size for NULL termination
     unsigned int cmd_len = 0;
     while( cmd_len != FILENAME_LEN + 1){
         if( *(command + cmd_start + cmd_len) == ' '){
@@ -104,18 +157,52 @@ int32_t system_execute (const uint8_t* command)
     }
 
     if(cmd_len >= FILENAME_LEN + 1){      //Command too long
-        sti(); return -1;
+        return -1;
     }
     /* Null terminate our buffer */
     command_buf[cmd_len] = NULL;
 
+    /* Assuming command has no more leading spaces and does have args*/
+    if(arg_flag){
+        const uint8_t* arg_start = command + cmd_start + cmd_len;
+        unsigned int i = 0;
+        for(i=0; i < MAX_ARGS; i++){
+            if(*(arg_start + i) != ' '){
+                break;
+            }
+        }
+        *args = arg_start + i;
+    }
+    /* Command has no args, pass in empty string */
+    else{
+        *args = (uint8_t*)"";
+    }
+
     /* Grab executable data */
-    if (read_header(command_buf) != 0) {
+    return (read_header(command_buf) != 0) ? -1 : 0;
+}
+
+/* execute system call: Index 2 */
+int32_t system_execute (const uint8_t* command)
+{
+    /* Disable interrupts */
+    cli();
+
+    uint8_t command_buf[FILENAME_LEN + 1];                  //Extra size for NULL termination
+    const uint8_t* args;
+    if (-1 == parse_command(command, command_buf, &args)) {
         sti(); return -1;
     }
 
-    /* Create and initialize PCB */
-    pcb_t* pcb = alloc_pcb();
+    /* Create and initialize PCB. A context without a live process (boot, or
+     * a terminal whose shell just halted) becomes the new shell in place. */
+    pcb_t* pcb;
+    if (get_curr_pcb()->active) {
+        pcb = alloc_pcb();
+    } else {
+        pcb = get_curr_pcb();
+        if (-1 == pcb_create(pcb)) pcb = NULL;
+    }
     if (!pcb) {
         sti(); return -1;
     }
@@ -129,38 +216,39 @@ int32_t system_execute (const uint8_t* command)
         /* This block will only occur if we tried to exit from a shell. */
 
         pcb->parent_pcb = 0;
-        /* The id will correspond also with the terminal id */
-        pcb->tcb_idx = pcb->id;
+        /* Stay on the terminal we were running on */
+        pcb->tcb_idx = tcb_get_curr_idx();
     }
 
-    /* Inform the asssociated tcb that there is a new process */
-    tcb_set_pcb(pcb->tcb_idx, pcb);
+    /* Inform the asssociated tcb that there is a new process, unless a
+     * background job started it */
+    if (pcb->parent_pcb) {
+        tcb_pass_pcb(pcb->parent_pcb, pcb);
+    } else {
+        tcb_set_pcb(pcb->tcb_idx, pcb);
+    }
+
+    /* Name the process for procstat */
+    strcpy((int8_t*)pcb->name, (int8_t*)command_buf);
 
     /* Save command args */
-    /* Assuming command has no more leading spaces and does have args*/
-    if(arg_flag){
-        const uint8_t* arg_start = command + cmd_start + cmd_len;
-        unsigned int i = 0;
-        for(i=0; i < MAX_ARGS; i++){
-            if(*(arg_start + i) != ' '){
-                break;
-            }
+    strcpy((int8_t*)pcb->args, (int8_t*)args);
+
+    /* Executable pages are read in by the page fault handler as they are touched */
+    if (load_program(command_buf, pcb) != 0) {
+        /* Give the process back, a root shell keeps its stack */
+        if (pcb->parent_pcb) {
+            tcb_pass_pcb(pcb, pcb->parent_pcb);
         }
-        strcpy((int8_t*)pcb->args, (int8_t*)(arg_start + i));
-    }
-    /* Command has no args, pass in empty string */
-    else{
-        uint8_t* empty = (uint8_t*)"";
-        strcpy((int8_t*)pcb->args, (int8_t*)empty);
+        pcb_destroy(pcb);
+        if (pcb != get_curr_pcb()) {
+            free_pcb(pcb);
+        }
+        sti(); return -1;
     }
 
     /* Setup paging for new process */
-    load_page_directory((uint32_t*)get_proc_page(pcb->id)->proc_pdirectory);
-
-    /* Load executable into memory */
-    if (load_program(command_buf, (uint8_t*)PROGRAM_START_MEM) != 0) {
-        sti(); return -1;
-    }
+    load_page_directory((uint32_t*)pcb->page->proc_pdirectory);
 
     /* Load TSS with SS0 and ESP0 to allow 
     for privilege switches from user to kernel */
@@ -177,6 +265,9 @@ int32_t system_execute (const uint8_t* command)
     );
     if (pcb->parent_pcb != 0) {
         pcb->parent_pcb->old_ebp = old_ebp;
+
+        /* The parent sleeps until the child halts, the child takes over its turn */
+        pcb->parent_pcb->state = PROC_STATE_BLOCKED;
     }
 
     /* Enable interrupts */
@@ -301,14 +392,13 @@ int32_t system_sigreturn (void)
 /* malloc system call: Index 11 */
 int32_t system_malloc(uint32_t nbytes)
 {
-    return (int32_t)kmalloc(nbytes, KMEM_ATOMIC | KMEM_USER);
+    return (int32_t)uheap_alloc(nbytes);
 }
 
 /* free system call: Index 12 */
 int32_t system_free(void* ptr)
 {
-    kfree(ptr, KMEM_ATOMIC | KMEM_USER);
-    return 0;
+    return uheap_free(ptr);
 }
 
 /* ioctl system call: Index 13 */
@@ -320,3 +410,139 @@ int32_t system_ioctl(int32_t fd, uint32_t command, uint32_t args)
     }
     return pcb_ioctl(fd, command, args);
 }
+
+/* sbrk system call: Index 14 */
+int32_t system_sbrk(int32_t increment)
+{
+    return uheap_sbrk(increment);
+}
+
+/* mmap system call: Index 15 */
+int32_t system_mmap(int32_t fd, uint32_t length)
+{
+    return pcb_mmap(fd, length);
+}
+
+/* munmap system call: Index 16 */
+int32_t system_munmap(void* addr)
+{
+    return pcb_munmap((uint32_t)addr);
+}
+
+/* getdents system call: Index 17 */
+int32_t system_getdents(int32_t fd, void* buf, int32_t nbytes)
+{
+    return pcb_getdents(fd, buf, nbytes);
+}
+
+/* pread system call: Index 18 */
+int32_t system_pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset)
+{
+    return pcb_pread(fd, buf, nbytes, offset);
+}
+
+/* pwrite system call: Index 19 */
+int32_t system_pwrite(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset)
+{
+    return pcb_pwrite(fd, buf, nbytes, offset);
+}
+
+/* lseek system call: Index 20 */
+int32_t system_lseek(int32_t fd, int32_t offset, int32_t whence)
+{
+    return pcb_lseek(fd, offset, whence);
+}
+
+/* fstat system call: Index 21 */
+int32_t system_fstat(int32_t fd, stat_t* buf)
+{
+    return pcb_fstat(fd, buf);
+}
+
+/* procstat system call: Index 22 */
+int32_t system_procstat(proc_stat_t* buf, int32_t count)
+{
+    /* The whole table must lie in the program image */
+    if (count > 0 && ((uint32_t)count > (PROGRAM_END_MEM - PROGRAM_START_MEM) / sizeof(proc_stat_t) ||
+        !(PROGRAM_START_MEM <= (uint32_t)buf && (uint32_t)(buf + count) <= PROGRAM_END_MEM))) {
+        return -1;
+    }
+
+    return pcb_procstat(buf, count);
+}
+
+/* spawn system call: Index 23 */
+int32_t system_spawn (const uint8_t* command)
+{
+    uint32_t flags;
+    cli_and_save(flags);
+
+    uint8_t command_buf[FILENAME_LEN + 1];
+    const uint8_t* args;
+    if (-1 == parse_command(command, command_buf, &args)) {
+        restore_flags(flags); return -1;
+    }
+
+    pcb_t* pcb = alloc_pcb();
+    if (!pcb) {
+        restore_flags(flags); return -1;
+    }
+
+    /* The child shares the terminal but stays in the background, the
+     * terminal's foreground process is still the parent */
+    pcb->parent_pcb = get_curr_pcb();
+    pcb->tcb_idx = pcb->parent_pcb->tcb_idx;
+    pcb->spawned = 1;
+
+    strcpy((int8_t*)pcb->name, (int8_t*)command_buf);
+    strcpy((int8_t*)pcb->args, (int8_t*)args);
+
+    if (load_program(command_buf, pcb) != 0) {
+        pcb_destroy(pcb);
+        free_pcb(pcb);
+        restore_flags(flags); return -1;
+    }
+
+    /* Queued beside the parent, which carries on */
+    sched_start(pcb);
+
+    restore_flags(flags);
+    return pcb->id;
+}
+
+/* waitpid system call: Index 24 */
+int32_t system_waitpid (int32_t pid, int32_t* status, uint32_t options)
+{
+    pcb_t* curr_pcb = get_curr_pcb();
+    pcb_t* child;
+
+    /* The exit status is written to user space, so it must land in the program image */
+    if (status && !(PROGRAM_START_MEM <= (uint32_t)status && (uint32_t)(status + 1) <= PROGRAM_END_MEM)) {
+        return -1;
+    }
+
+    uint32_t flags;
+    cli_and_save(flags);
+
+    /* Sleep until the child halts, every halting child wakes every waiting parent */
+    while ((child = pcb_find_child(curr_pcb, pid)) != NULL && child->state != PROC_STATE_ZOMBIE) {
+        if (options & WNOHANG) {
+            restore_flags(flags); return 0;
+        }
+        sleep_on(&child_exit_wait);
+    }
+    if (!child) {
+        restore_flags(flags); return -1;
+    }
+
+    /* Reap the zombie */
+    pid = child->id;
+    if (status) {
+        *status = child->exit_status;
+    }
+    pcb_destroy(child);
+    free_pcb(child);
+
+    restore_flags(flags);
+    return pid;
+}
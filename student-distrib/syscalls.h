@@ -153,6 +153,134 @@ int32_t system_free(void* ptr);
 */
 int32_t system_ioctl(int32_t fd, uint32_t command, uint32_t args);
 
+/**
+ * @brief The sbrk system call grows or shrinks the user heap by whole
+ *        pages mapped at USER_SPACE_HEAP_START.
+ * 
+ * @param increment Number of bytes to move the heap break by
+ * 
+ * @return Previous heap break, -1 if the heap cannot be resized
+*/
+int32_t system_sbrk(int32_t increment);
+
+/**
+ * @brief The mmap system call maps a regular file read only at
+ *        USER_SPACE_MMAP_START, sharing its data blocks instead of
+ *        copying them.
+ * 
+ * @param fd File descriptor of a regular file
+ * @param length Number of bytes to map, clamped to the file length
+ * 
+ * @return Address of the mapping, -1 on failure
+*/
+int32_t system_mmap(int32_t fd, uint32_t length);
+
+/**
+ * @brief The munmap system call removes a mapping made by mmap.
+ * 
+ * @param addr Address returned by mmap
+ * 
+ * @return 0 on success, -1 if addr does not start a mapping
+*/
+int32_t system_munmap(void* addr);
+
+/**
+ * @brief The getdents system call lists a directory in batches, filling
+ *        buf with as many dirent_t entries as fit. Each call continues
+ *        where the last one on the same fd stopped.
+ * 
+ * @param fd File descriptor of a directory
+ * @param buf Buffer for the entries
+ * @param nbytes Size of the buffer, at least one dirent_t
+ * 
+ * @return Bytes placed in buf, 0 past the last entry, -1 on failure
+*/
+int32_t system_getdents(int32_t fd, void* buf, int32_t nbytes);
+
+/**
+ * @brief The pread system call reads from a regular file at the given
+ *        offset. The file position is neither used nor moved.
+ * 
+ * @param fd File descriptor of a regular file
+ * @param buf Buffer to read into
+ * @param nbytes Number of bytes to read
+ * @param offset Byte of the file to start at, passed in ESI
+ * 
+ * @return Bytes read, 0 at or past the end of the file, -1 on failure
+*/
+int32_t system_pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+
+/**
+ * @brief The pwrite system call writes to a regular file at the given
+ *        offset, growing it if needed. The file position is not moved.
+ * 
+ * @param fd File descriptor of a regular file
+ * @param buf Buffer to write from
+ * @param nbytes Number of bytes to write
+ * @param offset Byte of the file to start at, passed in ESI
+ * 
+ * @return Bytes written, -1 on failure
+*/
+int32_t system_pwrite(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
+
+/**
+ * @brief The lseek system call moves the file position of a regular file.
+ * 
+ * @param fd File descriptor of a regular file
+ * @param offset Bytes to move by
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END
+ * 
+ * @return The new file position, -1 on failure
+*/
+int32_t system_lseek(int32_t fd, int32_t offset, int32_t whence);
+
+/**
+ * @brief The fstat system call reports the type, inode and length of an
+ *        open file, directory or rtc.
+ * 
+ * @param fd File descriptor
+ * @param buf Filled in on success
+ * 
+ * @return 0 on success, -1 on failure
+*/
+int32_t system_fstat(int32_t fd, stat_t* buf);
+
+/**
+ * @brief The procstat system call lists every live process, with the CPU
+ *        time it has used, followed by the idle context.
+ * 
+ * @param buf Table to fill in
+ * @param count Number of entries that fit in buf, all of which must lie
+ *              in the program image
+ * 
+ * @return Number of entries filled in, -1 on failure
+*/
+int32_t system_procstat(proc_stat_t* buf, int32_t count);
+
+/**
+ * @brief The spawn system call starts a program in the background. The
+ *        child runs beside its caller on the same terminal until it
+ *        halts, then waits for waitpid as a zombie.
+ * 
+ * @param command Program name and arguments, as for execute
+ * 
+ * @return Pid of the child, -1 if the command cannot be executed
+*/
+int32_t system_spawn(const uint8_t* command);
+
+/**
+ * @brief The waitpid system call reaps a halted child started by spawn
+ * 
+ * @param pid Pid of the child, WAIT_ANY for any child
+ * @param status Filled with the child's halt status when not NULL
+ * @param options WNOHANG returns at once if the child is still running
+ * 
+ * @return Pid of the reaped child, 0 if WNOHANG and it is still running,
+ *         -1 if there is no such child or status lies outside the
+ *         program image
+*/
+int32_t system_waitpid(int32_t pid, int32_t* status, uint32_t options);
+
 /* IRET context switch to user program */
 extern void execute_context_switch(void);
 
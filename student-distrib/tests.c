@@ -6,9 +6,12 @@
 // #include "drivers/file.h"
 #include "drivers/RTC.h"
 #include "drivers/terminal.h"
+#include "drivers/pit.h"
 #include "loader.h"
 #include "syscalls.h"
 #include "spinlock.h"
+#include "waitq.h"
+#include "switch.h"
 #include "alloc.h"
 
 #define PASS 1
@@ -848,35 +851,16 @@ int spinlock_test() {
 	return 0;
 }
 
+#define SLAB_TEST_CLASS_SIZE(size, slabs)	(size),
+static const uint32_t slab_test_sizes[NUM_SLAB_OBJECTS] = { SLAB_CLASS_TABLE(SLAB_TEST_CLASS_SIZE) };
+
 uint32_t slab_object_size(uint32_t index)
 {
-	if (index == 0) {
-		return SLAB_OBJECT_SIZE_0;
-	}
-	else if (index == 1) {
-		return SLAB_OBJECT_SIZE_1;
-	}
-	else if (index == 2) {
-		return SLAB_OBJECT_SIZE_2;
-	}
-	else if (index == 3) {
-		return SLAB_OBJECT_SIZE_3;
-	}
-	else if (index == 4) {
-		return SLAB_OBJECT_SIZE_4;
-	}
-	else if (index == 5) {
-		return SLAB_OBJECT_SIZE_5;
-	}
-	else if (index == 6) {
-		return SLAB_OBJECT_SIZE_6;
-	}
-	else if (index == 7) {
-		return SLAB_OBJECT_SIZE_7;
-	}
-	else {
+	if (index >= NUM_SLAB_OBJECTS) {
 		return -1;
 	}
+
+	return slab_test_sizes[index];
 }
 
 int slab_cache_basic_test() {
@@ -916,6 +900,1309 @@ int slab_cache_basic_test() {
 	return 0;
 }
 
+#define SLAB_BENCH_OBJECTS	16384
+#define SLAB_BENCH_BATCH	2048
+static uint8_t* slab_bench_objects[SLAB_BENCH_OBJECTS];
+
+/**
+ * @brief Slab allocation microbenchmark
+ * 
+ * @details Allocates MIN_SLAB_OBJECT_SIZE objects from the smallest size
+ *          class and prints the average cycles per kcache_alloc() for each
+ *          batch. Allocation cost should stay flat
+ *          as the class fills up, instead of growing with every full slab.
+*/
+int slab_alloc_benchmark() {
+	TEST_HEADER;
+
+	uint32_t i, batch_start = 0;
+	for (i = 0; i < SLAB_BENCH_OBJECTS; i++) {
+		if (i % SLAB_BENCH_BATCH == 0) {
+			batch_start = rdtsc();
+		}
+
+		slab_bench_objects[i] = (uint8_t*)kcache_alloc(MIN_SLAB_OBJECT_SIZE);
+		if (slab_bench_objects[i] == NULL) {
+			return FAIL;
+		}
+
+		if (i % SLAB_BENCH_BATCH == SLAB_BENCH_BATCH - 1) {
+			printf("objects %d - %d: %d cycles/alloc\n", i + 1 - SLAB_BENCH_BATCH, i,
+				(rdtsc() - batch_start) / SLAB_BENCH_BATCH);
+		}
+	}
+
+	/* Time freeing everything, which also refills the partial list */
+	batch_start = rdtsc();
+	for (i = 0; i < SLAB_BENCH_OBJECTS; i++) {
+		if (kcache_free(slab_bench_objects[i]) < 0) {
+			return FAIL;
+		}
+	}
+	printf("free: %d cycles/free\n", (rdtsc() - batch_start) / SLAB_BENCH_OBJECTS);
+
+	return PASS;
+}
+
+/**
+ * @brief Size class lookup test
+ * 
+ * @details Every size must land in the smallest class that holds it,
+ *          then the per class fragmentation table is printed.
+*/
+int slab_size_class_test() {
+	TEST_HEADER;
+
+	uint32_t size, i;
+	for (size = 1; size <= MAX_SLAB_OBJECT_SIZE; size++) {
+		/* Expected class by linear search */
+		for (i = 0; slab_object_size(i) < size; i++);
+
+		uint8_t* kptr = (uint8_t*)kcache_alloc(size);
+		if (kptr == NULL) {
+			return FAIL;
+		}
+
+		/* Objects are aligned to their class size within the slab */
+		if (((uint32_t)kptr & KMEM_OBJECT_MASK) % slab_object_size(i) != 0) {
+			return FAIL;
+		}
+		kcache_free(kptr);
+	}
+
+	kcache_print_classes();
+
+	return PASS;
+}
+
+/**
+ * @brief Leaked user objects are all reclaimed with the process heap
+ * 
+ * @details Objects of every class and a multi-page object are leaked, 
+ *          then the heap is released the same way system_halt() does.
+*/
+int uheap_reclaim_test() {
+	TEST_HEADER;
+
+	pcb_t* pcb = get_curr_pcb();
+	if (pcb_create(pcb)) {
+		return FAIL;
+	}
+	load_page_directory((uint32_t*)pcb->page->proc_pdirectory);
+
+	uint32_t i;
+	for (i = 0; i < 64; i++) {
+		uint8_t* obj = (uint8_t*)system_malloc_wrapper(16 << (i % UHEAP_NUM_CLASSES));
+		if (obj == NULL) {
+			return FAIL;
+		}
+		*obj = i;
+	}
+	if (system_malloc_wrapper(5 * PAGE_SIZE_BYTES) == 0) {
+		return FAIL;
+	}
+
+	/* Freeing something that is not a live object is rejected */
+	if (system_free_wrapper((void*)(USER_SPACE_KMEM_START + 1)) != -1) {
+		return FAIL;
+	}
+	/* Nor is anything on a page that was never mapped, which has no descriptor */
+	if (system_free_wrapper((void*)(USER_SPACE_KMEM_START + (USER_SPACE_KMEM_PAGES - 1) * PAGE_SIZE_BYTES)) != -1) {
+		return FAIL;
+	}
+
+	if (uheap_num_pages(pcb) == 0) {
+		return FAIL;
+	}
+	uheap_release(pcb);
+	if (uheap_num_pages(pcb) != 0 || pcb->heap_pages != 0) {
+		return FAIL;
+	}
+
+	load_kernel_page_directory();
+	pcb_destroy(pcb);
+
+	return PASS;
+}
+
+#define KMEM_CACHE_TEST_OBJECTS	256
+#define KMEM_CACHE_TEST_MAGIC	0x0B1EC7ED
+static uint32_t kmem_cache_test_ctors, kmem_cache_test_dtors;
+static uint32_t* kmem_cache_test_objects[KMEM_CACHE_TEST_OBJECTS];
+
+static void kmem_cache_test_ctor(void* obj) {
+	*(uint32_t*)obj = KMEM_CACHE_TEST_MAGIC;
+	kmem_cache_test_ctors++;
+}
+
+static void kmem_cache_test_dtor(void* obj) {
+	kmem_cache_test_dtors++;
+}
+
+/**
+ * @brief Named object cache test
+ * 
+ * @details Objects of an odd size are packed at their aligned size, come
+ *          back constructed, and every constructed object is destructed
+ *          once the cache is destroyed.
+*/
+int kmem_cache_test() {
+	TEST_HEADER;
+
+	kmem_cache_test_ctors = 0;
+	kmem_cache_test_dtors = 0;
+	kmem_cache_t* cache = kmem_cache_create("test_obj", 52, 16, kmem_cache_test_ctor, kmem_cache_test_dtor);
+	if (cache == NULL || cache->stride != 64) {
+		return FAIL;
+	}
+
+	/* Bad alignments are rejected */
+	if (kmem_cache_create("bad_align", 52, 24, NULL, NULL) != NULL) {
+		return FAIL;
+	}
+
+	/* Spans several slabs */
+	uint32_t i;
+	for (i = 0; i < KMEM_CACHE_TEST_OBJECTS; i++) {
+		uint32_t* obj = (uint32_t*)kmem_cache_alloc(cache);
+		if (obj == NULL || ((uint32_t)obj & (16 - 1)) || *obj != KMEM_CACHE_TEST_MAGIC) {
+			return FAIL;
+		}
+		kmem_cache_test_objects[i] = obj;
+	}
+	if (cache->num_slabs < 2 || cache->stats.live != KMEM_CACHE_TEST_OBJECTS ||
+		cache->stats.frag_bytes != KMEM_CACHE_TEST_OBJECTS * (64 - 52)) {
+		return FAIL;
+	}
+
+	/* Live caches cannot be destroyed, bad and double frees are rejected */
+	if (kmem_cache_destroy(cache) != -1) {
+		return FAIL;
+	}
+	if (kmem_cache_free(cache, (uint8_t*)kmem_cache_test_objects[0] + 4) != -1) {
+		return FAIL;
+	}
+	for (i = 0; i < KMEM_CACHE_TEST_OBJECTS; i++) {
+		if (kmem_cache_free(cache, kmem_cache_test_objects[i]) != 0) {
+			return FAIL;
+		}
+	}
+	if (kmem_cache_free(cache, kmem_cache_test_objects[0]) != -1) {
+		return FAIL;
+	}
+
+	/* Freed objects are handed out again without being reconstructed */
+	uint32_t ctors = kmem_cache_test_ctors;
+	uint32_t* obj = (uint32_t*)kmem_cache_alloc(cache);
+	if (obj == NULL || *obj != KMEM_CACHE_TEST_MAGIC || kmem_cache_test_ctors != ctors) {
+		return FAIL;
+	}
+	kmem_cache_free(cache, obj);
+
+	if (kmem_cache_destroy(cache) != 0 || kmem_cache_test_dtors != kmem_cache_test_ctors) {
+		return FAIL;
+	}
+
+	return PASS;
+}
+
+#define PIT_CHANNEL_2		0x42
+#define PIT_GATE_PORT		0x61
+#define PIT_GATE_HIGH		0x01
+#define PIT_SPEAKER_ON		0x02
+#define PIT_OUT_2			0x20
+#define PIT_CHANNEL_2_ONESHOT	0xB0
+#define TSC_CALIBRATE_MS	10
+#define READ_BENCH_CHUNK	1000
+#define ELF_MAGIC_SIZE		4
+
+/**
+ * @brief Measure the time stamp counter rate against a one-shot count on
+ *        PIT channel 2, which does not disturb the scheduler on channel 0
+ * 
+ * @return Time stamp counter ticks per microsecond
+*/
+static uint32_t tsc_cycles_per_us(void) {
+	uint32_t count = PIT_FREQ / 1000 * TSC_CALIBRATE_MS;
+	uint8_t gate = inb(PIT_GATE_PORT) & ~(PIT_SPEAKER_ON | PIT_GATE_HIGH);
+
+	outb(gate, PIT_GATE_PORT);
+	outb(PIT_CHANNEL_2_ONESHOT, PIT_COMMAND_REG);
+	outb(count & 0xFF, PIT_CHANNEL_2);
+	outb(count >> 8, PIT_CHANNEL_2);
+
+	/* Raising the gate starts the count, OUT goes high when it expires */
+	uint32_t start = rdtsc();
+	outb(gate | PIT_GATE_HIGH, PIT_GATE_PORT);
+	while (!(inb(PIT_GATE_PORT) & PIT_OUT_2));
+	uint32_t cycles = rdtsc() - start;
+
+	outb(gate, PIT_GATE_PORT);
+	return cycles / (TSC_CALIBRATE_MS * 1000);
+}
+
+/**
+ * @brief read_data() throughput benchmark
+ * 
+ * @details Reads the large text file and every executable in one call
+ *          and prints MB/s (bytes per microsecond), then checks the bulk 
+ *          copy against reads of READ_BENCH_CHUNK bytes, which split 
+ *          data blocks at odd offsets.
+*/
+int read_data_benchmark() {
+	TEST_HEADER;
+
+	uint32_t cycles_per_us = tsc_cycles_per_us();
+	if (cycles_per_us == 0) {
+		cycles_per_us = 1;
+	}
+	printf("tsc: %u MHz\n", cycles_per_us);
+
+	boot_block_t* bblock = file_system.boot_block;
+	uint32_t i, total_bytes = 0, total_cycles = 0;
+	for (i = 0; i < bblock->dir_count; i++) {
+		dentry_t* dentry = &bblock->direntries[i];
+		if (dentry->filetype != FILE_TYPE_REG) {
+			continue;
+		}
+
+		uint32_t length = file_system.inode_base[dentry->inode_num].length;
+		uint8_t magic[ELF_MAGIC_SIZE];
+		if (read_data(dentry->inode_num, 0, magic, ELF_MAGIC_SIZE) != ELF_MAGIC_SIZE) {
+			continue;
+		}
+		uint32_t is_elf = magic[0] == FIRST_BYTE && magic[1] == SECOND_BYTE && 
+			magic[2] == THIRD_BYTE && magic[3] == FOURTH_BYTE;
+		if (!is_elf && strncmp((int8_t*)dentry->filename, "verylargetextwithverylongname.txt", FILENAME_LEN)) {
+			continue;
+		}
+
+		uint8_t* buf = (uint8_t*)kmalloc(length, KMEM_KERNEL);
+		uint8_t* check = (uint8_t*)kmalloc(length, KMEM_KERNEL);
+		if (buf == NULL || check == NULL) {
+			return FAIL;
+		}
+
+		uint32_t start = rdtsc();
+		int32_t ret = read_data(dentry->inode_num, 0, buf, length);
+		uint32_t cycles = rdtsc() - start;
+		if (ret != length) {
+			return FAIL;
+		}
+		uint32_t us = cycles / cycles_per_us;
+		printf("%u bytes in %u cycles, %u MB/s\n", length, cycles, us ? length / us : length);
+		total_bytes += length;
+		total_cycles += cycles;
+
+		/* Chunked reads cross block boundaries mid-copy */
+		uint32_t pos, j;
+		for (pos = 0; pos < length; pos += READ_BENCH_CHUNK) {
+			read_data(dentry->inode_num, pos, check + pos, READ_BENCH_CHUNK);
+		}
+		for (j = 0; j < length; j++) {
+			if (buf[j] != check[j]) {
+				return FAIL;
+			}
+		}
+
+		kfree(check, KMEM_KERNEL);
+		kfree(buf, KMEM_KERNEL);
+	}
+
+	uint32_t total_us = total_cycles / cycles_per_us;
+	printf("total: %u bytes, %u MB/s\n", total_bytes, total_us ? total_bytes / total_us : total_bytes);
+
+	return PASS;
+}
+
+#define LOOKUP_BENCH_ROUNDS	1000
+
+/**
+ * @brief File name lookup latency benchmark
+ * 
+ * @details Times read_dentry_by_name() against the linear strncmp() scan
+ *          it replaced, over every name plus a miss, then the two lookups
+ *          and header read done by execute() and an open/close pair.
+*/
+int dentry_lookup_benchmark() {
+	TEST_HEADER;
+
+	boot_block_t* bblock = file_system.boot_block;
+	uint8_t names[MAX_FILES + 1][FILENAME_LEN + 1];
+	uint32_t num_names = 0, i, j, round;
+	for (i = 0; i < bblock->dir_count; i++, num_names++) {
+		strncpy((int8_t*)names[i], (int8_t*)bblock->direntries[i].filename, FILENAME_LEN);
+		names[i][FILENAME_LEN] = '\0';
+	}
+	strcpy((int8_t*)names[num_names++], "no_such_file");
+
+	dentry_t dentry;
+	uint32_t start = rdtsc();
+	for (round = 0; round < LOOKUP_BENCH_ROUNDS; round++) {
+		for (i = 0; i < num_names; i++) {
+			int32_t ret = read_dentry_by_name(names[i], &dentry);
+			if ((ret == 0) != (i < bblock->dir_count)) {
+				return FAIL;
+			}
+		}
+	}
+	uint32_t hashed = (rdtsc() - start) / (LOOKUP_BENCH_ROUNDS * num_names);
+
+	start = rdtsc();
+	for (round = 0; round < LOOKUP_BENCH_ROUNDS; round++) {
+		for (i = 0; i < num_names; i++) {
+			for (j = 0; j < bblock->dir_count; j++) {
+				if (!strncmp((int8_t*)names[i], (int8_t*)bblock->direntries[j].filename, FILENAME_LEN)) {
+					break;
+				}
+			}
+		}
+	}
+	uint32_t linear = (rdtsc() - start) / (LOOKUP_BENCH_ROUNDS * num_names);
+	printf("lookup: %u cycles hashed, %u cycles linear scan\n", hashed, linear);
+
+	/* execute() looks the name up in read_header() and again in load_program() */
+	start = rdtsc();
+	for (round = 0; round < LOOKUP_BENCH_ROUNDS; round++) {
+		if (read_header((uint8_t*)"shell") || read_dentry_by_name((uint8_t*)"shell", &dentry)) {
+			return FAIL;
+		}
+	}
+	printf("exec lookups + header: %u cycles\n", (rdtsc() - start) / LOOKUP_BENCH_ROUNDS);
+
+	start = rdtsc();
+	for (round = 0; round < LOOKUP_BENCH_ROUNDS; round++) {
+		int32_t fd = pcb_open((uint8_t*)"frame0.txt");
+		if (fd == -1 || pcb_close(fd)) {
+			return FAIL;
+		}
+	}
+	printf("open + close: %u cycles\n", (rdtsc() - start) / LOOKUP_BENCH_ROUNDS);
+
+	return PASS;
+}
+
+/* Whether two byte buffers differ anywhere in their first n bytes */
+static int32_t bytes_differ(const uint8_t* a, const uint8_t* b, uint32_t n) {
+	uint32_t i;
+	for (i = 0; i < n; i++) {
+		if (a[i] != b[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Extent inode write/read/truncate test
+ * 
+ * @details Writes a file spanning several blocks, then past its end so the
+ *          gap has to read back as zeros, then cuts it down and clears it.
+ *          Holds on either image version, on extent images every write
+ *          appends to the file's extents.
+*/
+int extent_file_test() {
+	TEST_HEADER;
+
+	static uint8_t buf[3 * BLOCK_SIZE];
+	static uint8_t check[3 * BLOCK_SIZE];
+	dentry_t dentry;
+	uint32_t i;
+
+	if (write_dentry_by_name((uint8_t*)"extent_test", &dentry)) {
+		return FAIL;
+	}
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)(i * 7 + 1);
+	}
+	if (write_data(dentry.inode_num, 0, buf, sizeof(buf)) != sizeof(buf)) {
+		return FAIL;
+	}
+	if (read_data(dentry.inode_num, 0, check, sizeof(check)) != sizeof(check) || bytes_differ(buf, check, sizeof(buf))) {
+		return FAIL;
+	}
+
+	/* Writing one block past the end leaves a zero filled gap */
+	if (write_data(dentry.inode_num, 4 * BLOCK_SIZE, buf, BLOCK_SIZE) != BLOCK_SIZE) {
+		return FAIL;
+	}
+	if (read_data(dentry.inode_num, 3 * BLOCK_SIZE, check, BLOCK_SIZE) != BLOCK_SIZE) {
+		return FAIL;
+	}
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		if (check[i] != 0) {
+			return FAIL;
+		}
+	}
+
+	/* Cut back into the first block */
+	if (delete_data(dentry.inode_num, 5 * BLOCK_SIZE - 100) != 5 * BLOCK_SIZE - 100) {
+		return FAIL;
+	}
+	if (read_data(dentry.inode_num, 0, check, sizeof(check)) != 100 || bytes_differ(buf, check, 100)) {
+		return FAIL;
+	}
+
+	clear_file((uint8_t*)"extent_test");
+	if (file_system.inode_base[dentry.inode_num].length != 0) {
+		return FAIL;
+	}
+	printf("file system version %u\n", file_system.version);
+	return PASS;
+}
+
+/**
+ * @brief Path lookup test
+ * 
+ * @details Root names resolve with or without leading slashes and "./",
+ *          names under a regular file or a missing directory do not, and
+ *          every entry read back from the root lists by its own name.
+*/
+int path_lookup_test() {
+	TEST_HEADER;
+
+	dentry_t dentry;
+	dentry_t by_path;
+	uint32_t index = 0;
+
+	if (read_dentry_by_name((uint8_t*)"shell", &dentry)) {
+		return FAIL;
+	}
+	if (read_dentry_by_name((uint8_t*)"/shell", &by_path) || by_path.inode_num != dentry.inode_num) {
+		return FAIL;
+	}
+	if (read_dentry_by_name((uint8_t*)"./shell", &by_path) || by_path.inode_num != dentry.inode_num) {
+		return FAIL;
+	}
+	if (!read_dentry_by_name((uint8_t*)"shell/cat", &by_path) ||
+		!read_dentry_by_name((uint8_t*)"no_such_dir/shell", &by_path) ||
+		!read_dentry_by_name((uint8_t*)"shell/", &by_path)) {
+		return FAIL;
+	}
+
+	while (read_dentry_in_dir(ROOT_DIR_INODE, &index, &dentry) == 0) {
+		uint8_t name[FILENAME_LEN + 1];
+		strncpy((int8_t*)name, (int8_t*)dentry.filename, FILENAME_LEN);
+		name[FILENAME_LEN] = '\0';
+		if (read_dentry_by_name(name, &by_path) || by_path.inode_num != dentry.inode_num) {
+			return FAIL;
+		}
+	}
+	if (index < file_system.boot_block->dir_count) {
+		return FAIL;
+	}
+	return PASS;
+}
+
+#define DIR_GROWTH_TEST_FILES	100
+
+/**
+ * @brief Directory growth test
+ * 
+ * @details Creates names in the root until it runs out of room. On extent
+ *          images the root carries on past the boot block into a directory
+ *          inode that doubles its buckets as they fill, so with enough spare
+ *          inodes (createfs2 -n) every name has to be created. Either way
+ *          every created name must resolve and be listed once.
+*/
+int dir_growth_test() {
+	TEST_HEADER;
+
+	uint8_t name[FILENAME_LEN + 1];
+	dentry_t dentry;
+	uint32_t index = 0;
+	uint32_t before = 0, after = 0;
+	uint32_t i, created;
+
+	while (read_dentry_in_dir(ROOT_DIR_INODE, &index, &dentry) == 0) {
+		before++;
+	}
+
+	for (created = 0; created < DIR_GROWTH_TEST_FILES; created++) {
+		strcpy((int8_t*)name, "grow_");
+		itoa(created, (int8_t*)name + strlen("grow_"), 10);
+		if (create_new_file(name)) {
+			break;
+		}
+	}
+	if (file_system.version == FS_VERSION_EXTENT && created != DIR_GROWTH_TEST_FILES) {
+		return FAIL;
+	}
+
+	for (i = 0; i < created; i++) {
+		strcpy((int8_t*)name, "grow_");
+		itoa(i, (int8_t*)name + strlen("grow_"), 10);
+		if (read_dentry_by_name(name, &dentry) || dentry.filetype != FILE_TYPE_REG) {
+			return FAIL;
+		}
+	}
+	/* A name is only ever created once */
+	if (created > 0 && !create_new_file((uint8_t*)"grow_0")) {
+		return FAIL;
+	}
+
+	index = 0;
+	while (read_dentry_in_dir(ROOT_DIR_INODE, &index, &dentry) == 0) {
+		after++;
+	}
+	if (after != before + created) {
+		return FAIL;
+	}
+	return PASS;
+}
+
+/**
+ * @brief File page lookup test for mmap
+ * 
+ * @details Every page file_data_page() hands out must be page aligned so
+ *          it can be mapped, hold the same bytes read_data() returns, and
+ *          stop at the end of the file.
+*/
+int file_data_page_test() {
+	TEST_HEADER;
+
+	static uint8_t check[BLOCK_SIZE];
+	dentry_t dentry;
+	uint32_t block, num_blocks;
+
+	if (read_dentry_by_name((uint8_t*)"fish", &dentry)) {
+		return FAIL;
+	}
+	uint32_t length = file_system.inode_base[dentry.inode_num].length;
+	num_blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	for (block = 0; block < num_blocks; block++) {
+		uint8_t* page = file_data_page(dentry.inode_num, block);
+		if (page == NULL || ((uint32_t)page & (BLOCK_SIZE - 1))) {
+			return FAIL;
+		}
+		int32_t n = read_data(dentry.inode_num, block * BLOCK_SIZE, check, BLOCK_SIZE);
+		if (n <= 0 || bytes_differ(page, check, n)) {
+			return FAIL;
+		}
+	}
+	if (file_data_page(dentry.inode_num, num_blocks) != NULL) {
+		return FAIL;
+	}
+	return PASS;
+}
+
+/**
+ * @brief Demand paging test
+ * 
+ * @details A freshly loaded image has no text page resident until it is
+ *          touched, the page fault fills it with the bytes read_data()
+ *          returns, and the stack past the image starts out zeroed.
+*/
+int demand_paging_test() {
+	TEST_HEADER;
+
+	static uint8_t check[PAGE_4KB_SIZE_B];
+	pcb_t* pcb = get_curr_pcb();
+	if (pcb_create(pcb) || read_header((uint8_t*)"shell") || load_program((uint8_t*)"shell", pcb)) {
+		return FAIL;
+	}
+	load_page_directory((uint32_t*)get_proc_page(pcb->id)->proc_pdirectory);
+
+	/* Nothing is resident until it is touched */
+	uint8_t* text = (uint8_t*)pcb->prog_segments[0].vaddr;
+	if (get_mapped_page(text, pcb->id) != NULL) {
+		return FAIL;
+	}
+	int32_t n = read_data(pcb->prog_inode, pcb->prog_segments[0].offset, check, PAGE_4KB_SIZE_B - ((uint32_t)text & (PAGE_4KB_SIZE_B - 1)));
+	if (n > pcb->prog_segments[0].file_size) {
+		n = pcb->prog_segments[0].file_size;
+	}
+	if (n <= 0 || bytes_differ(text, check, n)) {
+		return FAIL;
+	}
+	if (get_mapped_page(text, pcb->id) == NULL) {
+		return FAIL;
+	}
+
+	/* The stack lies past the image and starts out zeroed */
+	if (*(uint32_t*)(USER_SPACE_PROG_END - sizeof(uint32_t)) != 0) {
+		return FAIL;
+	}
+
+	load_kernel_page_directory();
+	pcb_destroy(pcb);
+	return PASS;
+}
+
+/**
+ * @brief ELF segment load test
+ * 
+ * @details Every PT_LOAD segment of fish must hold its file bytes at
+ *          p_vaddr and read as zero through the end of its bss.
+*/
+int elf_segment_test() {
+	TEST_HEADER;
+
+	static uint8_t check[PAGE_4KB_SIZE_B];
+	pcb_t* pcb = get_curr_pcb();
+
+	/* fish has a data segment whose bss runs over several pages */
+	if (pcb_create(pcb) || read_header((uint8_t*)"fish") || load_program((uint8_t*)"fish", pcb)) {
+		return FAIL;
+	}
+	load_page_directory((uint32_t*)get_proc_page(pcb->id)->proc_pdirectory);
+
+	uint32_t i, pos;
+	for (i = 0; i < pcb->prog_num_segments; i++) {
+		prog_segment_t segment = pcb->prog_segments[i];
+		uint8_t* base = (uint8_t*)segment.vaddr;
+
+		/* File bytes land at p_vaddr, not at their file offset */
+		for (pos = 0; pos < segment.file_size; pos += PAGE_4KB_SIZE_B) {
+			uint32_t n = segment.file_size - pos;
+			if (n > PAGE_4KB_SIZE_B) {
+				n = PAGE_4KB_SIZE_B;
+			}
+			if (read_data(pcb->prog_inode, segment.offset + pos, check, n) != (int32_t)n || bytes_differ(base + pos, check, n)) {
+				return FAIL;
+			}
+		}
+
+		/* Bss is zero */
+		for (pos = segment.file_size; pos < segment.mem_size; pos++) {
+			if (base[pos] != 0) {
+				return FAIL;
+			}
+		}
+	}
+
+	load_kernel_page_directory();
+	pcb_destroy(pcb);
+	return PASS;
+}
+
+/**
+ * @brief Shared text test
+ * 
+ * @details The read-only text segment of shell maps the file system
+ *          block itself, while its writable data segment faults in on a
+ *          private copy.
+*/
+int shared_text_test() {
+	TEST_HEADER;
+
+	pcb_t* pcb = get_curr_pcb();
+	if (pcb_create(pcb) || read_header((uint8_t*)"shell") || load_program((uint8_t*)"shell", pcb)) {
+		return FAIL;
+	}
+	load_page_directory((uint32_t*)get_proc_page(pcb->id)->proc_pdirectory);
+
+	/* Text maps the file system block itself, data gets a private page */
+	prog_segment_t text = pcb->prog_segments[0];
+	prog_segment_t data = pcb->prog_segments[1];
+	if ((text.flags & PF_W) || !(data.flags & PF_W)) {
+		return FAIL;
+	}
+	volatile uint8_t byte = *(uint8_t*)text.vaddr;
+	byte = *(uint8_t*)data.vaddr;
+	(void)byte;
+	if (get_mapped_page((uint8_t*)text.vaddr, pcb->id) != file_data_page(pcb->prog_inode, text.offset / PAGE_4KB_SIZE_B)) {
+		return FAIL;
+	}
+	if (get_mapped_page((uint8_t*)data.vaddr, pcb->id) == file_data_page(pcb->prog_inode, data.offset / PAGE_4KB_SIZE_B)) {
+		return FAIL;
+	}
+
+	load_kernel_page_directory();
+	pcb_destroy(pcb);
+	return PASS;
+}
+
+/**
+ * @brief Running image test
+ * 
+ * @details While a process runs shell, the file cannot be truncated,
+ *          cleared or written, and its text page still maps the same
+ *          block. The guard lifts once the process is gone.
+*/
+int running_image_test() {
+	TEST_HEADER;
+
+	pcb_t* pcb = get_curr_pcb();
+	if (pcb_create(pcb) || read_header((uint8_t*)"shell") || load_program((uint8_t*)"shell", pcb)) {
+		return FAIL;
+	}
+	load_page_directory((uint32_t*)get_proc_page(pcb->id)->proc_pdirectory);
+
+	/* Fault in the shared text page */
+	prog_segment_t text = pcb->prog_segments[0];
+	volatile uint8_t byte = *(uint8_t*)text.vaddr;
+	uint8_t* block = file_data_page(pcb->prog_inode, text.offset / PAGE_4KB_SIZE_B);
+	uint32_t inode = pcb->prog_inode;
+	uint32_t length = file_system.inode_base[inode].length;
+
+	int32_t fd = pcb_open((uint8_t*)"shell");
+	if (fd == -1) {
+		return FAIL;
+	}
+	if (truncate_file(fd, 0) != -1 || clear_file((uint8_t*)"shell") != -1) {
+		return FAIL;
+	}
+	if (pcb_pwrite(fd, (const void*)&byte, 1, 0) != -1 || write_data(inode, length, (uint8_t*)&byte, 1) != -1) {
+		return FAIL;
+	}
+	if (file_system.inode_base[inode].length != length || file_data_page(inode, text.offset / PAGE_4KB_SIZE_B) != block ||
+		get_mapped_page((uint8_t*)text.vaddr, pcb->id) != block) {
+		return FAIL;
+	}
+	pcb_close(fd);
+
+	load_kernel_page_directory();
+	pcb_destroy(pcb);
+	if (pcb_running_image(inode)) {
+		return FAIL;
+	}
+	return PASS;
+}
+
+/**
+ * @brief getdents test
+ * 
+ * @details Each descriptor keeps its own directory cursor, the rest of
+ *          the root comes back in one batch that matches the inodes, and
+ *          short buffers and regular files are rejected.
+*/
+int getdents_test() {
+	TEST_HEADER;
+
+	static dirent_t entries[MAX_FILES];
+	uint8_t name[FILENAME_LEN + 1];
+	int32_t fd1 = pcb_open((uint8_t*)".");
+	int32_t fd2 = pcb_open((uint8_t*)".");
+	if (fd1 == -1 || fd2 == -1) {
+		return FAIL;
+	}
+
+	/* A buffer too small for one entry is rejected, files have no entries */
+	if (pcb_getdents(fd1, entries, sizeof(dirent_t) - 1) != -1 || pcb_getdents(0, entries, sizeof(entries)) != -1) {
+		return FAIL;
+	}
+
+	/* One entry through fd1 does not move the cursor of fd2 */
+	int32_t n = pcb_getdents(fd1, entries, sizeof(dirent_t));
+	if (n != sizeof(dirent_t) || pcb_read(fd2, name, FILENAME_LEN) <= 0 || strncmp((int8_t*)name, (int8_t*)entries[0].filename, FILENAME_LEN)) {
+		return FAIL;
+	}
+
+	/* The rest of the root comes back in one batch, then 0 */
+	n = pcb_getdents(fd1, entries, sizeof(entries));
+	if (n != (int32_t)((file_system.boot_block->dir_count - 1) * sizeof(dirent_t)) || pcb_getdents(fd1, entries, sizeof(entries)) != 0) {
+		return FAIL;
+	}
+	uint32_t i;
+	for (i = 0; i < n / sizeof(dirent_t); i++) {
+		dentry_t dentry;
+		if (read_dentry_by_name(entries[i].filename, &dentry) || dentry.inode_num != entries[i].inode_num) {
+			return FAIL;
+		}
+		if (dentry.filetype == FILE_TYPE_REG && entries[i].size != file_system.inode_base[dentry.inode_num].length) {
+			return FAIL;
+		}
+	}
+
+	pcb_close(fd1);
+	pcb_close(fd2);
+	return PASS;
+}
+
+/**
+ * @brief Positional read/write test
+ * 
+ * @details pread and pwrite leave the file position alone, lseek moves
+ *          it from each origin but never before the start, fstat reports
+ *          the new length and truncating only ever shortens a file.
+*/
+int random_access_test() {
+	TEST_HEADER;
+
+	static uint8_t check[64];
+	const uint8_t* text = (const uint8_t*)"positional";
+	uint32_t len = strlen((int8_t*)text);
+	stat_t stat;
+
+	if (create_new_file((uint8_t*)"seek_test")) {
+		return FAIL;
+	}
+	int32_t fd = pcb_open((uint8_t*)"seek_test");
+	if (fd == -1) {
+		return FAIL;
+	}
+
+	/* pwrite past the end grows the file and leaves the position alone */
+	if (pcb_pwrite(fd, text, len, 100) != (int32_t)len || pcb_get_file_pos(fd) != 0) {
+		return FAIL;
+	}
+	if (pcb_fstat(fd, &stat) || stat.filetype != FILE_TYPE_REG || stat.size != 100 + len) {
+		return FAIL;
+	}
+	if (pcb_pread(fd, check, sizeof(check), 100) != (int32_t)len || bytes_differ(check, text, len)) {
+		return FAIL;
+	}
+	if (pcb_pread(fd, check, sizeof(check), 99) != (int32_t)len + 1 || check[0] != 0) {
+		return FAIL;
+	}
+	if (pcb_pread(fd, check, sizeof(check), 100 + len) != 0) {
+		return FAIL;
+	}
+
+	/* lseek from each origin, never before the start */
+	if (pcb_lseek(fd, 0, SEEK_END) != (int32_t)(100 + len) || pcb_lseek(fd, -(int32_t)len, SEEK_CUR) != 100 ||
+		pcb_lseek(fd, 4, SEEK_SET) != 4 || pcb_lseek(fd, -5, SEEK_CUR) != -1 || pcb_lseek(fd, 0, 3) != -1) {
+		return FAIL;
+	}
+
+	/* Truncating only ever shortens a regular file */
+	if (file_ioctl(fd, TRUNCATE_FILE, 100) || pcb_fstat(fd, &stat) || stat.size != 100) {
+		return FAIL;
+	}
+	if (file_ioctl(fd, TRUNCATE_FILE, 101) != -1 || file_ioctl(0, TRUNCATE_FILE, 0) != -1) {
+		return FAIL;
+	}
+
+	/* stdin is not a file */
+	if (pcb_fstat(0, &stat) != -1 || pcb_pread(0, check, 1, 0) != -1) {
+		return FAIL;
+	}
+
+	pcb_close(fd);
+	clear_file((uint8_t*)"seek_test");
+	return PASS;
+}
+
+/**
+ * @brief mmap truncate test
+ * 
+ * @details Pages of a mapping past the blocks a truncate keeps must read
+ *          as zeros, not the freed blocks another file may be handed.
+*/
+int mmap_truncate_test() {
+	TEST_HEADER;
+
+	static uint8_t fill[PAGE_4KB_SIZE_B];
+	pcb_t* pcb = get_curr_pcb();
+	if (pcb_create(pcb)) {
+		return FAIL;
+	}
+	load_page_directory((uint32_t*)get_proc_page(pcb->id)->proc_pdirectory);
+
+	memset(fill, 'm', sizeof(fill));
+	int32_t fd = -1;
+	if (create_new_file((uint8_t*)"mmap_test") || (fd = pcb_open((uint8_t*)"mmap_test")) == -1 ||
+		pcb_pwrite(fd, fill, sizeof(fill), 0) != sizeof(fill) || pcb_pwrite(fd, fill, sizeof(fill), sizeof(fill)) != sizeof(fill)) {
+		return FAIL;
+	}
+
+	int32_t map = pcb_mmap(fd, 2 * sizeof(fill));
+	if (map == -1 || ((uint8_t*)map)[sizeof(fill)] != 'm') {
+		return FAIL;
+	}
+
+	/* The kept block is cut at the new length, the dropped one reads as zeros */
+	if (file_ioctl(fd, TRUNCATE_FILE, 10)) {
+		return FAIL;
+	}
+	uint8_t* data = (uint8_t*)map;
+	if (data[9] != 'm' || data[10] != 0 || data[sizeof(fill)] != 0 || data[2 * sizeof(fill) - 1] != 0) {
+		return FAIL;
+	}
+
+	if (pcb_munmap(map)) {
+		return FAIL;
+	}
+	pcb_close(fd);
+	clear_file((uint8_t*)"mmap_test");
+	load_kernel_page_directory();
+	pcb_destroy(pcb);
+	return PASS;
+}
+
+/**
+ * @brief Wait queue test
+ * 
+ * @details Sleepers added to a queue are blocked, a single wakeup makes
+ *          all of them runnable, and NULL queues are rejected.
+*/
+int wait_queue_test() {
+	TEST_HEADER;
+
+	static pcb_t sleepers[2];
+	wait_queue_t queue = WAIT_QUEUE_INIT;
+
+	/* Waking an empty queue is harmless */
+	if (wake_up(&queue) || queue.head != NULL) {
+		return FAIL;
+	}
+
+	/* Blocked processes are linked into the queue */
+	if (wait_queue_add(&queue, &sleepers[0]) || wait_queue_add(&queue, &sleepers[1])) {
+		return FAIL;
+	}
+	if (sleepers[0].state != PROC_STATE_BLOCKED || sleepers[1].state != PROC_STATE_BLOCKED) {
+		return FAIL;
+	}
+	if (queue.head != &sleepers[1] || sleepers[1].wait_next != &sleepers[0] || sleepers[0].wait_next != NULL) {
+		return FAIL;
+	}
+
+	/* One wakeup makes every sleeper runnable */
+	if (wake_up(&queue) || queue.head != NULL) {
+		return FAIL;
+	}
+	if (sleepers[0].state != PROC_STATE_RUNNABLE || sleepers[1].state != PROC_STATE_RUNNABLE || sleepers[1].wait_next != NULL) {
+		return FAIL;
+	}
+
+	/* Woken sleepers are queued to run at the top priority */
+	if (sleepers[1].priority != SCHED_PRIO_INTERACTIVE || sched_dequeue() != &sleepers[1] || sched_dequeue() != &sleepers[0]) {
+		return FAIL;
+	}
+
+	if (wait_queue_add(NULL, &sleepers[0]) != -1 || wake_up(NULL) != -1) {
+		return FAIL;
+	}
+
+	return PASS;
+}
+
+/**
+ * @brief Run queue test
+ * 
+ * @details The most urgent level is dequeued first and each level is
+ *          FIFO. Batch processes get longer timeslices.
+*/
+int run_queue_test() {
+	TEST_HEADER;
+
+	static pcb_t procs[3];
+
+	/* The most urgent level runs first, FIFO within a level */
+	procs[0].priority = SCHED_PRIO_BATCH;
+	procs[1].priority = SCHED_PRIO_INTERACTIVE;
+	procs[2].priority = SCHED_PRIO_BATCH;
+	sched_enqueue(&procs[0]);
+	sched_enqueue(&procs[1]);
+	sched_enqueue(&procs[2]);
+	if (sched_dequeue() != &procs[1] || sched_dequeue() != &procs[0] || sched_dequeue() != &procs[2]) {
+		return FAIL;
+	}
+	if (sched_dequeue() != NULL) {
+		return FAIL;
+	}
+
+	/* Hogs get longer timeslices */
+	if (SCHED_QUANTUM(SCHED_PRIO_BATCH) <= SCHED_QUANTUM(SCHED_PRIO_INTERACTIVE)) {
+		return FAIL;
+	}
+
+	return PASS;
+}
+
+/**
+ * @brief Process table snapshot test
+ * 
+ * @details The idle context is always the last entry, even when it is
+ *          the only one that fits, and empty tables are rejected. The
+ *          system call refuses a table outside the program image.
+*/
+int procstat_test() {
+	TEST_HEADER;
+
+	static proc_stat_t table[PID_HASH_SIZE];
+	int32_t cnt;
+
+	setup_idle();
+
+	/* The idle context is always listed last */
+	cnt = pcb_procstat(table, PID_HASH_SIZE);
+	if (cnt < 1 || cnt > PID_HASH_SIZE) {
+		return FAIL;
+	}
+	if (table[cnt - 1].pid != IDLE_PID || table[cnt - 1].state != PROC_STATE_IDLE ||
+		strncmp((int8_t*)table[cnt - 1].name, (int8_t*)"idle", 5)) {
+		return FAIL;
+	}
+
+	/* Even when it is the only entry that fits */
+	if (pcb_procstat(table, 1) != 1 || table[0].pid != IDLE_PID) {
+		return FAIL;
+	}
+	if (pcb_procstat(table, 0) != -1 || pcb_procstat(NULL, 1) != -1) {
+		return FAIL;
+	}
+	if (system_procstat(table, 1) != -1 || system_procstat((proc_stat_t*)(PROGRAM_END_MEM - sizeof(proc_stat_t)), 2) != -1) {
+		return FAIL;
+	}
+
+	return PASS;
+}
+
+/**
+ * @brief Buddy page allocator test
+ * 
+ * @details Two single pages split from one block are buddies and free
+ *          back into the order 1 block, double frees are ignored, and
+ *          kernel and user buffers larger than a page are usable end to
+ *          end.
+*/
+int buddy_page_test() {
+	TEST_HEADER;
+
+	/* Split: two single pages from a fresh block are buddies */
+	uint8_t* page1 = (uint8_t*)kpage_alloc(0);
+	uint8_t* page2 = (uint8_t*)kpage_alloc(0);
+	if (page1 == NULL || page2 == NULL) {
+		return FAIL;
+	}
+	if (((uint32_t)page1 ^ (uint32_t)page2) != PAGE_SIZE_BYTES) {
+		return FAIL;
+	}
+
+	/* Coalesce: freeing both buddies gives back the order 1 block */
+	kpage_free(page1);
+	kpage_free(page2);
+	uint8_t* block = (uint8_t*)kpage_alloc(1);
+	if (block == NULL || kpage_order(block) != 1) {
+		return FAIL;
+	}
+	if (((uint32_t)block & ~(2 * PAGE_SIZE_BYTES - 1)) != ((uint32_t)page1 & ~(2 * PAGE_SIZE_BYTES - 1))) {
+		return FAIL;
+	}
+	kpage_free(block);
+
+	/* Double frees are ignored */
+	kpage_free(block);
+	if (kpage_order(block) != -1) {
+		return FAIL;
+	}
+
+	/* Large kernel buffers are mapped across every page */
+	uint32_t size = 3 * PAGE_SIZE_BYTES;
+	uint8_t* kbuf = (uint8_t*)kmalloc(size, KMEM_KERNEL);
+	if (kbuf == NULL || kpage_order(kbuf) != 2) {
+		return FAIL;
+	}
+	uint32_t i;
+	for (i = 0; i < size; i++) {
+		kbuf[i] = i;
+	}
+	kfree(kbuf, KMEM_KERNEL);
+
+	/* Large user buffers */
+	pcb_t* pcb = get_curr_pcb();
+	if (pcb_create(pcb)) {
+		return FAIL;
+	}
+	load_page_directory((uint32_t*)pcb->page->proc_pdirectory);
+	uint8_t* ubuf = (uint8_t*)system_malloc_wrapper(size);
+	if (ubuf == NULL) {
+		return FAIL;
+	}
+	for (i = 0; i < size; i++) {
+		ubuf[i] = i;
+	}
+	system_free_wrapper(ubuf);
+	load_kernel_page_directory();
+	pcb_destroy(pcb);
+
+	return PASS;
+}
+
+/**
+ * @brief Process paging structure test
+ * 
+ * @details The page directory and every page table of a process is a
+ *          single page from the buddy system, never the slab cache.
+*/
+int proc_page_test() {
+	TEST_HEADER;
+
+	proc_page_t* proc_page = proc_page_create();
+	if (proc_page == NULL) {
+		return FAIL;
+	}
+
+	void* tables[] = { proc_page->proc_pdirectory, proc_page->proc_prog_ptable, proc_page->proc_ptable2,
+		proc_page->proc_ptable3, proc_page->proc_heap_ptable, proc_page->proc_mmap_ptable };
+	uint32_t i;
+	for (i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+		if (kpage_order(tables[i]) != 0 ||
+			(KMEM_CACHE_START <= (uint32_t)tables[i] && (uint32_t)tables[i] < KMEM_CACHE_END)) {
+			return FAIL;
+		}
+	}
+
+	proc_page_destroy(proc_page);
+	for (i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+		if (kpage_order(tables[i]) != -1) {
+			return FAIL;
+		}
+	}
+	return PASS;
+}
+
+#define PID_TABLE_TEST_PROCS	16
+
+/**
+ * @brief pid table test
+ * 
+ * @details More processes than the old fixed table each get their own
+ *          pid, kernel stack and paging structures, and each leaves the
+ *          pid hash when it is destroyed.
+*/
+int pid_table_test() {
+	TEST_HEADER;
+
+	static pcb_t* procs[PID_TABLE_TEST_PROCS];
+	uint32_t i, j;
+
+	/* More processes than the old fixed table, each on its own stack */
+	for (i = 0; i < PID_TABLE_TEST_PROCS; i++) {
+		procs[i] = alloc_pcb();
+		if (procs[i] == NULL || ((uint32_t)procs[i] & (KSTACK_SIZE - 1)) || procs[i]->page == NULL) {
+			return FAIL;
+		}
+		if (get_pcb_by_pid(procs[i]->id) != procs[i]) {
+			return FAIL;
+		}
+		for (j = 0; j < i; j++) {
+			if (procs[j]->id == procs[i]->id || procs[j]->page == procs[i]->page) {
+				return FAIL;
+			}
+		}
+	}
+
+	/* Destroyed processes leave the pid hash, the rest stay reachable */
+	uint32_t pid = procs[0]->id;
+	pcb_destroy(procs[0]);
+	free_pcb(procs[0]);
+	if (get_pcb_by_pid(pid) != NULL || get_pcb_by_pid(procs[1]->id) != procs[1]) {
+		return FAIL;
+	}
+	for (i = 1; i < PID_TABLE_TEST_PROCS; i++) {
+		pid = procs[i]->id;
+		pcb_destroy(procs[i]);
+		free_pcb(procs[i]);
+		if (get_pcb_by_pid(pid) != NULL) {
+			return FAIL;
+		}
+	}
+
+	return PASS;
+}
+
+/**
+ * @brief waitpid test
+ * 
+ * @details A running child is left alone under WNOHANG, a zombie hands
+ *          over its exit status and leaves the pid hash, and a parent
+ *          without children gets -1. The status word lives on the
+ *          parent's user stack, a kernel address is refused.
+*/
+int waitpid_test() {
+	TEST_HEADER;
+
+	int32_t kernel_status;
+	pcb_t* parent = get_curr_pcb();
+	if (pcb_create(parent) || read_header((uint8_t*)"shell") || load_program((uint8_t*)"shell", parent)) {
+		return FAIL;
+	}
+	load_page_directory((uint32_t*)get_proc_page(parent->id)->proc_pdirectory);
+	int32_t* status = (int32_t*)(USER_SPACE_PROG_END - sizeof(int32_t));
+	*status = 0;
+
+	pcb_t* child = alloc_pcb();
+	if (child == NULL) {
+		return FAIL;
+	}
+	child->parent_pcb = parent;
+	child->spawned = 1;
+	uint32_t pid = child->id;
+
+	/* A running child is not reaped, WNOHANG returns at once */
+	if (pid == 0 || system_waitpid(pid, status, WNOHANG) != 0 || get_pcb_by_pid(pid) != child) {
+		return FAIL;
+	}
+	if (system_waitpid(pid + 1, status, WNOHANG) != -1) {
+		return FAIL;
+	}
+
+	/* A zombie hands over its status and leaves the pid hash */
+	child->exit_status = 7;
+	child->state = PROC_STATE_ZOMBIE;
+	if (system_waitpid(WAIT_ANY, &kernel_status, 0) != -1 || get_pcb_by_pid(pid) != child) {
+		return FAIL;
+	}
+	if (system_waitpid(WAIT_ANY, status, 0) != pid || *status != 7 || get_pcb_by_pid(pid) != NULL) {
+		return FAIL;
+	}
+
+	/* Nothing left to wait for */
+	if (system_waitpid(WAIT_ANY, NULL, WNOHANG) != -1) {
+		return FAIL;
+	}
+
+	load_kernel_page_directory();
+	pcb_destroy(parent);
+	return PASS;
+}
+
+/**
+ * @brief Background execute test
+ * 
+ * @details Walks the terminal foreground through execute and halt the way
+ *          the system calls hand it over. A spawned job running a program
+ *          must leave the shell in the foreground the whole time, while a
+ *          program the shell runs takes it and gives it back.
+*/
+int background_execute_test() {
+	TEST_HEADER;
+
+	pcb_t* shell = get_curr_pcb();
+	uint8_t idx = shell->tcb_idx;
+	pcb_t* saved = tcb_get_pcb(idx);
+	tcb_set_pcb(idx, shell);
+
+	pcb_t* job = alloc_pcb();
+	pcb_t* child = alloc_pcb();
+	if (job == NULL || child == NULL) {
+		return FAIL;
+	}
+	job->parent_pcb = shell;
+	job->tcb_idx = idx;
+	job->spawned = 1;
+	child->parent_pcb = job;
+	child->tcb_idx = idx;
+
+	/* The job's child neither takes the foreground nor hands it to the job */
+	if (tcb_pass_pcb(job, child) != -1 || tcb_get_pcb(idx) != shell) {
+		return FAIL;
+	}
+	if (tcb_pass_pcb(child, job) != -1 || tcb_get_pcb(idx) != shell) {
+		return FAIL;
+	}
+
+	/* A program run from the shell does, and gives it back on halt */
+	child->parent_pcb = shell;
+	if (tcb_pass_pcb(shell, child) || tcb_get_pcb(idx) != child) {
+		return FAIL;
+	}
+	if (tcb_pass_pcb(child, shell) || tcb_get_pcb(idx) != shell) {
+		return FAIL;
+	}
+
+	pcb_destroy(child);
+	free_pcb(child);
+	pcb_destroy(job);
+	free_pcb(job);
+	tcb_set_pcb(idx, saved);
+	return PASS;
+}
+
 int ioctl_test() {
 	/* Call terminal output mode ioctl */
 	uint32_t stdin = 0;
@@ -979,6 +2266,31 @@ void launch_tests(){
 #if EXTRA_TESTS
 	// TEST_OUTPUT("spinlock test", spinlock_test());
 	// TEST_OUTPUT("dynamic allocation test", slab_cache_basic_test());
+	// TEST_OUTPUT("buddy page allocation test", buddy_page_test());
+	// TEST_OUTPUT("slab allocation benchmark", slab_alloc_benchmark());
+	// TEST_OUTPUT("slab size class test", slab_size_class_test());
+	// TEST_OUTPUT("user heap reclaim test", uheap_reclaim_test());
+	// TEST_OUTPUT("object cache test", kmem_cache_test());
+	// TEST_OUTPUT("read_data benchmark", read_data_benchmark());
+	// TEST_OUTPUT("dentry lookup benchmark", dentry_lookup_benchmark());
+	// TEST_OUTPUT("extent file test", extent_file_test());
+	// TEST_OUTPUT("path lookup test", path_lookup_test());
+	// TEST_OUTPUT("directory growth test", dir_growth_test());
+	// TEST_OUTPUT("file data page test", file_data_page_test());
+	// TEST_OUTPUT("demand paging test", demand_paging_test());
+	// TEST_OUTPUT("elf segment test", elf_segment_test());
+	// TEST_OUTPUT("shared text test", shared_text_test());
+	// TEST_OUTPUT("running image test", running_image_test());
+	// TEST_OUTPUT("getdents test", getdents_test());
+	// TEST_OUTPUT("random access test", random_access_test());
+	// TEST_OUTPUT("wait queue test", wait_queue_test());
+	// TEST_OUTPUT("run queue test", run_queue_test());
+	// TEST_OUTPUT("procstat test", procstat_test());
+	// TEST_OUTPUT("pid table test", pid_table_test());
+	// TEST_OUTPUT("waitpid test", waitpid_test());
+	// TEST_OUTPUT("mmap truncate test", mmap_truncate_test());
+	// TEST_OUTPUT("background execute test", background_execute_test());
+	// TEST_OUTPUT("proc page test", proc_page_test());
 	TEST_OUTPUT("ioctl base test", ioctl_test());
 #endif
 
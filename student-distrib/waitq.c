@@ -0,0 +1,84 @@
+#include "waitq.h"
+#include "lib.h"
+#include "switch.h"
+#include "proc/PCB.h"
+
+/**
+ * @brief Mark a process blocked and add it to a wait queue
+ * 
+ * @param queue Wait queue
+ * @param pcb Process to block
+ * 
+ * @return Function status
+*/
+int32_t wait_queue_add(wait_queue_t* queue, pcb_t* pcb)
+{
+    /* Parse arguments */
+    if (queue == NULL || pcb == NULL) { return -1; }
+
+    pcb->state = PROC_STATE_BLOCKED;
+    pcb->wait_next = queue->head;
+    queue->head = pcb;
+
+    return 0;
+}
+
+/**
+ * @brief Block the current process on a wait queue until it is woken
+ * 
+ * @param queue Wait queue
+ * 
+ * @return Function status
+*/
+int32_t sleep_on(wait_queue_t* queue)
+{
+    pcb_t* pcb = get_curr_pcb();
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    if (wait_queue_add(queue, pcb)) {
+        restore_flags(flags);
+        return -1;
+    }
+
+    /* Give the rest of the timeslice away, this returns once we are woken and scheduled again */
+    while (pcb->state == PROC_STATE_BLOCKED) {
+        context_switch();
+    }
+
+    restore_flags(flags);
+
+    return 0;
+}
+
+/**
+ * @brief Make every process on a wait queue runnable, and empty the queue
+ * 
+ * @details The sleepers go onto the run queues ahead of CPU bound processes
+ * 
+ * @param queue Wait queue
+ * 
+ * @return Function status
+*/
+int32_t wake_up(wait_queue_t* queue)
+{
+    /* Parse argument */
+    if (queue == NULL) { return -1; }
+
+    uint32_t flags;
+    cli_and_save(flags);
+
+    pcb_t* pcb = queue->head;
+    while (pcb != NULL) {
+        pcb_t* next = pcb->wait_next;
+        pcb->wait_next = NULL;
+        sched_wake(pcb);
+        pcb = next;
+    }
+    queue->head = NULL;
+
+    restore_flags(flags);
+
+    return 0;
+}
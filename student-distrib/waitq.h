@@ -0,0 +1,48 @@
+#ifndef _WAITQ_H_
+#define _WAITQ_H_
+
+#include "types.h"
+
+struct pcb_t;
+
+#define WAIT_QUEUE_INIT { NULL }
+
+/* Processes asleep on an event, linked through pcb_t.wait_next */
+typedef struct wait_queue_t {
+    struct pcb_t* head;
+} wait_queue_t;
+
+/**
+ * @brief Mark a process blocked and add it to a wait queue
+ * 
+ * @param queue Wait queue
+ * @param pcb Process to block
+ * 
+ * @return Function status
+*/
+int32_t wait_queue_add(wait_queue_t* queue, struct pcb_t* pcb);
+
+/**
+ * @brief Block the current process on a wait queue until it is woken
+ * 
+ * @details Must be called with interrupts disabled, after the caller has
+ *          checked its wakeup condition, so a wakeup cannot be lost in
+ *          between. The scheduler skips the process while it is blocked.
+ *          Callers recheck their condition in a loop.
+ * 
+ * @param queue Wait queue
+ * 
+ * @return Function status
+*/
+int32_t sleep_on(wait_queue_t* queue);
+
+/**
+ * @brief Make every process on a wait queue runnable, and empty the queue
+ * 
+ * @param queue Wait queue
+ * 
+ * @return Function status
+*/
+int32_t wake_up(wait_queue_t* queue);
+
+#endif /* _WAITQ_H_ */
@@ -4,19 +4,61 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
-#define SBUFSIZE 33
+#define DIRENT_BATCH 64 /* a full root directory in one call */
+#define FILE_TYPE_REG 2
+
+/* 
+ * Search the length bytes of a file mapped by ece391_mmap. Lines are
+ * printed straight from the mapping since it cannot be written to.
+ */
+void
+search_mapped (const char* s, int32_t s_len, const char* fname, const uint8_t* data, uint32_t length)
+{
+    const uint8_t* line;
+    const uint8_t* end;
+    const uint8_t* check;
+    const uint8_t* data_end = data + length;
+
+    for (line = data; line < data_end; line = end + 1) {
+        for (end = line; end < data_end && '\n' != *end; end++);
+	for (check = line; check + s_len <= end; check++) {
+	    if (s[0] == *check &&
+	        0 == ece391_strncmp ((uint8_t*)check, (uint8_t*)s, s_len)) {
+		ece391_fdputs (1, (uint8_t*)fname);
+		ece391_fdputs (1, (uint8_t*)":");
+		ece391_write (1, line, end - line);
+		ece391_fdputs (1, (uint8_t*)"\n");
+		break;
+	    }
+	}
+    }
+}
 
 int32_t
 do_one_file (const char* s, const char* fname) 
 {
-    int32_t fd, cnt, last, line_start, line_end, check, s_len;
+    int32_t fd, cnt, last, line_start, line_end, check, s_len, map;
     uint8_t data[BUFSIZE+1];
+    ece391_stat_t stat;
 
     s_len = ece391_strlen ((uint8_t*)s);
     if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
         ece391_fdputs (1, (uint8_t*)"file open failed\n");
         return -1;
     }
+
+    /* Regular files are searched in place, anything else is read */
+    if (-1 != ece391_fstat (fd, &stat) && 0 != stat.size &&
+        -1 != (map = ece391_mmap (fd, stat.size))) {
+        search_mapped (s, s_len, fname, (const uint8_t*)map, stat.size);
+	ece391_munmap ((void*)map);
+	if (-1 == ece391_close (fd)) {
+	    ece391_fdputs (1, (uint8_t*)"file close failed\n");
+	    return -1;
+	}
+	return 0;
+    }
+
     last = 0;
     while (1) {
         cnt = ece391_read (fd, data + last, BUFSIZE - last);
@@ -67,8 +109,8 @@ do_one_file (const char* s, const char* fname)
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i;
+    ece391_dirent_t entries[DIRENT_BATCH];
     uint8_t search[BUFSIZE];
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
@@ -81,16 +123,17 @@ int main ()
 	return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, entries, sizeof (entries)))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	    return 3;
 	}
-	if ('.' == buf[0]) /* a directory... */
-	    continue;
-	buf[cnt] = '\0';
-	if (0 != do_one_file ((char*)search, (char*)buf))
-	    return 3;
+	for (i = 0; i < cnt / (int32_t)sizeof (ece391_dirent_t); i++) {
+	    if (FILE_TYPE_REG != entries[i].filetype) /* a directory or the rtc... */
+	        continue;
+	    if (0 != do_one_file ((char*)search, (char*)entries[i].filename))
+	        return 3;
+	}
     }
 
     return 0;
@@ -3,25 +3,40 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define PATHSIZE 1024
+#define DIRENT_BATCH 64 /* a full root directory in one call */
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i, len, out_len;
+    ece391_dirent_t entries[DIRENT_BATCH];
+    uint8_t out[DIRENT_BATCH * sizeof (entries[0].filename)];
+    uint8_t path[PATHSIZE];
 
-    if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
+    /* List the directory given as an a/b/c path, or the root */
+    if (0 != ece391_getargs (path, PATHSIZE) || '\0' == path[0]) {
+        ece391_strcpy (path, (uint8_t*)".");
+    }
+
+    if (-1 == (fd = ece391_open (path))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    /* One getdents and one write per batch of names */
+    while (0 != (cnt = ece391_getdents (fd, entries, sizeof (entries)))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
+	    out_len = 0;
+	    for (i = 0; i < cnt / (int32_t)sizeof (ece391_dirent_t); i++) {
+	        len = ece391_strlen (entries[i].filename);
+	        ece391_strcpy (out + out_len, entries[i].filename);
+	        out[out_len + len] = '\n';
+	        out_len += len + 1;
+	    }
+	    if (-1 == ece391_write (1, out, out_len))
 	        return 3;
     }
 
@@ -0,0 +1,178 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/*
+ * meminfo             print live/peak/failed/fragmentation per slab class and buddy order
+ * meminfo track on    start recording the pid and caller of each kmalloc()
+ * meminfo track off   stop recording
+ * meminfo leaks       print the recorded objects that are still live
+ * meminfo caches      print live/peak/failed/fragmentation per named object cache
+ */
+
+/* Must match the KMEM_IOCTL_* interface in student-distrib/alloc.h */
+#define KMEM_IOCTL_GET_STATS        16
+#define KMEM_IOCTL_SET_TRACKING     17
+#define KMEM_IOCTL_GET_RECORDS      18
+#define KMEM_IOCTL_GET_CACHES       19
+#define KMEM_KIND_SLAB              0
+#define KMEM_TRACK_NO_PID           0xFFFFFFFF
+#define KMEM_CACHE_NAME_LEN         16
+
+#define MAX_CLASSES     32
+#define MAX_RECORDS     256
+#define MAX_CACHES      32
+#define ARGBUFSIZE      128
+#define NUMBUFSIZE      33
+
+typedef struct kmem_ioctl_buf_t {
+    void* buf;
+    uint32_t count;
+} kmem_ioctl_buf_t;
+
+typedef struct kmem_stats_t {
+    uint32_t live;
+    uint32_t peak;
+    uint32_t failed;
+    uint32_t frag_bytes;
+} kmem_stats_t;
+
+typedef struct kmem_class_info_t {
+    uint32_t kind;
+    uint32_t size;
+    kmem_stats_t stats;
+} kmem_class_info_t;
+
+typedef struct kmem_cache_info_t {
+    uint8_t name[KMEM_CACHE_NAME_LEN];
+    uint32_t size;
+    uint32_t stride;
+    uint32_t num_slabs;
+    kmem_stats_t stats;
+} kmem_cache_info_t;
+
+typedef struct kmem_track_t {
+    uint32_t addr;
+    uint32_t size;
+    uint32_t caller;
+    uint32_t pid;
+} kmem_track_t;
+
+static kmem_class_info_t classes[MAX_CLASSES];
+static kmem_track_t records[MAX_RECORDS];
+static kmem_cache_info_t caches[MAX_CACHES];
+
+static void put_num (uint32_t value, int32_t radix)
+{
+    uint8_t buf[NUMBUFSIZE];
+    ece391_fdputs (1, ece391_itoa (value, buf, radix));
+}
+
+static void put_col (uint32_t value)
+{
+    ece391_fdputs (1, (uint8_t*)"\t");
+    put_num (value, 10);
+}
+
+static int32_t print_stats (void)
+{
+    kmem_ioctl_buf_t req = { classes, MAX_CLASSES };
+    int32_t cnt, i;
+
+    if (-1 == (cnt = ece391_ioctl (0, KMEM_IOCTL_GET_STATS, (uint32_t)&req))) {
+        ece391_fdputs (1, (uint8_t*)"allocator stats unavailable\n");
+        return 2;
+    }
+
+    ece391_fdputs (1, (uint8_t*)"kind\tsize\tlive\tpeak\tfailed\tfrag\n");
+    for (i = 0; i < cnt; i++) {
+        ece391_fdputs (1, (uint8_t*)(classes[i].kind == KMEM_KIND_SLAB ? "slab" : "page"));
+        put_col (classes[i].size);
+        put_col (classes[i].stats.live);
+        put_col (classes[i].stats.peak);
+        put_col (classes[i].stats.failed);
+        put_col (classes[i].stats.frag_bytes);
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+
+    return 0;
+}
+
+static int32_t print_records (void)
+{
+    kmem_ioctl_buf_t req = { records, MAX_RECORDS };
+    int32_t cnt, i;
+
+    if (-1 == (cnt = ece391_ioctl (0, KMEM_IOCTL_GET_RECORDS, (uint32_t)&req))) {
+        ece391_fdputs (1, (uint8_t*)"allocation records unavailable\n");
+        return 2;
+    }
+
+    ece391_fdputs (1, (uint8_t*)"addr\t\tsize\tpid\tcaller\n");
+    for (i = 0; i < cnt; i++) {
+        put_num (records[i].addr, 16);
+        ece391_fdputs (1, (uint8_t*)"\t");
+        put_num (records[i].size, 10);
+        ece391_fdputs (1, (uint8_t*)"\t");
+        if (records[i].pid == KMEM_TRACK_NO_PID)
+            ece391_fdputs (1, (uint8_t*)"-");
+        else
+            put_num (records[i].pid, 10);
+        ece391_fdputs (1, (uint8_t*)"\t");
+        put_num (records[i].caller, 16);
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+
+    return 0;
+}
+
+static int32_t print_caches (void)
+{
+    kmem_ioctl_buf_t req = { caches, MAX_CACHES };
+    int32_t cnt, i;
+
+    if (-1 == (cnt = ece391_ioctl (0, KMEM_IOCTL_GET_CACHES, (uint32_t)&req))) {
+        ece391_fdputs (1, (uint8_t*)"object caches unavailable\n");
+        return 2;
+    }
+
+    ece391_fdputs (1, (uint8_t*)"name\t\tsize\tstride\tslabs\tlive\tpeak\tfailed\tfrag\n");
+    for (i = 0; i < cnt; i++) {
+        ece391_fdputs (1, caches[i].name);
+        ece391_fdputs (1, (uint8_t*)(ece391_strlen (caches[i].name) < 8 ? "\t" : ""));
+        put_col (caches[i].size);
+        put_col (caches[i].stride);
+        put_col (caches[i].num_slabs);
+        put_col (caches[i].stats.live);
+        put_col (caches[i].stats.peak);
+        put_col (caches[i].stats.failed);
+        put_col (caches[i].stats.frag_bytes);
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+
+    return 0;
+}
+
+int main ()
+{
+    uint8_t buf[ARGBUFSIZE];
+
+    if (-1 == ece391_getargs (buf, ARGBUFSIZE) || '\0' == buf[0])
+        return print_stats ();
+
+    if (0 == ece391_strcmp (buf, (uint8_t*)"leaks"))
+        return print_records ();
+
+    if (0 == ece391_strcmp (buf, (uint8_t*)"caches"))
+        return print_caches ();
+
+    if (0 == ece391_strcmp (buf, (uint8_t*)"track on") ||
+        0 == ece391_strcmp (buf, (uint8_t*)"track off")) {
+        uint32_t on = (0 == ece391_strcmp (buf, (uint8_t*)"track on"));
+        return (-1 == ece391_ioctl (0, KMEM_IOCTL_SET_TRACKING, on)) ? 2 : 0;
+    }
+
+    ece391_fdputs (1, (uint8_t*)"usage: meminfo [leaks | caches | track on | track off]\n");
+    return 3;
+}
@@ -4,14 +4,39 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
+#define NUMBUFSIZE 33
+
+static void put_job (int32_t pid, const uint8_t* msg)
+{
+    uint8_t num[NUMBUFSIZE];
+
+    ece391_fdputs (1, (uint8_t*)"[");
+    ece391_fdputs (1, ece391_itoa (pid, num, 10));
+    ece391_fdputs (1, (uint8_t*)"] ");
+    ece391_fdputs (1, msg);
+}
+
+/* Report background jobs that finished since the last prompt */
+static void reap_jobs ()
+{
+    int32_t pid, status;
+
+    while (0 < (pid = ece391_waitpid (WAIT_ANY, &status, WNOHANG))) {
+	if (256 == status)
+	    put_job (pid, (uint8_t*)"terminated by exception\n");
+	else
+	    put_job (pid, (uint8_t*)"done\n");
+    }
+}
 
 int main ()
 {
-    int32_t cnt, rval;
+    int32_t cnt, rval, background;
     uint8_t buf[BUFSIZE];
     ece391_fdputs (1, (uint8_t*)"Starting 391 Shell\n");
 
     while (1) {
+        reap_jobs ();
         ece391_fdputs (1, (uint8_t*)"391OS> ");
 	if (-1 == (cnt = ece391_read (0, buf, BUFSIZE-1))) {
 	    ece391_fdputs (1, (uint8_t*)"read from keyboard failed\n");
@@ -19,11 +44,28 @@ int main ()
 	}
 	if (cnt > 0 && '\n' == buf[cnt - 1])
 	    cnt--;
+	/* A trailing & runs the command in the background */
+	background = 0;
+	while (cnt > 0 && ' ' == buf[cnt - 1])
+	    cnt--;
+	if (cnt > 0 && '&' == buf[cnt - 1]) {
+	    background = 1;
+	    cnt--;
+	    while (cnt > 0 && ' ' == buf[cnt - 1])
+		cnt--;
+	}
 	buf[cnt] = '\0';
 	if (0 == ece391_strcmp (buf, (uint8_t*)"exit"))
 	    return 0;
 	if ('\0' == buf[0])
 	    continue;
+	if (background) {
+	    if (-1 == (rval = ece391_spawn (buf)))
+		ece391_fdputs (1, (uint8_t*)"no such command\n");
+	    else
+		put_job (rval, (uint8_t*)"started\n");
+	    continue;
+	}
 	rval = ece391_execute (buf);
 	if (-1 == rval)
 	    ece391_fdputs (1, (uint8_t*)"no such command\n");
@@ -21,6 +21,83 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+extern int32_t ece391_ioctl (int32_t fd, uint32_t command, uint32_t args);
+
+/*
+ * Maps up to length bytes of an open regular file read only and returns
+ * its address, or -1. The pages are the file system's own, so nothing
+ * is copied. Zeros follow the end of the file, so text can be scanned
+ * up to a NUL. ece391_munmap() takes the address back.
+ */
+extern int32_t ece391_mmap (int32_t fd, uint32_t length);
+extern int32_t ece391_munmap (void* addr);
+
+/*
+ * Lists a directory opened with ece391_open() in batches. Fills buf with
+ * as many entries as fit and returns the bytes used, 0 once every entry
+ * has been returned, or -1. Each call continues where the last one on
+ * the same fd stopped.
+ */
+typedef struct ece391_dirent_t {
+    uint32_t inode_num;
+    uint32_t filetype;		/* 0 rtc, 1 directory, 2 regular file */
+    uint32_t size;		/* length of a regular file, 0 otherwise */
+    uint8_t filename[33];	/* NUL terminated */
+} ece391_dirent_t;
+extern int32_t ece391_getdents (int32_t fd, ece391_dirent_t* buf, int32_t nbytes);
+
+/*
+ * Random access to an open regular file. ece391_pread() and
+ * ece391_pwrite() work at offset and leave the file position alone.
+ * ece391_lseek() returns the new position, which may be past the end of
+ * the file. ece391_fstat() fills in the type, inode and length of an
+ * open file, directory or rtc.
+ */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+typedef struct ece391_stat_t {
+    uint32_t inode_num;
+    uint32_t filetype;		/* 0 rtc, 1 directory, 2 regular file */
+    uint32_t size;		/* length of a regular file, 0 otherwise */
+} ece391_stat_t;
+extern int32_t ece391_pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+extern int32_t ece391_pwrite (int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
+extern int32_t ece391_lseek (int32_t fd, int32_t offset, int32_t whence);
+extern int32_t ece391_fstat (int32_t fd, ece391_stat_t* buf);
+
+/*
+ * Fills buf with up to count entries, one per live process and then one
+ * for the idle context, and returns the number filled in or -1. CPU time
+ * is counted in 10ms timer ticks.
+ */
+#define PROC_STATE_RUNNABLE 0
+#define PROC_STATE_BLOCKED 1
+#define PROC_STATE_IDLE 2
+#define PROC_STATE_ZOMBIE 3
+typedef struct ece391_proc_stat_t {
+    uint32_t pid;		/* 0xFFFFFFFF for the idle context */
+    uint32_t parent_pid;	/* pid itself without a parent */
+    uint32_t terminal;
+    uint32_t state;
+    uint32_t priority;		/* 0 is the most urgent */
+    uint32_t user_ticks;
+    uint32_t kernel_ticks;
+    uint8_t name[33];		/* NUL terminated */
+} ece391_proc_stat_t;
+extern int32_t ece391_procstat (ece391_proc_stat_t* buf, int32_t count);
+
+/*
+ * spawn starts a program in the background and returns its pid, or -1.
+ * The child shares the terminal and runs beside the caller. waitpid reaps
+ * a halted child and stores its halt status: pid WAIT_ANY takes any child,
+ * and WNOHANG returns 0 at once while the child is still running. It
+ * returns the child's pid, or -1 if there is no such child.
+ */
+#define WAIT_ANY (-1)
+#define WNOHANG 0x1
+extern int32_t ece391_spawn (const uint8_t* command);
+extern int32_t ece391_waitpid (int32_t pid, int32_t* status, uint32_t options);
 
 enum signums {
 	DIV_ZERO = 0,
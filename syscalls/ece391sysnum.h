@@ -11,5 +11,19 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_MALLOC  11
+#define SYS_FREE    12
+#define SYS_IOCTL   13
+#define SYS_SBRK    14
+#define SYS_MMAP    15
+#define SYS_MUNMAP  16
+#define SYS_GETDENTS 17
+#define SYS_PREAD    18
+#define SYS_PWRITE   19
+#define SYS_LSEEK    20
+#define SYS_FSTAT    21
+#define SYS_PROCSTAT 22
+#define SYS_SPAWN    23
+#define SYS_WAITPID  24
 
 #endif /* ECE391SYSNUM_H */
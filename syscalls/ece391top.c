@@ -0,0 +1,150 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/*
+ * top            redraw the process table once a second, 10 times
+ * top <count>    redraw it count times
+ *
+ * CPU% is each process's share of the timer ticks since the last redraw,
+ * idle included.
+ */
+
+#define MAX_PROCS       16
+#define SCREEN_ROWS     25
+#define DEFAULT_COUNT   10
+#define RTC_HZ          1
+#define IDLE_PID        0xFFFFFFFF
+#define ARGBUFSIZE      128
+#define NUMBUFSIZE      33
+
+static ece391_proc_stat_t procs[MAX_PROCS];
+static ece391_proc_stat_t prev[MAX_PROCS];
+static int32_t num_prev;
+
+static void put_num (uint32_t value)
+{
+    uint8_t buf[NUMBUFSIZE];
+    ece391_fdputs (1, ece391_itoa (value, buf, 10));
+}
+
+static void put_col (uint32_t value)
+{
+    put_num (value);
+    ece391_fdputs (1, (uint8_t*)"\t");
+}
+
+static uint32_t parse_count (const uint8_t* s)
+{
+    uint32_t count = 0;
+
+    if ('\0' == *s)
+        return DEFAULT_COUNT;
+    while (*s >= '0' && *s <= '9')
+        count = count * 10 + (*s++ - '0');
+    return ('\0' == *s) ? count : 0;
+}
+
+/* Ticks used since the last redraw, a reused pid starts from zero */
+static uint32_t ticks_since (const ece391_proc_stat_t* p)
+{
+    uint32_t now = p->user_ticks + p->kernel_ticks;
+    int32_t i;
+
+    for (i = 0; i < num_prev; i++) {
+        if (prev[i].pid != p->pid || 0 != ece391_strcmp (prev[i].name, p->name))
+            continue;
+        if (prev[i].user_ticks + prev[i].kernel_ticks > now)
+            break;
+        return now - (prev[i].user_ticks + prev[i].kernel_ticks);
+    }
+    return now;
+}
+
+static const uint8_t* state_name (uint32_t state)
+{
+    switch (state) {
+        case PROC_STATE_RUNNABLE: return (uint8_t*)"run";
+        case PROC_STATE_BLOCKED: return (uint8_t*)"sleep";
+        case PROC_STATE_IDLE: return (uint8_t*)"idle";
+        case PROC_STATE_ZOMBIE: return (uint8_t*)"zombie";
+        default: return (uint8_t*)"?";
+    }
+}
+
+static int32_t redraw (void)
+{
+    uint32_t delta[MAX_PROCS];
+    uint32_t total = 0;
+    int32_t cnt, i, rows;
+
+    if (-1 == (cnt = ece391_procstat (procs, MAX_PROCS))) {
+        ece391_fdputs (1, (uint8_t*)"process table unavailable\n");
+        return -1;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        delta[i] = ticks_since (&procs[i]);
+        total += delta[i];
+    }
+
+    /* Every line starts with a newline, so a full screen scrolls the last table away */
+    ece391_fdputs (1, (uint8_t*)"\nPID\tPPID\tTTY\tSTATE\tPRIO\tUSER\tSYS\tCPU%\tNAME");
+    for (i = 0; i < cnt; i++) {
+        ece391_fdputs (1, (uint8_t*)"\n");
+        if (IDLE_PID == procs[i].pid) {
+            ece391_fdputs (1, (uint8_t*)"-\t-\t-\t");
+        } else {
+            put_col (procs[i].pid);
+            put_col (procs[i].parent_pid);
+            put_col (procs[i].terminal);
+        }
+        ece391_fdputs (1, state_name (procs[i].state));
+        ece391_fdputs (1, (uint8_t*)"\t");
+        put_col (procs[i].priority);
+        put_col (procs[i].user_ticks);
+        put_col (procs[i].kernel_ticks);
+        put_col (total ? delta[i] * 100 / total : 0);
+        ece391_fdputs (1, procs[i].name);
+    }
+    for (rows = cnt + 1; rows < SCREEN_ROWS; rows++)
+        ece391_fdputs (1, (uint8_t*)"\n");
+
+    for (i = 0; i < cnt; i++)
+        prev[i] = procs[i];
+    num_prev = cnt;
+
+    return 0;
+}
+
+int main ()
+{
+    uint8_t buf[ARGBUFSIZE];
+    int32_t rtc_fd, garbage, rate = RTC_HZ;
+    uint32_t count;
+
+    if (-1 == ece391_getargs (buf, ARGBUFSIZE))
+        buf[0] = '\0';
+    if (0 == (count = parse_count (buf))) {
+        ece391_fdputs (1, (uint8_t*)"usage: top [count]\n");
+        return 3;
+    }
+
+    if (-1 == (rtc_fd = ece391_open ((uint8_t*)"rtc")) ||
+        -1 == ece391_write (rtc_fd, &rate, sizeof (rate))) {
+        ece391_fdputs (1, (uint8_t*)"rtc unavailable\n");
+        return 2;
+    }
+
+    while (count--) {
+        if (-1 == redraw ())
+            return 2;
+        if (count)
+            ece391_read (rtc_fd, &garbage, sizeof (garbage));
+    }
+    ece391_fdputs (1, (uint8_t*)"\n");
+
+    ece391_close (rtc_fd);
+    return 0;
+}
@@ -4,13 +4,20 @@
 #include "ece391syscall.h"
 
 #define SBUFSIZE 33
+#define PATHSIZE 1024
 
 int main ()
 {
     int32_t fd, cnt;
     uint8_t buf[SBUFSIZE];
+    uint8_t path[PATHSIZE];
 
-    if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
+    /* List the directory given as an a/b/c path, or the root */
+    if (0 != ece391_getargs (path, PATHSIZE) || '\0' == path[0]) {
+        ece391_strcpy (path, (uint8_t*)".");
+    }
+
+    if (-1 == (fd = ece391_open (path))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
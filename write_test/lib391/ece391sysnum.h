@@ -14,5 +14,16 @@
 #define SYS_MALLOC          11
 #define SYS_FREE            12
 #define SYS_IOCTL           13
+#define SYS_SBRK            14
+#define SYS_MMAP            15
+#define SYS_MUNMAP          16
+#define SYS_GETDENTS        17
+#define SYS_PREAD           18
+#define SYS_PWRITE          19
+#define SYS_LSEEK           20
+#define SYS_FSTAT           21
+#define SYS_PROCSTAT        22
+#define SYS_SPAWN           23
+#define SYS_WAITPID         24
 
 #endif /* _ECE391SYSNUM_H_ */